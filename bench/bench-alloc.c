@@ -0,0 +1,426 @@
+/*
+ * log-malloc2 allocation benchmark
+ *	Multi-threaded allocation patterns for measuring interposer overhead
+ *	(run it with and without preloaded library, see bench-alloc.sh).
+ *
+ * Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+ *
+ * License: GNU LGPLv3 (http://www.gnu.org/licenses/lgpl.html)
+ *
+ * Web:
+ *	http://devel.dob.sk/log-malloc2
+ *	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+ *	https://github.com/samsk/log-malloc2 (git repo)
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+/* live blocks per thread */
+#define SLOTS		256
+/* producer/consumer queue size (power of 2) */
+#define QUEUE_SIZE	1024
+/* every n-th op latency is measured */
+#define LAT_SAMPLE	8
+/* latency histogram (log-linear, 16 sub-buckets per power of 2) */
+#define LAT_SUB_BITS	4
+#define LAT_BUCKETS	(64 + 40 * (1 << LAT_SUB_BITS))
+/* realloc growth limit */
+#define REALLOC_MAX	(64 * 1024)
+
+enum {
+	PATTERN_MIX,		/* size-class mix, random free order */
+	PATTERN_XFREE,		/* producer/consumer, cross-thread free */
+	PATTERN_REALLOC,	/* realloc growth */
+	PATTERN_MEMALIGN,	/* posix_memalign, mixed alignment */
+};
+
+static const char *patterns[] = { "mix", "xfree", "realloc", "memalign", NULL };
+
+/* single producer single consumer pointer queue */
+struct queue_s {
+	volatile size_t head __attribute__((__aligned__(64)));
+	volatile size_t tail __attribute__((__aligned__(64)));
+	void *ptrs[QUEUE_SIZE];
+};
+
+struct worker_s {
+	int id;
+	int pattern;
+	unsigned long ops;
+	struct queue_s *queue;		/* xfree */
+	uint64_t rng;
+	uint64_t start, end;		/* ns */
+	uint64_t lat[LAT_BUCKETS];
+} __attribute__((__aligned__(64)));
+
+static pthread_barrier_t g_barrier;
+
+/* internal memory is mmap-ed, to not influence measured allocator */
+static void *bench_alloc(size_t size)
+{
+	void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if(mem == MAP_FAILED)
+	{
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	return mem;
+}
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* xorshift64* */
+static inline uint64_t rnd(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+/* size-class mix: 70% small, 25% medium, 5% large */
+static inline size_t rnd_size(uint64_t *state)
+{
+	const uint64_t r = rnd(state);
+	const unsigned int cls = (r >> 32) % 100;
+
+	if(cls < 70)
+		return 16 + r % 113;
+	else if(cls < 95)
+		return 129 + r % 3968;
+	return 4097 + r % 61440;
+}
+
+static inline unsigned int lat_bucket(uint64_t ns)
+{
+	int exp;
+
+	if(ns < 64)
+		return ns;
+
+	exp = 63 - __builtin_clzll(ns);
+	if(exp > 45)
+		return LAT_BUCKETS - 1;
+	return 64 + (exp - 6) * (1 << LAT_SUB_BITS)
+		+ ((ns >> (exp - LAT_SUB_BITS)) & ((1 << LAT_SUB_BITS) - 1));
+}
+
+static inline uint64_t lat_value(unsigned int bucket)
+{
+	unsigned int exp, sub;
+
+	if(bucket < 64)
+		return bucket;
+
+	exp = (bucket - 64) / (1 << LAT_SUB_BITS) + 6;
+	sub = (bucket - 64) % (1 << LAT_SUB_BITS);
+	return (1ULL << exp) + ((uint64_t)sub << (exp - LAT_SUB_BITS));
+}
+
+/* measured op (latency sampled) */
+#define OP(w, n, stmt)						\
+	do {							\
+		if(((n) & (LAT_SAMPLE - 1)) == 0)		\
+		{						\
+			const uint64_t __t = now_ns();		\
+			stmt;					\
+			(w)->lat[lat_bucket(now_ns() - __t)]++;	\
+		}						\
+		else						\
+			stmt;					\
+	} while(0)
+
+static void run_mix(struct worker_s *w, void **slots)
+{
+	unsigned long n;
+
+	for(n = 0; n < w->ops; n++)
+	{
+		const unsigned int idx = rnd(&w->rng) % SLOTS;
+
+		if(slots[idx])
+		{
+			OP(w, n, free(slots[idx]));
+			slots[idx] = NULL;
+		}
+		else
+		{
+			const size_t size = rnd_size(&w->rng);
+
+			OP(w, n, slots[idx] = malloc(size));
+			*(volatile char *)slots[idx] = 1;
+		}
+	}
+}
+
+static void run_memalign(struct worker_s *w, void **slots)
+{
+	unsigned long n;
+
+	for(n = 0; n < w->ops; n++)
+	{
+		const unsigned int idx = rnd(&w->rng) % SLOTS;
+
+		if(slots[idx])
+		{
+			OP(w, n, free(slots[idx]));
+			slots[idx] = NULL;
+		}
+		else
+		{
+			const uint64_t r = rnd(&w->rng);
+			const size_t align = (size_t)16 << (r % 9);	/* 16 - 4096 */
+			const size_t size = 16 + (r >> 8) % 1009;
+			int ret;
+
+			OP(w, n, ret = posix_memalign(&slots[idx], align, size));
+			if(ret != 0)
+				slots[idx] = NULL;
+		}
+	}
+}
+
+static void run_realloc(struct worker_s *w)
+{
+	unsigned long n;
+	size_t size = 0;
+	char *ptr = NULL;
+
+	for(n = 0; n < w->ops; n++)
+	{
+		if(size >= REALLOC_MAX)
+		{
+			OP(w, n, free(ptr));
+			ptr = NULL;
+			size = 0;
+		}
+		else
+		{
+			size = (size) ? size + size / 2 : 16;
+			OP(w, n, ptr = realloc(ptr, size));
+			ptr[size - 1] = 1;
+		}
+	}
+	free(ptr);
+}
+
+/* even workers produce, odd workers consume (and free) */
+static void run_xfree(struct worker_s *w)
+{
+	unsigned long n;
+	struct queue_s *q = w->queue;
+
+	for(n = 0; n < w->ops; n++)
+	{
+		if((w->id & 1) == 0)
+		{
+			void *ptr;
+			const size_t head = q->head;
+
+			while(head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) >= QUEUE_SIZE)
+				sched_yield();
+
+			OP(w, n, ptr = malloc(rnd_size(&w->rng)));
+			q->ptrs[head & (QUEUE_SIZE - 1)] = ptr;
+			__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+		}
+		else
+		{
+			void *ptr;
+			const size_t tail = q->tail;
+
+			while(__atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == tail)
+				sched_yield();
+
+			ptr = q->ptrs[tail & (QUEUE_SIZE - 1)];
+			__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+			OP(w, n, free(ptr));
+		}
+	}
+}
+
+static void *worker(void *arg)
+{
+	int ii;
+	struct worker_s *w = arg;
+	void **slots = bench_alloc(SLOTS * sizeof(*slots));
+
+	pthread_barrier_wait(&g_barrier);
+	w->start = now_ns();
+
+	switch(w->pattern)
+	{
+		case PATTERN_MIX:
+			run_mix(w, slots);
+			break;
+
+		case PATTERN_XFREE:
+			run_xfree(w);
+			break;
+
+		case PATTERN_REALLOC:
+			run_realloc(w);
+			break;
+
+		case PATTERN_MEMALIGN:
+			run_memalign(w, slots);
+			break;
+	}
+
+	w->end = now_ns();
+
+	for(ii = 0; ii < SLOTS; ii++)
+		free(slots[ii]);
+	munmap(slots, SLOTS * sizeof(*slots));
+	return NULL;
+}
+
+static uint64_t percentile(const uint64_t *lat, uint64_t total, double pct)
+{
+	unsigned int ii;
+	uint64_t sum = 0;
+	const uint64_t want = total * pct / 100.0;
+
+	for(ii = 0; ii < LAT_BUCKETS; ii++)
+	{
+		sum += lat[ii];
+		if(sum > want)
+			return lat_value(ii);
+	}
+	return lat_value(LAT_BUCKETS - 1);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-t threads] [-n ops-per-thread] [-p mix|xfree|realloc|memalign] [-H]\n",
+		prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	int ii, opt;
+	int threads = 1;
+	int pattern = PATTERN_MIX;
+	int header = 0;
+	unsigned long ops = 100000;
+	uint64_t elapsed = 0, total = 0;
+	uint64_t wall_start = UINT64_MAX, wall_end = 0;
+	uint64_t lat[LAT_BUCKETS];
+	pthread_t *tids;
+	struct worker_s *workers;
+	struct queue_s *queues;
+
+	while((opt = getopt(argc, argv, "t:n:p:H")) != -1)
+	{
+		switch(opt)
+		{
+			case 't':
+				threads = atoi(optarg);
+				break;
+
+			case 'n':
+				ops = strtoul(optarg, NULL, 10);
+				break;
+
+			case 'p':
+				for(pattern = 0; patterns[pattern]; pattern++)
+					if(strcmp(patterns[pattern], optarg) == 0)
+						break;
+				if(patterns[pattern] == NULL)
+					usage(argv[0]);
+				break;
+
+			case 'H':
+				header = 1;
+				break;
+
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	if(threads < 1 || ops == 0)
+		usage(argv[0]);
+	/* producer needs consumer */
+	if(pattern == PATTERN_XFREE && (threads & 1))
+		threads++;
+
+	tids    = bench_alloc(threads * sizeof(*tids));
+	workers = bench_alloc(threads * sizeof(*workers));
+	queues  = bench_alloc((threads / 2 + 1) * sizeof(*queues));
+
+	pthread_barrier_init(&g_barrier, NULL, threads + 1);
+	for(ii = 0; ii < threads; ii++)
+	{
+		workers[ii].id      = ii;
+		workers[ii].pattern = pattern;
+		workers[ii].ops     = ops;
+		workers[ii].queue   = &queues[ii / 2];
+		workers[ii].rng     = 0x9E3779B97F4A7C15ULL * (ii + 1);
+
+		if(pthread_create(&tids[ii], NULL, worker, &workers[ii]) != 0)
+		{
+			perror("pthread_create");
+			return EXIT_FAILURE;
+		}
+	}
+
+	pthread_barrier_wait(&g_barrier);
+	for(ii = 0; ii < threads; ii++)
+		pthread_join(tids[ii], NULL);
+
+	memset(lat, 0, sizeof(lat));
+	for(ii = 0; ii < threads; ii++)
+	{
+		unsigned int jj;
+
+		elapsed += workers[ii].end - workers[ii].start;
+		if(workers[ii].start < wall_start)
+			wall_start = workers[ii].start;
+		if(workers[ii].end > wall_end)
+			wall_end = workers[ii].end;
+		for(jj = 0; jj < LAT_BUCKETS; jj++)
+		{
+			lat[jj] += workers[ii].lat[jj];
+			total   += workers[ii].lat[jj];
+		}
+	}
+
+	if(header)
+		printf("%-9s %7s %10s %8s %8s %8s %9s\n",
+			"pattern", "threads", "ops", "ns/op", "p50", "p99", "Mops/s");
+	printf("%-9s %7d %10lu %8.1f %8" PRIu64 " %8" PRIu64 " %9.2f\n",
+		patterns[pattern], threads, ops * threads,
+		(double)elapsed / (ops * threads),
+		percentile(lat, total, 50), percentile(lat, total, 99),
+		(ops * threads) * 1000.0 / (wall_end - wall_start));
+	return 0;
+}
+
+/* EOF */
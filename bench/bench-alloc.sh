@@ -0,0 +1,99 @@
+#!/bin/bash
+#
+# log-malloc2 interposer overhead benchmark
+#	Runs bench-alloc patterns in all modes (no preload, preloaded library
+#	with trace disabled, pass-through mode, trace without backtraces, full
+#	trace, trace without backtraces with cached statm) and for 1 to N threads.
+#
+# Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+#
+# License: GNU GPLv3 (http://www.gnu.org/licenses/gpl.html)
+#
+# Web:
+#	http://devel.dob.sk/log-malloc2
+#	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+#	https://github.com/samsk/log-malloc2 (git repo)
+#
+# Environment:
+#	LIB		library to preload (default ../.libs/liblog-malloc2.so)
+#	THREADS		max. thread count (default number of cpus)
+#	OPS		ops per thread (default 50000)
+#	PATTERNS	patterns to run (default mix xfree realloc memalign)
+#	MODES		modes to run (default none preload passthrough trace-nobt trace trace-nobt-statm-cache trace-nobt-free-batch trace-nobt-headerless)
+#
+
+BENCH=${BENCH:-./bench-alloc}
+LIB=${LIB:-../.libs/liblog-malloc2.so}
+THREADS=${THREADS:-$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 4)}
+OPS=${OPS:-50000}
+PATTERNS=${PATTERNS:-mix xfree realloc memalign}
+MODES=${MODES:-none preload passthrough trace-nobt trace trace-nobt-statm-cache trace-nobt-free-batch trace-nobt-headerless}
+TRACE=$(mktemp "${TMPDIR:-/tmp}/log-malloc-bench.XXXXXX") || exit 1
+
+trap 'rm -f "$TRACE"' EXIT INT TERM
+
+if [ ! -f "$LIB" ]; then
+	echo "$0: library '$LIB' not found (set LIB)" >&2
+	exit 1
+fi
+
+# thread counts 1, 2, 4 ... THREADS
+thread_counts() {
+	t=1
+	while [ $t -lt "$THREADS" ]; do
+		echo $t
+		t=$((t * 2))
+	done
+	echo "$THREADS"
+}
+
+# run_mode <mode> <bench args> (prints result line and trace bytes)
+run_mode() {
+	mode=$1
+	shift
+	: > "$TRACE"
+	case $mode in
+	none)
+		out=$("$BENCH" "$@") ;;
+	preload)
+		out=$(LD_PRELOAD=$LIB "$BENCH" "$@") ;;
+	passthrough)
+		out=$(LOG_MALLOC_PASSTHROUGH=1 LD_PRELOAD=$LIB "$BENCH" "$@" 1022>"$TRACE") ;;
+	trace-nobt)
+		out=$(LOG_MALLOC_UNWIND=none LD_PRELOAD=$LIB "$BENCH" "$@" 1022>"$TRACE") ;;
+	trace)
+		out=$(LD_PRELOAD=$LIB "$BENCH" "$@" 1022>"$TRACE") ;;
+	trace-nobt-statm-cache)
+		out=$(LOG_MALLOC_STATM_CACHE=10 LOG_MALLOC_UNWIND=none LD_PRELOAD=$LIB "$BENCH" "$@" 1022>"$TRACE") ;;
+	trace-nobt-free-batch)
+		out=$(LOG_MALLOC_FREE_BATCH=64 LOG_MALLOC_UNWIND=none LD_PRELOAD=$LIB "$BENCH" "$@" 1022>"$TRACE") ;;
+	trace-nobt-headerless)
+		out=$(LOG_MALLOC_HEADERLESS=1 LOG_MALLOC_UNWIND=none LD_PRELOAD=$LIB "$BENCH" "$@" 1022>"$TRACE") ;;
+	*)
+		echo "$0: unknown mode '$mode'" >&2
+		exit 1 ;;
+	esac
+	echo "$out $(wc -c < "$TRACE")"
+}
+
+for mode in $MODES; do
+	echo "# mode=$mode ops/thread=$OPS"
+	printf "%-9s %7s %10s %8s %8s %8s %9s %6s %8s\n" \
+		pattern threads ops ns/op p50 p99 Mops/s scale B/op
+	for pattern in $PATTERNS; do
+		for t in $(thread_counts); do
+			run_mode "$mode" -p "$pattern" -t "$t" -n "$OPS" || exit 1
+		done | awk '
+			$2 == last { next }	# xfree rounds up to even threads
+			NR == 1 { base = $7 }
+			{ last = $2 }
+			{
+				printf("%-9s %7d %10d %8.1f %8d %8d %9.2f %6.2f %8.1f\n",
+					$1, $2, $3, $4, $5, $6, $7,
+					(base > 0) ? $7 / base : 0, $8 / $3);
+			}'
+	done
+	echo
+done
+
+# EOF
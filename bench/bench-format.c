@@ -0,0 +1,228 @@
+/*
+ * log-malloc2 text record formatting microbenchmark
+ *	Compares snprintf() based event line formatting with library text
+ *	encoder, and checks that both produce same output.
+ *
+ * Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+ *
+ * License: GNU LGPLv3 (http://www.gnu.org/licenses/lgpl.html)
+ *
+ * Web:
+ *	http://devel.dob.sk/log-malloc2
+ *	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+ *	https://github.com/samsk/log-malloc2 (git repo)
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "log-malloc2.h"
+#include "log-malloc2_internal.h"
+
+#define EVENTS		4096
+#define ROUNDS		500
+#define LINE_SIZE	512
+
+/* format module needs library context */
+static log_malloc_ctx_t g_ctx = LOG_MALLOC_CTX_INIT;
+
+log_malloc_ctx_t *log_malloc_ctx_get(void)
+{
+	return &g_ctx;
+}
+
+ssize_t log_malloc_buffer_write(const char *data, size_t len)
+{
+	return len;
+}
+
+/* reference formatting (library up to 0.4.x) */
+static size_t format_snprintf(const log_malloc_event_t *ev, char *buf, size_t size)
+{
+	int s = 0;
+	const int64_t used  = ev->mem_used;
+	const int64_t rused = ev->mem_rused;
+
+	switch(ev->type)
+	{
+		case LOG_MALLOC_EV_MALLOC:
+			s = snprintf(buf, size, "+ malloc %zu %p [%" PRId64 ":%" PRId64 "]\n",
+				ev->size, ev->ptr,
+				used, rused);
+			break;
+
+		case LOG_MALLOC_EV_CALLOC:
+			s = snprintf(buf, size, "+ calloc %zu %p [%" PRId64 ":%" PRId64 "] (%zu %zu)\n",
+				ev->size, ev->ptr,
+				used, rused,
+				ev->arg1, ev->arg2);
+			break;
+
+		case LOG_MALLOC_EV_REALLOC:
+			s = snprintf(buf, size, "+ realloc %zd %p %p (%zu %zu) [%" PRId64 ":%" PRId64 "]\n",
+				ev->size, ev->optr,
+				ev->ptr, ev->arg1, ev->arg2,
+				used, rused);
+			break;
+
+		case LOG_MALLOC_EV_MEMALIGN:
+			s = snprintf(buf, size, "+ memalign %zu %p (%zu) [%" PRId64 ":%" PRId64 "]\n",
+				ev->size, ev->ptr,
+				ev->arg1,
+				used, rused);
+			break;
+
+		case LOG_MALLOC_EV_POSIX_MEMALIGN:
+			s = snprintf(buf, size, "+ posix_memalign %zu %p (%zu %zu : %d) [%" PRId64 ":%" PRId64 "]\n",
+				ev->size, ev->ptr,
+				ev->arg1, ev->arg2, ev->ret,
+				used, rused);
+			break;
+
+		case LOG_MALLOC_EV_VALLOC:
+			s = snprintf(buf, size, "+ valloc %zu %p [%" PRId64 ":%" PRId64 "]\n",
+				ev->size, ev->ptr,
+				used, rused);
+			break;
+
+		case LOG_MALLOC_EV_FREE:
+			s = snprintf(buf, size, (ev->foreign)
+					? "+ free -%zu %p [%" PRId64 ":%" PRId64 "] !f\n"
+					: "+ free -%zu %p [%" PRId64 ":%" PRId64 "]\n",
+				ev->size, ev->ptr,
+				used, rused);
+			break;
+	}
+
+	if(s >= size)
+		s = size - 1;
+	return s;
+}
+
+typedef size_t (*format_fn)(const log_malloc_event_t *ev, char *buf, size_t size);
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* random value of random magnitude (short and long numbers) */
+static uint64_t rnd(unsigned int *seed)
+{
+	const uint64_t val = ((uint64_t)rand_r(seed) << 42)
+		^ ((uint64_t)rand_r(seed) << 21) ^ rand_r(seed);
+
+	return val >> (rand_r(seed) % 64);
+}
+
+static void gen_events(log_malloc_event_t *evs, int count)
+{
+	int ii;
+	unsigned int seed = 42;
+
+	for(ii = 0; ii < count; ii++)
+	{
+		log_malloc_event_t *ev = &evs[ii];
+
+		memset(ev, 0, sizeof(*ev));
+		ev->type	= LOG_MALLOC_EV_MALLOC + (ii % (LOG_MALLOC_EV_FREE - LOG_MALLOC_EV_MALLOC + 1));
+		ev->foreign	= (ii % 3 == 0);
+		ev->ret		= (ii % 5 == 0) ? -(int)(rnd(&seed) & 0xffff) : (int)(rnd(&seed) & 0xffff);
+		ev->size	= (ev->type == LOG_MALLOC_EV_REALLOC && ii % 2) ? -(ssize_t)rnd(&seed) : (ssize_t)rnd(&seed);
+		ev->ptr		= (ii % 17 == 0) ? NULL : (void *)(uintptr_t)rnd(&seed);
+		ev->optr	= (ii % 13 == 0) ? NULL : (void *)(uintptr_t)rnd(&seed);
+		ev->arg1	= rnd(&seed);
+		ev->arg2	= rnd(&seed);
+		ev->mem_used	= (ii % 7 == 0) ? -(int64_t)(rnd(&seed) >> 1) : (int64_t)(rnd(&seed) >> 1);
+		ev->mem_rused	= (int64_t)(rnd(&seed) >> 1);
+	}
+
+	/* extremes */
+	evs[0].size = 0;
+	evs[1].mem_used = INT64_MIN;
+	evs[2].mem_rused = INT64_MAX;
+	evs[3].arg1 = UINT64_MAX;
+	evs[4].ret = -2147483647 - 1;
+	evs[5].ptr = (void *)UINTPTR_MAX;
+	return;
+}
+
+/* check encoder output (also truncated) */
+static int verify(const log_malloc_event_t *evs, int count)
+{
+	int ii;
+	size_t size;
+	char buf1[LINE_SIZE], buf2[LINE_SIZE];
+
+	for(ii = 0; ii < count; ii++)
+	{
+		for(size = LINE_SIZE; size > 0; size = (size > 256) ? 256 : size - 1)
+		{
+			const size_t s1 = format_snprintf(&evs[ii], buf1, size);
+			const size_t s2 = log_malloc_format_text(&evs[ii], buf2, size);
+
+			if(s1 != s2 || memcmp(buf1, buf2, s1) != 0)
+			{
+				fprintf(stderr, "mismatch (event %d, size %zu):\n%.*s%.*s", ii, size,
+					(int)s1, buf1, (int)s2, buf2);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static void run(const char *name, format_fn fn, const log_malloc_event_t *evs, int count)
+{
+	int ii, rr;
+	size_t bytes = 0;
+	uint64_t start, ns;
+	char buf[LINE_SIZE];
+
+	start = now_ns();
+	for(rr = 0; rr < ROUNDS; rr++)
+	{
+		for(ii = 0; ii < count; ii++)
+		{
+			bytes += fn(&evs[ii], buf, sizeof(buf));
+			__asm__ __volatile__("" : : "r"(buf) : "memory");
+		}
+	}
+	ns = now_ns() - start;
+
+	printf("%-9s %8.1f %8.1f\n", name, (double)ns / (ROUNDS * count),
+		(double)bytes / (ROUNDS * count));
+	return;
+}
+
+int main(int argc, char *argv[])
+{
+	static log_malloc_event_t evs[EVENTS];
+
+	gen_events(evs, EVENTS);
+	if(verify(evs, EVENTS) != 0)
+		return 1;
+
+	printf("# text event line formatting, %d events x %d rounds\n", EVENTS, ROUNDS);
+	printf("%-9s %8s %8s\n", "format", "ns/ev", "B/ev");
+	run("snprintf", format_snprintf, evs, EVENTS);
+	run("encoder", log_malloc_format_text, evs, EVENTS);
+	return 0;
+}
+
+/* EOF */
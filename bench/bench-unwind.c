@@ -0,0 +1,154 @@
+/*
+ * log-malloc2 unwinding engines microbenchmark
+ *	Compares frame pointer walk, glibc backtrace() and cached libunwind
+ *	on call chains of depth 7, 16 and 32.
+ *
+ * Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+ *
+ * License: GNU LGPLv3 (http://www.gnu.org/licenses/lgpl.html)
+ *
+ * Web:
+ *	http://devel.dob.sk/log-malloc2
+ *	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+ *	https://github.com/samsk/log-malloc2 (git repo)
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef HAVE_BACKTRACE
+#include <execinfo.h>
+#endif
+
+#include "log-malloc2.h"
+#include "log-malloc2_internal.h"
+
+#define MAX_FRAMES	64
+
+typedef int (*engine_fn)(uint64_t *frames, int max);
+
+struct engine_s {
+	const char *name;
+	engine_fn fn;
+};
+
+/* unwind engine module needs library context */
+static log_malloc_ctx_t g_ctx = LOG_MALLOC_CTX_INIT;
+
+log_malloc_ctx_t *log_malloc_ctx_get(void)
+{
+	return &g_ctx;
+}
+
+static __attribute__((noinline)) int engine_fp(uint64_t *frames, int max)
+{
+	return log_malloc_unwind_fp(__builtin_frame_address(0), frames, max);
+}
+
+#ifdef HAVE_BACKTRACE
+static __attribute__((noinline)) int engine_glibc(uint64_t *frames, int max)
+{
+	int ii;
+	int nptrs;
+	void *buffer[MAX_FRAMES + 1];
+
+	nptrs = backtrace(buffer, max + 1) - 1;
+	for(ii = 0; ii < nptrs; ii++)
+		frames[ii] = (uintptr_t)buffer[ii + 1];
+	return (nptrs > 0) ? nptrs : 0;
+}
+#endif
+
+#ifdef HAVE_UNWIND
+static __attribute__((noinline)) int engine_libunwind(uint64_t *frames, int max)
+{
+	return log_malloc_unwind_cached(frames, max, 1);
+}
+#endif
+
+static const struct engine_s engines[] = {
+	{ "fp", engine_fp },
+#ifdef HAVE_BACKTRACE
+	{ "glibc", engine_glibc },
+#endif
+#ifdef HAVE_UNWIND
+	{ "libunwind", engine_libunwind },
+#endif
+	{ NULL, NULL }
+};
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* leaf of call chain, measures engine */
+static __attribute__((noinline)) double measure(const struct engine_s *eng, long iters, int *nframes)
+{
+	long ii;
+	uint64_t start;
+	uint64_t frames[MAX_FRAMES];
+
+	/* warmup (loads libgcc_s, fills unwind caches) */
+	*nframes = eng->fn(frames, MAX_FRAMES);
+
+	start = now_ns();
+	for(ii = 0; ii < iters; ii++)
+		*nframes = eng->fn(frames, MAX_FRAMES);
+	return (double)(now_ns() - start) / iters;
+}
+
+/* builds call chain of given depth (no tail calls) */
+static __attribute__((noinline)) double chain(int depth, const struct engine_s *eng, long iters, int *nframes)
+{
+	volatile double res;
+
+	if(depth <= 1)
+		res = measure(eng, iters, nframes);
+	else
+		res = chain(depth - 1, eng, iters, nframes);
+	return res;
+}
+
+int main(int argc, char *argv[])
+{
+	int ii;
+	const struct engine_s *eng;
+	const int depths[] = { 7, 16, 32 };
+	const long iters = (argc > 1) ? atol(argv[1]) : 200000;
+
+	printf("# log-malloc2 unwind benchmark (iterations=%ld)\n", iters);
+	printf("%-10s %6s %7s %10s\n", "engine", "depth", "frames", "ns/op");
+
+	for(eng = engines; eng->name; eng++)
+	{
+		if(log_malloc_unwind_init(eng->name) < 0)
+			continue;
+
+		for(ii = 0; ii < sizeof(depths) / sizeof(depths[0]); ii++)
+		{
+			int nframes = 0;
+			const double ns = chain(depths[ii], eng, iters, &nframes);
+
+			printf("%-10s %6d %7d %10.1f\n", eng->name, depths[ii], nframes, ns);
+		}
+	}
+	return 0;
+}
+
+/* EOF */
@@ -16,6 +16,8 @@
  */
 
 #include <assert.h>
+#include <stdint.h>
+#include <inttypes.h>
 
 /* config (LINUX specific) */
 #ifndef LOG_MALLOC_TRACE_FD
@@ -34,6 +36,29 @@
 #define LOG_MALLOC_MAPS_PATH		"/proc/self/maps"
 #endif
 
+#ifndef LOG_MALLOC_HISTOGRAM_BUCKETS
+#define LOG_MALLOC_HISTOGRAM_BUCKETS	64
+#endif
+
+/* API types */
+
+/** allocation histograms (log2 buckets)
+ *	bucket k > 0 holds values of [2^(k-1), 2^k), bucket 0 zero values
+ */
+typedef struct log_malloc_histogram_s {
+	uint64_t allocs[LOG_MALLOC_HISTOGRAM_BUCKETS];	/* allocations by requested size */
+	uint64_t bytes[LOG_MALLOC_HISTOGRAM_BUCKETS];	/* requested bytes by size class */
+	uint64_t lifetime[LOG_MALLOC_HISTOGRAM_BUCKETS];	/* frees by block lifetime in ns */
+} log_malloc_histogram_t;
+
+/** per-thread quota callback
+ * @param	usage	memory used by thread
+ * @param	quota	thread quota
+ * @note	called from allocation function that crossed quota, once until
+ *		usage drops below quota again
+ */
+typedef void (*log_malloc_quota_cb_t)(int64_t usage, uint64_t quota);
+
 /* API macros */
 
 /* disable macros */
@@ -41,12 +66,12 @@
 
 /** crate savepoint storing actual memory usage */
 #define LOG_MALLOC_SAVE(name, trace)		\
-		size_t _log_malloc_sp_##name = log_malloc_get_usage();			\
-		ssize_t _log_malloc_sp_diff_##name = 0;					\
+		uint64_t _log_malloc_sp_##name = log_malloc_get_usage();		\
+		int64_t _log_malloc_sp_diff_##name = 0;					\
 		static ssize_t _log_malloc_sp_iter_##name = -1;				\
 		_log_malloc_sp_iter_##name++;						\
 		if((trace))								\
-			log_malloc_trace_printf("# SP %s(%s:%u)/%s: saved=%lu\n",	\
+			log_malloc_trace_printf("# SP %s(%s:%u)/%s: saved=%" PRIu64 "\n",	\
 				__FUNCTION__, __FILE__, __LINE__, #name,		\
 				_log_malloc_sp_##name);
 
@@ -54,7 +79,7 @@
 #define LOG_MALLOC_UPDATE(name, trace)		\
 		_log_malloc_sp_##name = log_malloc_get_usage();				\
 		if((trace))								\
-			log_malloc_trace_printf("# SP %s(%s:%u)/%s: updated=%lu\n",	\
+			log_malloc_trace_printf("# SP %s(%s:%u)/%s: updated=%" PRIu64 "\n",	\
 				__FUNCTION__, __FILE__, __LINE__, #name,		\
 				_log_malloc_sp_##name);
 
@@ -63,9 +88,9 @@
 #define LOG_MALLOC_COMPARE(name, trace)		\
 		(									\
 		 _log_malloc_sp_diff_##name =						\
-		 	(log_malloc_get_usage() - _log_malloc_sp_##name),		\
+		 	(int64_t)(log_malloc_get_usage() - _log_malloc_sp_##name),	\
 		(((_log_malloc_sp_diff_##name != 0) || (trace)) ?			\
-			log_malloc_trace_printf("# SP-COMPARE %s(%s:%u)/%s: expected=%lu, diff=%+ld\n",\
+			log_malloc_trace_printf("# SP-COMPARE %s(%s:%u)/%s: expected=%" PRIu64 ", diff=%+" PRId64 "\n",\
 				__FUNCTION__, __FILE__, __LINE__, #name,		\
 				_log_malloc_sp_##name, _log_malloc_sp_diff_##name) : 0)	\
 			, _log_malloc_sp_diff_##name )
@@ -77,7 +102,7 @@
 #define LOG_MALLOC_ASSERT(name, iter)	\
 		if(((iter) == 0) || ((iter)) == _log_malloc_sp_iter_##name)		\
 		{									\
-		 size_t _log_malloc_sp_now_##name = log_malloc_get_usage();		\
+		 uint64_t _log_malloc_sp_now_##name = log_malloc_get_usage();		\
 		 if(!(_log_malloc_sp_##name == _log_malloc_sp_now_##name))		\
 		 	__assert_fail(#name "-mem-usage-before != " #name "-mem-usage-after",		\
 		 		__FILE__, __LINE__, __FUNCTION__);			\
@@ -86,6 +111,51 @@
 #define LOG_MALLOC_ASSERT(name, iter)
 #endif
 
+/** crate thread savepoint storing actual memory usage of calling thread
+ * @note	usage of thread is memory allocated minus memory released by it
+ */
+#define LOG_MALLOC_THREAD_SAVE(name, trace)	\
+		int64_t _log_malloc_tsp_##name = log_malloc_thread_get_usage();	\
+		int64_t _log_malloc_tsp_diff_##name = 0;				\
+		static __thread ssize_t _log_malloc_tsp_iter_##name = -1;		\
+		_log_malloc_tsp_iter_##name++;						\
+		if((trace))								\
+			log_malloc_trace_printf("# TSP %s(%s:%u)/%s: saved=%" PRId64 "\n",	\
+				__FUNCTION__, __FILE__, __LINE__, #name,		\
+				_log_malloc_tsp_##name);
+
+/** update given thread savepoint with actual memory usage of calling thread */
+#define LOG_MALLOC_THREAD_UPDATE(name, trace)	\
+		_log_malloc_tsp_##name = log_malloc_thread_get_usage();			\
+		if((trace))								\
+			log_malloc_trace_printf("# TSP %s(%s:%u)/%s: updated=%" PRId64 "\n",	\
+				__FUNCTION__, __FILE__, __LINE__, #name,		\
+				_log_malloc_tsp_##name);
+
+/** test memory level of calling thread for change */
+#define LOG_MALLOC_THREAD_COMPARE(name, trace)	\
+		(									\
+		 _log_malloc_tsp_diff_##name =						\
+		 	log_malloc_thread_get_usage() - _log_malloc_tsp_##name,		\
+		(((_log_malloc_tsp_diff_##name != 0) || (trace)) ?			\
+			log_malloc_trace_printf("# TSP-COMPARE %s(%s:%u)/%s: expected=%" PRId64 ", diff=%+" PRId64 "\n",\
+				__FUNCTION__, __FILE__, __LINE__, #name,		\
+				_log_malloc_tsp_##name, _log_malloc_tsp_diff_##name) : 0)	\
+			, _log_malloc_tsp_diff_##name )
+
+#ifndef NDEBUG
+/** assert if memory usage of calling thread differs */
+#define LOG_MALLOC_THREAD_ASSERT(name, iter)	\
+		if(((iter) == 0) || ((iter)) == _log_malloc_tsp_iter_##name)		\
+		{									\
+		 if(_log_malloc_tsp_##name != log_malloc_thread_get_usage())		\
+		 	__assert_fail(#name "-thread-mem-usage-before != " #name "-thread-mem-usage-after",	\
+		 		__FILE__, __LINE__, __FUNCTION__);			\
+		}
+#else
+#define LOG_MALLOC_THREAD_ASSERT(name, iter)
+#endif
+
 #else
 
 /* noops (NOTE: use of NULL here is experimental :) */
@@ -93,6 +163,10 @@
 #define LOG_MALLOC_UPDATE(name, trace)
 #define LOG_MALLOC_COMPARE(name, trace) NULL
 #define LOG_MALLOC_ASSERT(name, trace)
+#define LOG_MALLOC_THREAD_SAVE(name, trace)
+#define LOG_MALLOC_THREAD_UPDATE(name, trace)
+#define LOG_MALLOC_THREAD_COMPARE(name, trace) NULL
+#define LOG_MALLOC_THREAD_ASSERT(name, trace)
 
 #endif
 
@@ -102,8 +176,8 @@
 extern "C" {
 #endif
 
-/** get current memory usage */
-size_t log_malloc_get_usage(void);
+/** get current memory usage (64-bit, even on 32-bit platforms) */
+uint64_t log_malloc_get_usage(void);
 
 /** enable trace to LOG_MALLOC_TRACE_FD */
 void log_malloc_trace_enable(void);
@@ -111,6 +185,48 @@ void log_malloc_trace_enable(void);
 /** disable trace */
 void log_malloc_trace_disable(void);
 
+/** switch pass-through mode
+ * @param	enable	1 - allocation functions call libc directly (no trace,
+ *			accounting or call counting), 0 - back to tracing
+ * @return	previous state, -1 if library is not initialized
+ * @note	blocks allocated while tracing are still traced on free/realloc
+ */
+int log_malloc_passthrough(int enable);
+
+/** dump heap snapshot (outstanding allocations grouped by call site)
+ * @param	fd	output fd, -1 for LOG_MALLOC_TRACE_FD
+ * @return	number of call sites, -1 if live allocations table is disabled
+ * @note	requires LOG_MALLOC_LIVE environment variable
+ */
+int log_malloc_heap_snapshot(int fd);
+
+/** get allocation size class and lifetime histograms
+ * @param	hist	aggregated histograms of all threads
+ * @return	0, -1 if histograms are disabled
+ * @note	requires --enable-histogram build and LOG_MALLOC_HISTOGRAM environment variable
+ */
+int log_malloc_histogram_get(log_malloc_histogram_t *hist);
+
+/** dump allocation histograms (non-empty buckets)
+ * @param	fd	output fd, -1 for LOG_MALLOC_TRACE_FD
+ * @return	0, -1 if histograms are disabled
+ */
+int log_malloc_histogram_dump(int fd);
+
+/** get memory usage of calling thread
+ * @return	bytes allocated minus bytes released by calling thread (negative
+ *		if thread releases memory allocated by other threads)
+ */
+int64_t log_malloc_thread_get_usage(void);
+
+/** set memory quota of calling thread
+ * @param	quota	bytes, 0 disables quota
+ * @param	cb	called when usage crosses quota, NULL writes
+ *			'# QUOTA' marker to trace (or stderr)
+ * @note	default quota of all threads is set by LOG_MALLOC_THREAD_QUOTA
+ */
+void log_malloc_thread_set_quota(uint64_t quota, log_malloc_quota_cb_t cb);
+
 /** trace smth. to LOG_MALLOC_TRACE_FD */
 int log_malloc_trace_printf(const char *fmt, ...)
 	__attribute__((format(printf, 1, 2)));
@@ -21,6 +21,8 @@ use Getopt::Long;
 use Pod::Usage;
 use Data::Dumper;
 use File::Basename;
+use File::Path;
+use IPC::Open2;
 
 # VERSION
 our $VERSION = '0.4';
@@ -31,6 +33,19 @@ our $WARNING = 0;	# set to -1 to disable globally
 my @ADDR2LINE = ("addr2line", "-C");
 my $LINUX_ALSR_CONFIG = "/proc/sys/kernel/randomize_va_space";
 
+# symbol cache dir (keyed by build-id), set to undef to disable
+our $CACHE_DIR = $ENV{'LOG_MALLOC_SYMBOL_CACHE'};
+$CACHE_DIR = ($ENV{'XDG_CACHE_HOME'} || ($ENV{'HOME'} && $ENV{'HOME'} . '/.cache'))
+		. '/log-malloc2/symbols'
+	if(!defined($CACHE_DIR) && ($ENV{'XDG_CACHE_HOME'} || $ENV{'HOME'}));
+$CACHE_DIR = undef
+	if(defined($CACHE_DIR) && ($CACHE_DIR eq '' || $CACHE_DIR eq '0'));
+
+# symbolizers (exe => [ pid, in, out ]), symbol caches (key => { addr => rec })
+my (%SYMBOLIZERS, %SYMCACHE, %CACHEKEYS);
+# last library map (maps ref is kept, so it can not be reused)
+my @LIBMAP_LAST;
+
 # EXEC
 sub main(@);
 exit(main(@ARGV)) if(!caller());
@@ -148,6 +163,209 @@ sub get_wd($$)
 	return readlink($lnk);
 }
 
+sub get_libmap_cached($$)
+{
+	my ($mapsFile, $pid) = @_;
+
+	# maps recorded in trace are same for all backtraces of trace
+	return %{$LIBMAP_LAST[1]}
+		if(@LIBMAP_LAST && ref($mapsFile) && $LIBMAP_LAST[0] == $mapsFile);
+
+	my @maps = read_mapsFile($mapsFile, $pid);
+	return ()
+		if(!@maps);
+
+	my %libs = get_libmap(@maps);
+	@LIBMAP_LAST = ($mapsFile, \%libs)
+		if(ref($mapsFile));
+	return %libs;
+}
+
+# elf_build_id($path): $build_id
+sub elf_build_id($)
+{
+	my ($path) = @_;
+
+	my ($fd, $hdr);
+	return undef
+		if(!open($fd, '<:raw', $path));
+
+	if(read($fd, $hdr, 64) != 64 || substr($hdr, 0, 4) ne "\x7fELF")
+	{
+		close($fd);
+		return undef;
+	}
+
+	# ELF class (1 - 32bit, 2 - 64bit) and data encoding (1 - LE, 2 - BE)
+	my ($class, $data) = unpack('x4 C C', $hdr);
+	my ($h, $w, $q) = ($data == 2) ? ('n', 'N', 'Q>') : ('v', 'V', 'Q<');
+
+	# e_phoff, e_phentsize, e_phnum
+	my ($phoff, $phentsize, $phnum) = ($class == 2)
+		? unpack("x32 $q x14 $h $h", $hdr)
+		: unpack("x28 $w x14 $h $h", $hdr);
+
+	my $id;
+	for(my $ii = 0; !defined($id) && $ii < $phnum; $ii++)
+	{
+		my ($ph, $notes);
+
+		last
+			if(!seek($fd, $phoff + $ii * $phentsize, 0) || read($fd, $ph, $phentsize) != $phentsize);
+
+		# PT_NOTE
+		my ($type, $offset, $size);
+		if($class == 2)
+		{	($type, $offset, $size) = unpack("$w x4 $q x16 $q", $ph);	}
+		else
+		{	($type, $offset, $size) = unpack("$w $w x8 $w", $ph);	}
+		next
+			if($type != 4 || $size > 65536);
+
+		next
+			if(!seek($fd, $offset, 0) || read($fd, $notes, $size) != $size);
+
+		# NT_GNU_BUILD_ID
+		for(my $pos = 0; $pos + 12 <= $size; )
+		{
+			my ($namesz, $descsz, $ntype) = unpack("$w $w $w", substr($notes, $pos, 12));
+			my $name = substr($notes, $pos + 12, $namesz);
+			my $desc = substr($notes, $pos + 12 + (($namesz + 3) & ~3), $descsz);
+
+			$id = unpack('H*', $desc), last
+				if($ntype == 3 && $name eq "GNU\0");
+			$pos += 12 + (($namesz + 3) & ~3) + (($descsz + 3) & ~3);
+		}
+	}
+	close($fd);
+
+	return $id;
+}
+
+# cache_key($exe): $key
+sub cache_key($)
+{
+	my ($exe) = @_;
+
+	return $CACHEKEYS{$exe}
+		if(exists($CACHEKEYS{$exe}));
+
+	# translation depends also on addr2line options
+	my $tag = join('', @ADDR2LINE[1 .. $#ADDR2LINE]);
+	$tag =~ s/[^\w]+//go;
+
+	my $id = elf_build_id($exe);
+	if(!$id)
+	{
+		# without build-id, file identity is used
+		my @st = stat($exe);
+		$id = sprintf("nobuildid-%d-%d-%d-%d", @st[0, 1, 7, 9])
+			if(@st);
+	}
+
+	$CACHEKEYS{$exe} = ($id) ? "$id.$tag" : undef;
+	return $CACHEKEYS{$exe};
+}
+
+# cache_load($key): \%cache
+sub cache_load($)
+{
+	my ($key) = @_;
+
+	return $SYMCACHE{$key}
+		if(exists($SYMCACHE{$key}));
+
+	my (%cache, $fd);
+	if($CACHE_DIR && open($fd, '<', "$CACHE_DIR/$key"))
+	{
+		while(my $line = <$fd>)
+		{
+			chomp($line);
+
+			# ADDR [TAB FUNCTION TAB FILE TAB LINE]
+			my ($addr, $function, $file, $l) = split(/\t/o, $line, 4);
+			next
+				if(!defined($addr) || $addr eq '');
+
+			$cache{$addr} = (defined($l))
+				? { function => $function, file => $file, line => $l }
+				: undef;
+		}
+		close($fd);
+	}
+
+	$SYMCACHE{$key} = \%cache;
+	return \%cache;
+}
+
+# cache_store($key, \%translated)
+sub cache_store($\%)
+{
+	my ($key, $new) = @_;
+
+	return
+		if(!$CACHE_DIR || !keys(%$new));
+
+	my $fd;
+	eval { File::Path::mkpath($CACHE_DIR) }
+		if(!-d $CACHE_DIR);
+	verbose(1, "CACHE_WRITE_FAILED: $CACHE_DIR/$key - $!\n"), return
+		if(!open($fd, '>>', "$CACHE_DIR/$key"));
+
+	my $buf = '';
+	foreach my $addr (keys(%$new))
+	{
+		my $rec = $new->{$addr};
+
+		$buf .= (defined($rec))
+			? join("\t", $addr, $rec->{function}, $rec->{file}, $rec->{line}) . "\n"
+			: "$addr\n";
+	}
+	# single write (appends from parallel runs do not interleave)
+	syswrite($fd, $buf);
+	close($fd);
+	return;
+}
+
+# symbolizer($exe): [ $pid, $in, $out ]
+sub symbolizer($)
+{
+	my ($exe) = @_;
+
+	return $SYMBOLIZERS{$exe}
+		if(exists($SYMBOLIZERS{$exe}));
+
+	# addr2line reads addresses from stdin and flushes every answer
+	my ($in, $out);
+	my $pid = eval { open2($out, $in, @ADDR2LINE, "-f", "-e", $exe) };
+
+	warn("\t - addr2line failed to start for '$exe'\n")
+		if(!$pid);
+	$SYMBOLIZERS{$exe} = ($pid) ? [ $pid, $in, $out ] : undef;
+	return $SYMBOLIZERS{$exe};
+}
+
+# symbolizer_close($exe)
+sub symbolizer_close($)
+{
+	my ($exe) = @_;
+
+	my $sym = delete($SYMBOLIZERS{$exe});
+	return
+		if(!$sym);
+
+	close($sym->[1]);
+	close($sym->[2]);
+	waitpid($sym->[0], 0);
+	return;
+}
+
+END
+{
+	symbolizer_close($_)
+		foreach(keys(%SYMBOLIZERS));
+}
+
 sub addr2libname(\%$)
 {
 	my ($libmap, $addr) = @_;
@@ -178,39 +396,63 @@ sub addr2line($@)
 {
 	my ($exe, @symbols) = @_;
 
-	my @cmd = (@ADDR2LINE, "-f", "-e", $exe, @symbols);
-
-	# XXX: improve this
-	my @lines = `@cmd`;
-	warn("\t - addr2line filed while executing '@cmd'\n"), return ()
-		if($? != 0);
+	my $key = ($CACHE_DIR) ? cache_key($exe) : undef;
+	my $cache = ($key) ? cache_load($key) : {};
 
-	my %addr;
+	my (%addr, %new);
 	my $symIdx = 0;
-	chomp(@lines);
-	for(my $ii = 0; $ii <= $#lines; $ii++)
+	local $SIG{'PIPE'} = 'IGNORE';
+	foreach my $sym (@symbols)
 	{
-		my $line = $lines[$ii];
-		my $sym = $symbols[$symIdx];
+		my $id = $sym || $symIdx;
+
+		$symIdx++;
+
+		# cached (copy, caller modifies records)
+		if(exists($cache->{$sym}))
+		{
+			$addr{$id} = ($cache->{$sym}) ? { %{$cache->{$sym}} } : undef;
+			next;
+		}
+
+		my $s = symbolizer($exe);
+		return ()
+			if(!$s);
 
-		# every 1st line is function
-		my $function = $line;
-		my $location = $lines[++$ii];
+		# every 1st line is function, 2nd is location
+		my ($in, $out) = ($s->[1], $s->[2]);
+		my ($function, $location);
+		if(print($in "$sym\n") && $in->flush())
+		{
+			$function = <$out>;
+			$location = <$out>;
+		}
+
+		if(!defined($location))
+		{
+			warn("\t - addr2line failed while translating '$sym' from '$exe'\n");
+			symbolizer_close($exe);
+			$SYMBOLIZERS{$exe} = undef;
+			last;
+		}
+		chomp($function, $location);
 
 		if($function eq "??" && $location eq "??:0")
 		{
-			$addr{$sym || $symIdx} = undef;
+			$addr{$id} = undef;
 		}
 		else
 		{
 			my ($f, $l) = split(/:/o, $location, 2);
 
-			$addr{$sym || $symIdx} = { function => $function, file => $f, line => $l };
+			$addr{$id} = { function => $function, file => $f, line => $l };
 		}
 
-		$symIdx++;
+		$new{$sym} = $cache->{$sym} = ($addr{$id}) ? { %{$addr{$id}} } : undef;
 	}
 
+	cache_store($key, %new)
+		if($key);
 	return %addr;
 }
 
@@ -223,14 +465,9 @@ sub process($$$@)
 	my $cwd = get_wd($wd, $pid);
 
 	# get library map from maps file
-	my (@maps, %libs);
-	@maps = read_mapsFile($mapsFile, $pid);
-	if(@maps)
-	{
-		%libs = get_libmap(@maps);
-		return wantarray ? (undef, "failed to get library maps") : undef
-			if(!keys(%libs));
-	}
+	my %libs = get_libmap_cached($mapsFile, $pid);
+	return wantarray ? (undef, "failed to get library maps") : undef
+		if(!keys(%libs) && ($pid || $mapsFile) && read_mapsFile($mapsFile, $pid));
 
 	# parse input
 	my @data;
@@ -418,6 +655,8 @@ sub main(@)
 		"wd|work-dir=s"	=> \$workDir,
 		"full-filename"	=> \$fullName,
 		"demangle=s"	=> sub { push(@ADDR2LINE, "--demangle=$_[1]"); },
+		"cache-dir=s"	=> \$CACHE_DIR,
+		"no-cache"	=> sub { $CACHE_DIR = undef; },
 		"v|verbose"	=> \$VERBOSE,
 		"h|?|help"	=> \$help,
 		"man"		=> \$man,
@@ -551,6 +790,16 @@ and maps file has not been provided).
 
 Passes given --demangle I<STYLE> parameter to B<addr2line> when translating symbols.
 
+=item B<--cache-dir> I<DIR>
+
+Directory of persistent symbol cache (default $LOG_MALLOC_SYMBOL_CACHE or ~/.cache/log-malloc2/symbols).
+Translated addresses are cached per binary build-id (or file identity, if binary has no build-id),
+so repeated translation of backtraces from same binaries does not need B<addr2line> at all.
+
+=item B<--no-cache>
+
+Disable persistent symbol cache.
+
 =item B<-v>
 
 =item B<--verbose>
@@ -569,6 +818,21 @@ Show man page.
 
 =back
 
+=head1 ENVIRONMENT
+
+=over 4
+
+=item B<LOG_MALLOC_SYMBOL_CACHE>
+
+Symbol cache directory, empty or '0' disables cache.
+
+=back
+
+=head1 NOTES
+
+Every binary is translated by single long-running B<addr2line> process, that reads addresses
+from pipe, so no process is forked per backtrace (also if used as perl module).
+
 =head1 EXAMPLES
 
 	# pass symbols and maps divided by single dot on line
@@ -0,0 +1,416 @@
+#!/usr/bin/perl -w
+# log-malloc2 / decode
+#	Decode binary log-malloc trace file into text trace format
+#
+# Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+#
+# License: GNU GPLv3 (http://www.gnu.org/licenses/gpl.html)
+#
+# Web:
+#	http://devel.dob.sk/log-malloc2
+#	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+#	https://github.com/samsk/log-malloc2 (git repo)
+#
+#
+package log_malloc::decode;
+
+use strict;
+use Getopt::Long;
+use Pod::Usage;
+
+# VERSION
+our $VERSION = "0.4";
+
+# CONFIGS
+my $MAGIC = "LM2B";
+my $VERSION_MAX = 2;
+my $BOM = 0x01020304;
+
+# stream header: magic, version, rec_size, bom, reserved
+my $HEAD_FMT = "a4 S S L L";
+my $HEAD_SIZE = 16;
+
+# record header (struct log_malloc_brec_s), per format version
+my %REC_FMT = (
+	1 => "C C S S S L l Q q Q Q Q Q q q",
+	2 => "C C S S S L l L L Q q Q Q Q Q q q",
+);
+my %REC_FIELDS = (
+	1 => [ qw(type flags nframes statm_len reserved tid ret timestamp size
+		ptr optr arg1 arg2 mem_used mem_rused) ],
+	2 => [ qw(type flags nframes statm_len reserved tid ret stack atid timestamp size
+		ptr optr arg1 arg2 mem_used mem_rused) ],
+);
+my %REC_SIZE = (
+	1 => 80,
+	2 => 88,
+);
+
+# sanity limits: frames (batched frees carry 3 words per free, max. 64 frees),
+# statm and text chunk length
+my $FRAMES_MAX = 3 * 64;
+my $STATM_MAX = 1024;
+my $TEXT_MAX = 4096;
+
+# record flags
+my $BF_FOREIGN = 0x01;
+my $BF_RECURSION = 0x02;
+my $BF_TID = 0x04;
+
+# event types
+my @EVENTS = qw(TEXT malloc calloc realloc memalign posix_memalign valloc free STACK frees
+	aligned_alloc pvalloc reallocarray new new[] delete delete[]);
+
+# EXEC
+sub main(@);
+exit(main(@ARGV)) if(!caller());
+
+#
+# INTERNAL FUNCTIONS
+#
+
+sub ptr($)
+{
+	my ($ptr) = @_;
+
+	# glibc printf %p
+	return "(nil)"
+		if(!$ptr);
+	return sprintf("0x%x", $ptr);
+}
+
+sub align8($)
+{
+	my ($len) = @_;
+
+	return ($len + 7) & ~7;
+}
+
+sub readExact($$)
+{
+	my ($fd, $len) = @_;
+
+	my $buf = '';
+	while(length($buf) < $len)
+	{
+		my $r = read($fd, $buf, $len - length($buf), length($buf));
+
+		die("read failed - $!\n")
+			if(!defined($r));
+		last
+			if($r == 0);
+	}
+	return $buf;
+}
+
+#
+# PUBLIC FUNCTIONS
+#
+
+# format_event(\%rec): $line
+sub format_event($)
+{
+	my ($rec) = @_;
+
+	my $type = $EVENTS[ $rec->{type} ] || 'unknown';
+	my $mem = sprintf("[%d:%d]", $rec->{mem_used}, $rec->{mem_rused});
+	my $line;
+
+	# interned stack definition
+	if($type eq 'STACK')
+	{
+		$line = sprintf("# STACK %u\n", $rec->{stack});
+		$line .= sprintf("[0x%x]\n", $_)
+			foreach(@{$rec->{frames}});
+		return $line;
+	}
+
+	# batched frees, frames are (ptr, size, atid) triples
+	if($type eq 'frees')
+	{
+		my @tombs = @{$rec->{frames}};
+
+		$line = sprintf("+ frees %u %s", $rec->{size}, $mem);
+		while(my ($ptr, $size, $atid) = splice(@tombs, 0, 3))
+		{
+			$line .= sprintf(" -%u %s", $size, ptr($ptr));
+			$line .= sprintf("/%u", $atid)
+				if($rec->{flags} & $BF_TID);
+		}
+		$line .= sprintf(" ~%u", $rec->{tid})
+			if($rec->{flags} & $BF_TID);
+		return $line . "\n";
+	}
+
+	if($type eq 'malloc' || $type eq 'valloc' || $type eq 'pvalloc')
+	{
+		$line = sprintf("+ %s %u %s %s", $type, $rec->{size}, ptr($rec->{ptr}), $mem);
+	}
+	elsif($type eq 'new' || $type eq 'new[]')
+	{
+		$line = sprintf("+ %s %u %s", $type, $rec->{size}, ptr($rec->{ptr}));
+		$line .= sprintf(" (%u)", $rec->{arg1})
+			if($rec->{arg1});
+		$line .= " " . $mem;
+	}
+	elsif($type eq 'calloc')
+	{
+		$line = sprintf("+ calloc %u %s %s (%u %u)", $rec->{size}, ptr($rec->{ptr}), $mem,
+				$rec->{arg1}, $rec->{arg2});
+	}
+	elsif($type eq 'realloc' || $type eq 'reallocarray')
+	{
+		$line = sprintf("+ %s %d %s %s (%u %u) %s", $type, $rec->{size},
+				ptr($rec->{optr}), ptr($rec->{ptr}),
+				$rec->{arg1}, $rec->{arg2}, $mem);
+	}
+	elsif($type eq 'memalign' || $type eq 'aligned_alloc')
+	{
+		$line = sprintf("+ %s %u %s (%u) %s", $type, $rec->{size}, ptr($rec->{ptr}),
+				$rec->{arg1}, $mem);
+	}
+	elsif($type eq 'posix_memalign')
+	{
+		$line = sprintf("+ posix_memalign %u %s (%u %u : %d) %s", $rec->{size}, ptr($rec->{ptr}),
+				$rec->{arg1}, $rec->{arg2}, $rec->{ret}, $mem);
+	}
+	elsif($type eq 'free' || $type eq 'delete' || $type eq 'delete[]')
+	{
+		$line = sprintf("+ %s -%u %s %s", $type, $rec->{size}, ptr($rec->{ptr}), $mem);
+		$line .= " !f"
+			if($rec->{flags} & $BF_FOREIGN);
+	}
+	else
+	{
+		$line = sprintf("# UNKNOWN-EVENT %d", $rec->{type});
+	}
+
+	# thread id (free with allocating thread)
+	if($rec->{flags} & $BF_TID)
+	{
+		$line .= sprintf(" ~%u", $rec->{tid});
+		$line .= sprintf("/%u", $rec->{atid} || 0)
+			if($type =~ /^(?:free|delete)/o);
+	}
+
+	# interned stack reference
+	$line .= sprintf(" @%u", $rec->{stack})
+		if($rec->{stack});
+
+	# statm data (without trailing newline)
+	$line .= " #" . substr($rec->{statm}, 0, -1)
+		if(length($rec->{statm}));
+
+	# recursion, no stack available
+	$line .= "!"
+		if($rec->{flags} & $BF_RECURSION);
+
+	$line .= "\n";
+	$line .= sprintf("[0x%x]\n", $_)
+		foreach(@{$rec->{frames}});
+
+	return $line;
+}
+
+# process($fd_in, $fd_out): $records
+sub process($$)
+{
+	my ($in, $out) = @_;
+
+	binmode($in);
+
+	my $head = readExact($in, $HEAD_SIZE);
+	my ($magic, $version, $rec_size, $bom) = unpack($HEAD_FMT, $head);
+
+	# not a binary trace, pass through
+	if(!defined($magic) || $magic ne $MAGIC)
+	{
+		print $out $head;
+		print $out $_
+			while(<$in>);
+		return 0;
+	}
+
+	die("unsupported binary trace version $version\n")
+		if($version < 1 || $version > $VERSION_MAX);
+	die("binary trace byte order differs from this machine\n")
+		if($bom != $BOM);
+	die("unexpected record header size $rec_size\n")
+		if($rec_size != $REC_SIZE{$version});
+
+	my $count = 0;
+	while(length(my $buf = readExact($in, $rec_size)))
+	{
+		my %rec;
+
+		die("truncated record header (record $count)\n")
+			if(length($buf) != $rec_size);
+
+		@rec{ @{$REC_FIELDS{$version}} } = unpack($REC_FMT{$version}, $buf);
+		die("unknown record type $rec{type} (record $count)\n")
+			if($rec{type} > $#EVENTS);
+
+		# raw text
+		if($rec{type} == 0)
+		{
+			die("invalid text record length $rec{size} (record $count)\n")
+				if($rec{size} < 0 || $rec{size} > $TEXT_MAX);
+
+			my $text = readExact($in, align8($rec{size}));
+			die("truncated text record (record $count)\n")
+				if(length($text) != align8($rec{size}));
+
+			print $out substr($text, 0, $rec{size});
+			$count++;
+			next;
+		}
+
+		die("invalid frames count $rec{nframes} (record $count)\n")
+			if($rec{nframes} > $FRAMES_MAX);
+		die("invalid statm length $rec{statm_len} (record $count)\n")
+			if($rec{statm_len} > $STATM_MAX);
+
+		my $len = align8($rec{nframes} * 8 + $rec{statm_len});
+		my $payload = readExact($in, $len);
+		die("truncated record payload (record $count)\n")
+			if(length($payload) != $len);
+
+		$rec{frames} = [ unpack("Q$rec{nframes}", $payload) ];
+		$rec{statm} = substr($payload, $rec{nframes} * 8, $rec{statm_len});
+
+		print $out format_event(\%rec);
+		$count++;
+	}
+	return $count;
+}
+
+#
+# MAIN
+#
+
+sub main(@)
+{
+	my (@argv) = @_;
+	my ($file, $output, $man, $help);
+
+	@ARGV = @argv;
+	GetOptions(
+		"<>"		=> sub { $file = $_[0] . ''; },
+		"o|output=s"	=> \$output,
+		"h|?|help"	=> \$help,
+		"man"		=> \$man,
+	) || pod2usage( -verbose => 0, -exitval => 1 );
+	@argv = @ARGV;
+
+	pod2usage( -verbose => 1 )
+		if($help);
+	pod2usage( -verbose => 3 )
+		if($man);
+
+	pod2usage( -msg => "$0: log-malloc trace filename required",
+		-verbose => 0, -exitval => 1 )
+		if(!$file);
+
+	my ($in, $out);
+	if($file eq '-')
+	{
+		$in = \*STDIN;
+	}
+	else
+	{
+		die("$0: failed to open file '$file' - $!\n")
+			if(!open($in, '<', $file));
+	}
+
+	if($output && $output ne '-')
+	{
+		die("$0: failed to open output file '$output' - $!\n")
+			if(!open($out, '>', $output));
+	}
+	else
+	{
+		$out = \*STDOUT;
+	}
+
+	process($in, $out);
+
+	close($in);
+	close($out);
+	return 0;
+}
+
+1;
+
+=pod
+
+=head1 NAME
+
+log-malloc-decode - decode binary log-malloc2 trace file into text trace
+
+=head1 SYNOPSIS
+
+log-malloc-decode [ OPTIONS ] I<TRACE-FILE>
+
+=head1 DESCRIPTION
+
+This script converts binary trace file, produced by log-malloc2 library with B<LOG_MALLOC_FORMAT=binary>,
+into text trace format, so it can be processed by other log-malloc2 scripts. Backtrace is written as raw
+addresses (as with libunwind), interned stacks are kept interned (B<# STACK> lines), text trace
+files are passed through unchanged.
+
+NOTE: This script can be also used as perl module.
+
+=head1 ARGUMENTS
+
+=over 4
+
+=item I<TRACE-FILE>
+
+Path to file containing binary log-malloc2 trace, or '-' for STDIN.
+
+=back
+
+=head1 OPTIONS
+
+=over 4
+
+=item B<-o> I<FILE>
+
+=item B<--output> I<FILE>
+
+Write decoded trace to I<FILE> instead of STDOUT.
+
+=item B<-h>
+
+=item B<--help>
+
+Print help.
+
+=item B<--man>
+
+Show man page.
+
+=back
+
+=head1 EXAMPLES
+
+	$ LOG_MALLOC_FORMAT=binary log-malloc -o /tmp/lm.btrace ./examples/leak-01
+	$ log-malloc-decode /tmp/lm.btrace > /tmp/lm.trace
+	$ log-malloc-findleak /tmp/lm.trace
+
+=head1 LICENSE
+
+This script is released under GNU GPLv3 License.
+See L<http://www.gnu.org/licenses/gpl.html>.
+
+=head1 AUTHOR
+
+Samuel Behan - L<http://devel.dob.sk/log-malloc2/>, L<https://github.com/samsk/log-malloc2>
+
+=head1 SEE ALSO
+
+L<log-malloc>, L<log-malloc-findleak>, L<log-malloc-trackusage>
+
+=cut
+
+# EOF
@@ -47,7 +47,7 @@ sub parse(\@)
 	my ($lines) = @_;
 
 	my $init = 0;
-	my (%map, %data, %other, $payload);
+	my (%map, %data, %other, %stacks, $payload);
 	for(my $ii = 0; $ii <= $#$lines; $ii++)
 	{
 		$init = 1, $payload = undef, ($2 ? %map = %data = () : undef), next
@@ -59,8 +59,29 @@ sub parse(\@)
 			# + FUNCTION MEM-CHANGE MEM-IN? MEM-OUT? (FUNCTION-PARAMS) [MEM-STATUS:MEM-STATUS-USABLE]
 			my (undef, $func, $size, $addr1, $addr2) = split(/ /o, $$lines[$ii]);
 
+			# batched frees (no backtrace)
+			# + frees COUNT [MEM-STATUS:MEM-STATUS-USABLE] -SIZE ADDR[/ATID] ...
+			if($func eq 'frees')
+			{
+				while($$lines[$ii] =~ / (-\d+) (0x[0-9a-f]+)/go)
+				{
+					$map{ $2 } += $1;
+					push(@{$data{ $2 }}, {
+						call => 'free',
+						line => $ii + 1,
+						change => $1,
+						backtrace => []});
+				}
+				$payload = undef;
+				next;
+			}
+
+			# free of foreign memory (allocated before init, or in pass-through mode)
+			$payload = undef, next
+				if($func =~ /^(?:free|delete)/o && $$lines[$ii] =~ /\] !f(?: |$)/o);
+
 			my $key = $addr1;
-			if($func eq 'realloc' && $addr1 ne $addr2)
+			if($func =~ /^realloc/o && $addr1 ne $addr2)
 			{
 				$map{ $addr2 } = $map{ $addr1 };
 				delete($map{ $addr1 });
@@ -69,11 +90,21 @@ sub parse(\@)
 
 			$map{ $key } += $size;
 			$payload = [];
+
+			# interned stack (defined by '# STACK <id>', possibly later in trace)
+			my $backtrace = $payload;
+			$backtrace = ($stacks{$1} ||= []), $payload = undef
+				if($$lines[$ii] =~ / @(\d+)(?: #|$)/o);
+
 			push(@{$data{ $key }}, { 
 				call => $func,
 				line => $ii + 1,
 				change => $size,
-				backtrace => $payload});
+				backtrace => $backtrace});
+		}
+		elsif($$lines[$ii] =~ /^# STACK (\d+)$/o)
+		{
+			$payload = ($stacks{$1} ||= []);
 		}
 		elsif($$lines[$ii] =~ /# (\w+) (.+?)$/o)
 		{
@@ -0,0 +1,282 @@
+#!/usr/bin/perl -w
+# log-malloc2 / query
+#	Query live counters, histograms and heap of process traced with log-malloc2
+#
+# Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+#
+# License: GNU GPLv3 (http://www.gnu.org/licenses/gpl.html)
+#
+# Web:
+#	http://devel.dob.sk/log-malloc2
+#	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+#	https://github.com/samsk/log-malloc2 (git repo)
+#
+#
+package log_malloc::query;
+
+use strict;
+use Cwd;
+use Getopt::Long;
+use Pod::Usage;
+use Data::Dumper;
+use File::Basename;
+use IO::Socket::UNIX;
+
+# VERSION
+our $VERSION = "0.4";
+
+my $LIBEXECDIR;
+BEGIN {	$LIBEXECDIR = Cwd::abs_path(dirname(readlink(__FILE__) || __FILE__)); };
+
+# include submodule (optional)
+use lib $LIBEXECDIR;
+my $LOGMALLOC_HAVE_BT = 0;
+$LOGMALLOC_HAVE_BT = 1
+	if(eval { require "backtrace2line.pl" });
+
+# EXEC
+sub main(@);
+exit(main(@ARGV)) if(!caller());
+
+#
+# INTERNAL FUNCTIONS
+#
+
+# translate([0x...] frames): @lines
+sub translate($@)
+{
+	my ($pid, @frames) = @_;
+
+	return @frames
+		if(!$LOGMALLOC_HAVE_BT);
+
+	my @lines = log_malloc::backtrace2line::process(undef, undef, $pid, @frames);
+	return @frames
+		if(!@lines || !defined($lines[0]));
+
+	foreach my $line (@lines)
+	{
+		$line = sprintf("%s %s:%s %s", $line->{function}, $line->{file},
+				$line->{line}, $line->{sym})
+			if(ref($line));
+	}
+	return @lines;
+}
+
+#
+# PUBLIC FUNCTIONS
+#
+
+# open_socket($socket): $fd
+#	'@name' is socket in abstract namespace
+sub open_socket($)
+{
+	my ($socket) = @_;
+
+	$socket =~ s/^@/\0/o;
+	return IO::Socket::UNIX->new(
+		Type	=> SOCK_STREAM,
+		Peer	=> $socket,
+	);
+}
+
+# query($fd, $query): ($pid, \@lines, $error)
+sub query($$)
+{
+	my ($fd, $query) = @_;
+	my ($pid, @lines);
+
+	print $fd $query . "\n";
+	$fd->flush();
+
+	while(my $line = <$fd>)
+	{
+		chomp($line);
+
+		# greeting (first reply on connection)
+		$pid = $1, next
+			if($line =~ /^# PID (\d+)$/o);
+		return ($pid, \@lines, undef)
+			if($line eq '# OK');
+		return ($pid, \@lines, $1)
+			if($line =~ /^# ERROR (.*)$/o);
+
+		push(@lines, $line);
+	}
+	return ($pid, \@lines, "connection closed");
+}
+
+#
+# MAIN
+#
+
+sub main(@)
+{
+	my (@argv) = @_;
+	my ($socket, $man, $help);
+	my $no_translate = 0;
+
+	@ARGV = @argv;
+	GetOptions(
+		"no-translate"	=> \$no_translate,
+		"h|?|help"	=> \$help,
+		"man"		=> \$man,
+	) || pod2usage( -verbose => 0, -exitval => 1 );
+	@argv = @ARGV;
+
+	pod2usage( -verbose => 1 )
+		if($help);
+	pod2usage( -verbose => 3 )
+		if($man);
+
+	$socket = shift(@argv);
+	pod2usage( -msg => "$0: query socket path required",
+		-verbose => 0, -exitval => 1 )
+		if(!$socket);
+
+	@argv = ("counters")
+		if(!@argv);
+
+	my $fd = open_socket($socket);
+	die("$0: failed to connect to '$socket' - $!\n")
+		if(!$fd);
+
+	my ($pid, $lines, $error) = query($fd, join(" ", @argv));
+	close($fd);
+
+	# translate backtraces (process is still running, so maps are valid)
+	my @frames;
+	foreach my $line (@$lines, '')
+	{
+		if($line =~ /^\[0x[0-9a-f]+\]$/o)
+		{
+			push(@frames, $line);
+			next;
+		}
+
+		if(@frames)
+		{
+			@frames = translate($pid, @frames)
+				if(!$no_translate && $pid);
+			print "\t$_\n" foreach(@frames);
+			@frames = ();
+		}
+
+		print $line . "\n"
+			if($line ne '');
+	}
+
+	if($error)
+	{
+		warn("$0: $error\n");
+		return 1;
+	}
+	return 0;
+}
+
+1;
+
+=pod
+
+=head1 NAME
+
+log-malloc-query - query running process traced with log-malloc2
+
+=head1 SYNOPSIS
+
+log-malloc-query [ OPTIONS ] I<SOCKET> [ I<QUERY> [ I<ARG> ] ]
+
+=head1 DESCRIPTION
+
+This script connects to query socket of running process (library started with
+LOG_MALLOC_QUERY) and prints out reply of given query. Process is not stopped,
+replies are in the same format as snapshot and histogram records in trace file.
+
+NOTE: This script can be also used as perl module.
+
+=head1 ARGUMENTS
+
+=over 4
+
+=item I<SOCKET>
+
+Path to query socket, '@name' for socket in abstract namespace.
+
+=item I<QUERY>
+
+=over 4
+
+=item B<counters>
+
+Memory usage and call counters (default).
+
+=item B<histogram>
+
+Allocation size and block lifetime histograms (needs LOG_MALLOC_HISTOGRAM).
+
+=item B<top> [I<N>]
+
+I<N> call sites with most live bytes with their backtraces (default 10, 0 - all,
+needs LOG_MALLOC_LIVE).
+
+=item B<heap>
+
+All live blocks with size, age and call site stack id (needs LOG_MALLOC_LIVE).
+
+=item B<stack> I<ID>
+
+Backtrace of given stack id.
+
+=back
+
+=back
+
+=head1 OPTIONS
+
+=over 4
+
+=item B<--no-translate>
+
+Will not translate backtraces, but print only addresses as returned by process.
+
+=item B<-h>
+
+=item B<--help>
+
+Print help.
+
+=item B<--man>
+
+Show man page.
+
+=back
+
+=head1 EXAMPLES
+
+	$ LOG_MALLOC_QUERY=/tmp/lm-%p.sock LOG_MALLOC_LIVE=1 log-malloc ./server &
+	$ log-malloc-query /tmp/lm-1234.sock
+	# COUNTERS [487040:595688] malloc=8100 calloc=5 realloc=0 memalign=0/0 valloc=0 free=5332
+
+	$ log-malloc-query /tmp/lm-1234.sock top 1
+	# HEAP-SNAPSHOT sites=4 blocks=2773 bytes=487040 dropped=0 skipped=0
+	# HEAP-SITE bytes=385600 blocks=2668 age=12.618 @4
+		worker server.c:12 [0x562f0d6f51ea]
+		start_thread ??:? [0x7f3cd94d31f5]
+		clone ??:? [0x7f3cd95538dc]
+
+=head1 LICENSE
+
+This script is released under GNU GPLv3 License.
+See L<http://www.gnu.org/licenses/gpl.html>.
+
+=head1 AUTHOR
+
+Samuel Behan - L<http://devel.dob.sk/log-malloc2/>, L<https://github.com/samsk/log-malloc2>
+
+=head1 SEE ALSO
+
+L<log-malloc>, L<log-malloc-findleak>
+
+=cut
+
+#EOF
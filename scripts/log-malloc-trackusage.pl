@@ -48,7 +48,9 @@ PROCESS:
 
 		# matching [MEM-STATUS:MEM-STATUS-USABLE] in
 		# + FUNCTION MEM-CHANGE MEM-IN? MEM-OUT? (FUNCTION-PARAMS) [MEM-STATUS:MEM-STATUS-USABLE]
-		if($$lines[$ii] =~ /^\+.*?\[(\d+):(\d*)\]/o)
+		# # USAGE SEC.MSEC [MEM-STATUS:MEM-STATUS-USABLE] (usage time series sample)
+		# (64-bit values, might be negative with sharded counters)
+		if($$lines[$ii] =~ /^(?:\+|# USAGE ).*?\[(-?\d+):(-?\d*)\]/o)
 		{
 			my ($use, $ruse) = ($1, $2);
 			my $val = $use;
@@ -130,7 +132,8 @@ log-malloc-trackusage [ OPTIONS ] I<TRACE-FILE>
 =head1 DESCRIPTION
 
 This script analyzes input trace file and prints out how memory usage changed by every
-memory allocation/release.
+memory allocation/release. Usage time series samples (trace written with LOG_MALLOC_SERIES)
+are printed too, so usage curve can be plotted without tracing every call.
 
 NOTE: This script can be also used as perl module.
 
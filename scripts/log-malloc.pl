@@ -65,7 +65,7 @@ sub rotateFile($)
 sub main(@)
 {
 	my (@argv) = @_;
-	my ($logfile, $rotate, $verbose, $man, $help);
+	my ($logfile, $rotate, $format, $verbose, $man, $help);
 
 	# cmdline parsing
 	@ARGV = @argv;
@@ -76,6 +76,7 @@ sub main(@)
 		GetOptions(
 			"o|output=s"		=> \$logfile,
 			"oo|ro|rotate-output=s" => sub { $logfile = $_[1]; $rotate = 1; },
+			"f|format=s"		=> \$format,
 			"v|verbose"		=> \$verbose,
 			"<>"			=> sub { unshift(@ARGV, "$_[0]"); last; },
 			"h|?|help"		=> \$help,
@@ -141,6 +142,8 @@ sub main(@)
 
 	# setup env
 	$ENV{'LD_PRELOAD'} = $LD_PRELOAD;
+	$ENV{'LOG_MALLOC_FORMAT'} = $format
+		if($format);
 	warn "LD_PRELOAD = $LD_PRELOAD\n"
 		if($verbose);
 
@@ -204,6 +207,12 @@ STDERR.
 
 The same as B<--output> but I<FILE> will be automatically rotated instead of being overwritten - FILE.1, FILE.2...
 
+=item B<-f> I<FORMAT>
+
+=item B<--format> I<FORMAT>
+
+Trace format, I<text> (default) or I<binary>. Binary trace can be converted to text by B<log-malloc-decode>.
+
 =item B<-v>
 
 =item B<--verbose>
@@ -240,7 +249,7 @@ Samuel Behan - L<http://devel.dob.sk/log-malloc2/>, L<https://github.com/samsk/l
 
 =head1 SEE ALSO
 
-L<log-malloc-findleak>, L<log-malloc-trackusage>
+L<log-malloc-findleak>, L<log-malloc-trackusage>, L<log-malloc-decode>
 
 =cut
 
@@ -0,0 +1,1511 @@
+/*
+ * log-malloc2 / analyze
+ *	Streaming log-malloc trace analyzer (leaks, usage over time, top
+ *	allocation call sites and cross-thread memory flow in single pass
+ *	over mmap-ed trace). Trace is
+ *	split at record boundaries into chunks, parsed in parallel and merged
+ *	in order, with result identical to sequential parse.
+ *
+ * Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+ *
+ * License: GNU GPLv3 (http://www.gnu.org/licenses/gpl.html)
+ *
+ * Web:
+ *	http://devel.dob.sk/log-malloc2
+ *	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+ *	https://github.com/samsk/log-malloc2 (git repo)
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef HAVE_STDBOOL_H
+#define bool int
+#define true 1
+#define false 0
+#else
+#include <stdbool.h>
+#endif
+
+/* address key of "(nil)" (and other non-address tokens) */
+#define KEY_NIL		0
+
+/* entry flags */
+#define ENTRY_USED	0x01	/* slot used */
+#define ENTRY_SRC	0x02	/* counter continues from incoming counter of src */
+#define ENTRY_RECORD	0x04	/* first record stored ($data{addr}[0]) */
+#define ENTRY_STACK	0x08	/* backtrace is interned stack id */
+
+/* initial hash table sizes (power of 2) */
+#define ENTRIES_INIT	(1 << 16)
+#define CHUNK_ENTRIES_INIT	(1 << 10)
+#define SITES_INIT	(1 << 12)
+#define FLOWS_INIT	(1 << 8)
+
+/* call sites per thread pair (without --top) */
+#define FLOW_SITES	3
+
+/* max. threads printed in flow matrix */
+#define FLOW_MATRIX_MAX	16
+
+/* chunk size limits (chunk size is trace size / jobs within them) */
+#define CHUNK_MIN	(1 << 20)
+#define CHUNK_MAX	(64 << 20)
+
+/* per-address state, what findleak keeps in %map and first record of %data
+ * (address without usage counter has always zero sum, so it is not tracked)
+ *
+ * Chunk does not know counters of addresses from preceding chunks, so
+ * its sum is only a delta added to incoming counter of src address (realloc
+ * moves counter between addresses) or to zero if ENTRY_SRC is not set.
+ */
+struct entry_s {
+	uint64_t key;		/* address */
+	int64_t sum;		/* usage counter */
+	uint64_t src;		/* address of incoming counter (chunk only) */
+	uint64_t line;		/* first record line */
+	int64_t change;		/* first record change */
+	uint64_t bt;		/* first record backtrace (payload offset or stack id) */
+	uint64_t func;		/* first record function (offset) */
+	uint32_t site;		/* call site of last allocation (+1, 0 - none) */
+	uint8_t func_len;
+	uint8_t flags;
+};
+
+struct table_s {
+	struct entry_s *entries;
+	size_t size;
+	size_t used;
+};
+
+/* allocation call site */
+struct site_s {
+	uint64_t hash;		/* 0 - empty slot */
+	uint64_t bt;		/* payload offset or stack id */
+	uint64_t calls;
+	uint64_t bytes;
+	uint64_t live_blocks;
+	int64_t live_bytes;
+	bool stack;
+};
+
+struct sites_s {
+	struct site_s *sites;
+	size_t size;
+	size_t used;
+};
+
+/* memory allocated by one thread and freed by other (or same) thread,
+ * by allocation call site
+ */
+struct flow_s {
+	uint64_t pair;		/* ATID << 32 | TID, 0 - empty slot */
+	uint32_t site;		/* allocation call site (+1, 0 - unknown) */
+	uint64_t frees;
+	uint64_t bytes;
+};
+
+struct flows_s {
+	struct flow_s *flows;
+	size_t size;
+	size_t used;
+};
+
+/* free of block allocated in preceding chunk (site is resolved on merge) */
+struct pending_s {
+	uint64_t pair;
+	uint64_t key;		/* address of incoming counter */
+	uint64_t bytes;
+};
+
+/* interned stacks (id -> payload offset + 1) */
+struct stacks_s {
+	uint64_t *offsets;
+	size_t size;
+};
+
+struct analyze_s;
+
+/* trace chunk, starts with record line */
+struct chunk_s {
+	const struct analyze_s *an;
+	const char *start;
+	const char *end;
+
+	uint64_t lines;		/* lines in chunk */
+	bool reset;		/* contains INIT (preceding state dropped) */
+
+	struct table_s table;
+	struct sites_s sites;
+	struct stacks_s stacks;
+	struct flows_s flows;
+
+	struct pending_s *pending;
+	size_t npending;
+	size_t pending_size;
+
+	/* usage output */
+	char *out;
+	size_t out_len;
+	size_t out_size;
+};
+
+struct analyze_s {
+	const char *data;
+	size_t size;
+
+	/* merged state */
+	struct table_s table;
+	struct stacks_s stacks;
+	struct sites_s sites;
+	struct flows_s flows;
+	uint64_t lines;
+
+	/* options */
+	bool leaks;
+	bool usage;
+	bool threads;
+	bool usable_size;
+	int top;
+	int jobs;
+	size_t chunk_size;
+	size_t usage_from;	/* usage printed after first INIT/FINI line */
+};
+
+static void *xrealloc(void *ptr, size_t size)
+{
+	void *mem = realloc(ptr, size);
+
+	if(mem == NULL && size)
+	{
+		fprintf(stderr, "log-malloc-analyze: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return mem;
+}
+
+static inline uint64_t hash64(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+static inline bool is_word(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+		|| (c >= '0' && c <= '9') || c == '_';
+}
+
+/* next line (or end) */
+static inline const char *line_next(const char *p, const char *end)
+{
+	const char *nl = memchr(p, '\n', end - p);
+
+	return (nl) ? nl + 1 : end;
+}
+
+/* line length without newline */
+static inline size_t line_len(const char *p, const char *next)
+{
+	return (next > p && next[-1] == '\n') ? next - p - 1 : next - p;
+}
+
+/* matches /# (\w+) (.+?)$/ (comment with value) */
+static bool line_is_comment(const char *p, size_t len)
+{
+	size_t ii, jj;
+
+	for(ii = 0; ii + 1 < len; ii++)
+	{
+		if(p[ii] != '#' || p[ii + 1] != ' ')
+			continue;
+
+		for(jj = ii + 2; jj < len && is_word(p[jj]); jj++);
+		if(jj > ii + 2 && jj + 1 < len && p[jj] == ' ')
+			return true;
+	}
+	return false;
+}
+
+/* line ends payload (backtrace) of preceding record */
+static inline bool line_is_stop(const char *p, size_t len)
+{
+	if(len >= 2 && !is_word(p[0]) && p[1] == ' ')
+		return true;
+	return line_is_comment(p, len);
+}
+
+/* space delimited field */
+static const char *field(const char *p, const char *end, int n, size_t *flen)
+{
+	const char *f = p;
+
+	while(n-- > 0)
+	{
+		f = memchr(f, ' ', end - f);
+		if(f == NULL)
+			return NULL;
+		f++;
+	}
+
+	p = memchr(f, ' ', end - f);
+	*flen = ((p) ? p : end) - f;
+	return f;
+}
+
+/* address token to key */
+static uint64_t addr_key(const char *tok, size_t len)
+{
+	size_t ii;
+	uint64_t key = 0;
+
+	if(len < 3 || tok[0] != '0' || tok[1] != 'x' || len > 18)
+		return KEY_NIL;
+
+	for(ii = 2; ii < len; ii++)
+	{
+		const char c = tok[ii];
+
+		key <<= 4;
+		if(c >= '0' && c <= '9')
+			key |= c - '0';
+		else if(c >= 'a' && c <= 'f')
+			key |= c - 'a' + 10;
+		else
+			return KEY_NIL;
+	}
+	return key;
+}
+
+static int64_t parse_int(const char *p, size_t len)
+{
+	size_t ii = 0;
+	int64_t val = 0;
+	bool neg = false;
+
+	if(len && (p[0] == '-' || p[0] == '+'))
+		neg = (p[ii++] == '-');
+	for(; ii < len && p[ii] >= '0' && p[ii] <= '9'; ii++)
+		val = val * 10 + (p[ii] - '0');
+	return (neg) ? -val : val;
+}
+
+/*
+ *  ADDRESS TABLE
+ */
+static void entries_reset(struct table_s *t, size_t size)
+{
+	free(t->entries);
+	t->size = size;
+	t->used = 0;
+	t->entries = xrealloc(NULL, t->size * sizeof(*t->entries));
+	memset(t->entries, 0, t->size * sizeof(*t->entries));
+}
+
+static struct entry_s *entry_find(const struct table_s *t, uint64_t key)
+{
+	size_t idx = hash64(key) & (t->size - 1);
+
+	while(t->entries[idx].flags & ENTRY_USED)
+	{
+		if(t->entries[idx].key == key)
+			return &t->entries[idx];
+		idx = (idx + 1) & (t->size - 1);
+	}
+	return NULL;
+}
+
+/* new entry continues from incoming counter of its own address */
+static struct entry_s *entry_get(struct table_s *t, uint64_t key)
+{
+	size_t idx;
+
+	/* grow at 50% load */
+	if(t->used * 2 >= t->size)
+	{
+		size_t ii;
+		struct entry_s *old = t->entries;
+		const size_t old_size = t->size;
+
+		t->size *= 2;
+		t->entries = xrealloc(NULL, t->size * sizeof(*t->entries));
+		memset(t->entries, 0, t->size * sizeof(*t->entries));
+
+		for(ii = 0; ii < old_size; ii++)
+		{
+			if(!(old[ii].flags & ENTRY_USED))
+				continue;
+
+			idx = hash64(old[ii].key) & (t->size - 1);
+			while(t->entries[idx].flags & ENTRY_USED)
+				idx = (idx + 1) & (t->size - 1);
+			t->entries[idx] = old[ii];
+		}
+		free(old);
+	}
+
+	idx = hash64(key) & (t->size - 1);
+	while(t->entries[idx].flags & ENTRY_USED)
+	{
+		if(t->entries[idx].key == key)
+			return &t->entries[idx];
+		idx = (idx + 1) & (t->size - 1);
+	}
+
+	t->used++;
+	t->entries[idx].key = key;
+	t->entries[idx].src = key;
+	t->entries[idx].flags = ENTRY_USED | ENTRY_SRC;
+	return &t->entries[idx];
+}
+
+/*
+ *  CALL SITES
+ */
+static uint32_t site_get(struct sites_s *s, uint64_t hash, uint64_t bt, bool stack)
+{
+	size_t idx;
+
+	hash = (hash) ? hash : 1;
+	if(s->used * 2 >= s->size)
+	{
+		size_t ii;
+		struct site_s *old = s->sites;
+		const size_t old_size = s->size;
+
+		s->size = (old_size) ? old_size * 2 : SITES_INIT;
+		s->sites = xrealloc(NULL, s->size * sizeof(*s->sites));
+		memset(s->sites, 0, s->size * sizeof(*s->sites));
+
+		for(ii = 0; ii < old_size; ii++)
+		{
+			if(!old[ii].hash)
+				continue;
+
+			idx = old[ii].hash & (s->size - 1);
+			while(s->sites[idx].hash)
+				idx = (idx + 1) & (s->size - 1);
+			s->sites[idx] = old[ii];
+		}
+		free(old);
+	}
+
+	idx = hash & (s->size - 1);
+	while(s->sites[idx].hash)
+	{
+		if(s->sites[idx].hash == hash)
+			return idx + 1;
+		idx = (idx + 1) & (s->size - 1);
+	}
+
+	s->used++;
+	s->sites[idx].hash = hash;
+	s->sites[idx].bt = bt;
+	s->sites[idx].stack = stack;
+	return idx + 1;
+}
+
+/*
+ *  THREAD FLOWS
+ */
+static void flow_add(struct flows_s *f, uint64_t pair, uint32_t site,
+		uint64_t frees, uint64_t bytes)
+{
+	size_t idx;
+	const uint64_t hash = hash64(pair ^ ((uint64_t)site << 17));
+
+	if(f->used * 2 >= f->size)
+	{
+		size_t ii;
+		struct flow_s *old = f->flows;
+		const size_t old_size = f->size;
+
+		f->size = (old_size) ? old_size * 2 : FLOWS_INIT;
+		f->flows = xrealloc(NULL, f->size * sizeof(*f->flows));
+		memset(f->flows, 0, f->size * sizeof(*f->flows));
+
+		for(ii = 0; ii < old_size; ii++)
+		{
+			if(!old[ii].pair)
+				continue;
+
+			idx = hash64(old[ii].pair ^ ((uint64_t)old[ii].site << 17)) & (f->size - 1);
+			while(f->flows[idx].pair)
+				idx = (idx + 1) & (f->size - 1);
+			f->flows[idx] = old[ii];
+		}
+		free(old);
+	}
+
+	idx = hash & (f->size - 1);
+	while(f->flows[idx].pair
+		&& (f->flows[idx].pair != pair || f->flows[idx].site != site))
+		idx = (idx + 1) & (f->size - 1);
+
+	if(!f->flows[idx].pair)
+	{
+		f->used++;
+		f->flows[idx].pair = pair;
+		f->flows[idx].site = site;
+	}
+	f->flows[idx].frees += frees;
+	f->flows[idx].bytes += bytes;
+}
+
+static void pending_add(struct chunk_s *ch, uint64_t pair, uint64_t key, uint64_t bytes)
+{
+	if(ch->npending == ch->pending_size)
+	{
+		ch->pending_size = (ch->pending_size) ? ch->pending_size * 2 : FLOWS_INIT;
+		ch->pending = xrealloc(ch->pending, ch->pending_size * sizeof(*ch->pending));
+	}
+
+	ch->pending[ch->npending].pair  = pair;
+	ch->pending[ch->npending].key   = key;
+	ch->pending[ch->npending].bytes = bytes;
+	ch->npending++;
+}
+
+/* ' ~TID' or ' ~TID/ATID' token */
+static void parse_tid(const char *p, const char *end, uint32_t *tid, uint32_t *atid)
+{
+	const char *q;
+
+	*tid = *atid = 0;
+	if((p = memmem(p, end - p, " ~", 2)) == NULL)
+		return;
+
+	for(q = p + 2; q < end && *q >= '0' && *q <= '9'; q++);
+	*tid = parse_int(p + 2, q - p - 2);
+
+	if(q < end && *q == '/')
+	{
+		for(p = ++q; q < end && *q >= '0' && *q <= '9'; q++);
+		*atid = parse_int(p, q - p);
+	}
+}
+
+/* FNV-1a of payload lines, returns end of payload */
+static const char *payload_scan(const char *p, const char *end, uint64_t *hash)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while(p < end)
+	{
+		const char *next = line_next(p, end);
+		const size_t len = line_len(p, next);
+
+		if(line_is_stop(p, len))
+			break;
+
+		for(; p < next; p++)
+		{
+			h ^= (unsigned char)*p;
+			h *= 0x100000001b3ULL;
+		}
+	}
+
+	*hash = h;
+	return p;
+}
+
+/*
+ *  PARSING
+ */
+static void stack_define(struct stacks_s *st, uint64_t id, size_t offset)
+{
+	if(id >= st->size)
+	{
+		size_t size = (st->size) ? st->size : 1024;
+
+		while(size <= id)
+			size *= 2;
+		st->offsets = xrealloc(st->offsets, size * sizeof(*st->offsets));
+		memset(st->offsets + st->size, 0,
+			(size - st->size) * sizeof(*st->offsets));
+		st->size = size;
+	}
+
+	/* first definition wins */
+	if(st->offsets[id] == 0)
+		st->offsets[id] = offset + 1;
+}
+
+/* usage counter change (and freed memory flow) */
+static void entry_change(struct chunk_s *ch, struct entry_s *ent, int64_t change,
+		uint32_t tid, uint32_t atid)
+{
+	/* freed memory flow, site of allocation in preceding chunk is not known yet */
+	if(tid && atid)
+	{
+		const uint64_t pair = ((uint64_t)atid << 32) | tid;
+
+		if(ent->site || !(ent->flags & ENTRY_SRC))
+			flow_add(&ch->flows, pair, ent->site, 1, -change);
+		else
+			pending_add(ch, pair, ent->src, -change);
+	}
+
+	ent->sum += change;
+}
+
+/* first record of address */
+static void entry_record(const struct analyze_s *an, struct entry_s *ent, uint64_t lineno,
+		int64_t change, uint64_t bt, bool stack, const char *func, size_t flen)
+{
+	ent->flags |= ENTRY_RECORD | ((stack) ? ENTRY_STACK : 0);
+	ent->line     = lineno;
+	ent->change   = change;
+	ent->bt       = bt;
+	ent->func     = func - an->data;
+	ent->func_len = (flen < 255) ? flen : 255;
+}
+
+/* + frees COUNT [MEM-STATUS:MEM-STATUS-USABLE] -SIZE ADDR[/ATID] ... (batched frees) */
+static void parse_frees(struct chunk_s *ch, const char *p, size_t len, uint64_t lineno,
+		const char *payload)
+{
+	const struct analyze_s *an = ch->an;
+	const char *end = p + len;
+	const char *q = p;
+	uint32_t tid = 0, atid = 0;
+
+	if(!an->leaks && !an->top && !an->threads)
+		return;
+
+	if(an->threads)
+		parse_tid(p, end, &tid, &atid);
+
+	while((q = memmem(q, end - q, " -", 2)) != NULL)
+	{
+		const char *num = q + 2;
+		const char *addr;
+		struct entry_s *ent;
+		int64_t change;
+
+		for(q = num; q < end && *q >= '0' && *q <= '9'; q++);
+		if(q == num || q == end || *q != ' ')
+			continue;
+		change = -parse_int(num, q - num);
+
+		for(addr = ++q; q < end && *q != ' ' && *q != '/'; q++);
+		ent = entry_get(&ch->table, addr_key(addr, q - addr));
+
+		atid = 0;
+		if(q < end && *q == '/')
+		{
+			for(num = ++q; q < end && *q >= '0' && *q <= '9'; q++);
+			atid = parse_int(num, q - num);
+		}
+
+		entry_change(ch, ent, change, tid, atid);
+
+		/* reported as 'free' (same as findleak) */
+		if(!(ent->flags & ENTRY_RECORD))
+			entry_record(an, ent, lineno, change, payload - an->data, false, p + 2, 4);
+	}
+}
+
+/* + FUNCTION MEM-CHANGE MEM-IN? MEM-OUT? (FUNCTION-PARAMS) [MEM-STATUS:MEM-STATUS-USABLE] */
+static void parse_record(struct chunk_s *ch, const char *p, size_t len, uint64_t lineno,
+		const char *payload)
+{
+	size_t flen, alen = 0, blen = 0;
+	const struct analyze_s *an = ch->an;
+	const char *end = p + len;
+	const char *func, *size, *addr1, *addr2;
+	const char *at;
+	struct entry_s *ent;
+	uint64_t key, bt;
+	int64_t change;
+	uint32_t site = 0;
+	uint32_t tid = 0, atid = 0;
+	bool stack = false;
+	bool is_free;
+
+	func  = field(p, end, 1, &flen);
+	if(func == NULL)
+		return;
+
+	if(flen == 5 && memcmp(func, "frees", 5) == 0)
+	{
+		parse_frees(ch, p, len, lineno, payload);
+		return;
+	}
+
+	size   = field(p, end, 2, &alen);
+	change = (size) ? parse_int(size, alen) : 0;
+
+	addr1 = field(p, end, 3, &alen);
+	addr2 = field(p, end, 4, &blen);
+	key = (addr1) ? addr_key(addr1, alen) : KEY_NIL;
+
+	/* interned stack ' @<id>' (followed by statm or end of line) */
+	bt = payload - an->data;
+	for(at = p; (at = memmem(at, end - at, " @", 2)) != NULL; at += 2)
+	{
+		const char *id_end = at + 2;
+
+		while(id_end < end && *id_end >= '0' && *id_end <= '9')
+			id_end++;
+		if(id_end > at + 2 && (id_end == end
+			|| (end - id_end >= 2 && id_end[0] == ' ' && id_end[1] == '#')))
+		{
+			bt = parse_int(at + 2, id_end - at - 2);
+			stack = true;
+			break;
+		}
+	}
+
+	/* free, delete, delete[] */
+	is_free = ((flen == 4 && memcmp(func, "free", 4) == 0)
+		|| (flen >= 6 && memcmp(func, "delete", 6) == 0));
+
+	/* free of foreign memory (allocated before init, or in pass-through mode) */
+	if(is_free && memmem(p, len, "] !f", 4) != NULL)
+		return;
+	if(an->threads && is_free)
+		parse_tid(p, end, &tid, &atid);
+
+	/* call site */
+	if((an->top || an->threads) && !is_free)
+	{
+		uint64_t hash;
+
+		/* interned and inline backtraces have separate hash spaces */
+		if(stack)
+			hash = hash64(bt) | 1;
+		else
+		{
+			payload_scan(payload, an->data + an->size, &hash);
+			hash &= ~1ULL;
+		}
+
+		site = site_get(&ch->sites, hash, bt, stack);
+		ch->sites.sites[site - 1].calls++;
+		if(change > 0)
+			ch->sites.sites[site - 1].bytes += change;
+	}
+
+	if(!an->leaks && !an->top && !an->threads)
+		return;
+
+	/* realloc (reallocarray) moved block */
+	if(flen >= 7 && memcmp(func, "realloc", 7) == 0 && addr2
+		&& (alen != blen || memcmp(addr1, addr2, alen) != 0))
+	{
+		const uint64_t key2 = addr_key(addr2, blen);
+		struct entry_s *old = entry_get(&ch->table, key);
+		const uint64_t src = old->src;
+		const uint8_t src_flag = old->flags & ENTRY_SRC;
+		const int64_t sum = old->sum;
+
+		old->flags &= ~ENTRY_SRC;
+		old->sum = 0;
+
+		ent = entry_get(&ch->table, key2);
+		ent->flags = (ent->flags & ~ENTRY_SRC) | src_flag;
+		ent->src = src;
+		ent->sum = sum;
+	}
+	else
+		ent = entry_get(&ch->table, key);
+
+	entry_change(ch, ent, change, tid, atid);
+	if(site)
+		ent->site = site;
+
+	if(!(ent->flags & ENTRY_RECORD))
+		entry_record(an, ent, lineno, change, bt, stack, func, flen);
+}
+
+static void out_append(struct chunk_s *ch, const char *p, size_t len)
+{
+	if(ch->out_len + len > ch->out_size)
+	{
+		ch->out_size = (ch->out_size) ? ch->out_size * 2 : (1 << 16);
+		while(ch->out_len + len > ch->out_size)
+			ch->out_size *= 2;
+		ch->out = xrealloc(ch->out, ch->out_size);
+	}
+	memcpy(ch->out + ch->out_len, p, len);
+	ch->out_len += len;
+}
+
+/* matches /^\+.*?\[(-?\d+):(-?\d*)\]/ */
+static void parse_usage(struct chunk_s *ch, const char *p, size_t len)
+{
+	const char *end = p + len;
+	const char *b = p;
+
+	while((b = memchr(b, '[', end - b)) != NULL)
+	{
+		const char *use, *ruse, *q = ++b;
+		size_t use_len, ruse_len;
+
+		use = q;
+		if(q < end && *q == '-')
+			q++;
+		if(q >= end || *q < '0' || *q > '9')
+			continue;
+		while(q < end && *q >= '0' && *q <= '9')
+			q++;
+		use_len = q - use;
+		if(q >= end || *q != ':')
+			continue;
+
+		ruse = ++q;
+		if(q < end && *q == '-')
+			q++;
+		while(q < end && *q >= '0' && *q <= '9')
+			q++;
+		ruse_len = q - ruse;
+		if(q >= end || *q != ']')
+			continue;
+
+		if(ch->an->usable_size && ruse_len)
+			out_append(ch, ruse, ruse_len);
+		else
+			out_append(ch, use, use_len);
+		out_append(ch, "\n", 1);
+		return;
+	}
+}
+
+/* locate line after first INIT/FINI (usage is printed only after it),
+ * whole trace is used if it is only a snippet without INIT/FINI
+ */
+static size_t usage_start(const char *data, size_t size)
+{
+	const char *p = data;
+	const char *end = data + size;
+
+	while(p < end)
+	{
+		const char *next = line_next(p, end);
+
+		if(end - p >= 6 && (memcmp(p, "+ INIT", 6) == 0 || memcmp(p, "+ FINI", 6) == 0))
+			return next - data;
+		p = next;
+	}
+	return 0;
+}
+
+/* parse chunk (line numbers are relative to chunk start) */
+static void *parse_chunk(void *arg)
+{
+	struct chunk_s *ch = arg;
+	const struct analyze_s *an = ch->an;
+	uint64_t lineno = 0;
+	const char *p = ch->start;
+	const char *end = ch->end;
+
+	while(p < end)
+	{
+		const char *next = line_next(p, end);
+		const size_t len = line_len(p, next);
+
+		lineno++;
+		if(len >= 2 && p[0] == '+' && p[1] == ' ')
+		{
+			if(len >= 6 && (memcmp(p + 2, "INIT", 4) == 0 || memcmp(p + 2, "FINI", 4) == 0))
+			{
+				if(p[2] == 'I' && (an->leaks || an->top))
+				{
+					entries_reset(&ch->table, CHUNK_ENTRIES_INIT);
+					ch->reset = true;
+				}
+			}
+			else
+			{
+				if(an->usage && (size_t)(p - an->data) >= an->usage_from)
+					parse_usage(ch, p, len);
+				parse_record(ch, p, len, lineno, next);
+			}
+		}
+		else if(len > 8 && memcmp(p, "# STACK ", 8) == 0)
+		{
+			size_t ii;
+
+			for(ii = 8; ii < len && p[ii] >= '0' && p[ii] <= '9'; ii++);
+			if(ii == len)
+				stack_define(&ch->stacks, parse_int(p + 8, len - 8), next - an->data);
+		}
+		else if(an->usage && p[0] == '+' && (size_t)(p - an->data) >= an->usage_from)
+			parse_usage(ch, p, len);
+		/* usage time series sample (LOG_MALLOC_SERIES) */
+		else if(an->usage && len > 8 && memcmp(p, "# USAGE ", 8) == 0
+			&& (size_t)(p - an->data) >= an->usage_from)
+			parse_usage(ch, p, len);
+
+		p = next;
+	}
+
+	ch->lines = lineno;
+	return NULL;
+}
+
+/* chunk end (start of first record line after chunk size) */
+static const char *chunk_end(const struct analyze_s *an, const char *start)
+{
+	const char *end = an->data + an->size;
+	const char *p;
+
+	if((size_t)(end - start) <= an->chunk_size)
+		return end;
+
+	for(p = start + an->chunk_size - 1; (p = memchr(p, '\n', end - p)) != NULL; p++)
+		if(end - p > 2 && p[1] == '+' && p[2] == ' ')
+			return p + 1;
+	return end;
+}
+
+static void chunk_reset(struct chunk_s *ch, const struct analyze_s *an, const char *start)
+{
+	ch->an    = an;
+	ch->start = start;
+	ch->end   = chunk_end(an, start);
+	ch->lines = 0;
+	ch->reset = false;
+	ch->out_len = 0;
+
+	entries_reset(&ch->table, CHUNK_ENTRIES_INIT);
+
+	free(ch->sites.sites);
+	memset(&ch->sites, 0, sizeof(ch->sites));
+	free(ch->flows.flows);
+	memset(&ch->flows, 0, sizeof(ch->flows));
+	ch->npending = 0;
+	if(ch->stacks.size)
+		memset(ch->stacks.offsets, 0, ch->stacks.size * sizeof(*ch->stacks.offsets));
+}
+
+/* apply chunk to merged state (chunks must be merged in trace order) */
+static void merge_chunk(struct analyze_s *an, const struct chunk_s *ch)
+{
+	size_t ii;
+	uint32_t *site_map = NULL;
+	int64_t *sums;
+
+	if(ch->reset)
+		entries_reset(&an->table, ENTRIES_INIT);
+
+	for(ii = 0; ii < ch->stacks.size; ii++)
+		if(ch->stacks.offsets[ii])
+			stack_define(&an->stacks, ii, ch->stacks.offsets[ii] - 1);
+
+	/* chunk sites to merged sites (first chunk with site defines its backtrace) */
+	if(ch->sites.size)
+	{
+		site_map = xrealloc(NULL, ch->sites.size * sizeof(*site_map));
+		for(ii = 0; ii < ch->sites.size; ii++)
+		{
+			const struct site_s *cs = &ch->sites.sites[ii];
+			uint32_t site;
+
+			if(!cs->hash)
+				continue;
+
+			site = site_get(&an->sites, cs->hash, cs->bt, cs->stack);
+			an->sites.sites[site - 1].calls += cs->calls;
+			an->sites.sites[site - 1].bytes += cs->bytes;
+			site_map[ii] = site;
+		}
+	}
+
+	/* thread flows (pending frees take allocation site from merged state,
+	 * before it is updated by this chunk)
+	 */
+	for(ii = 0; ii < ch->flows.size; ii++)
+	{
+		const struct flow_s *cf = &ch->flows.flows[ii];
+
+		if(cf->pair)
+			flow_add(&an->flows, cf->pair, (cf->site) ? site_map[cf->site - 1] : 0,
+				cf->frees, cf->bytes);
+	}
+	for(ii = 0; ii < ch->npending; ii++)
+	{
+		const struct entry_s *in = entry_find(&an->table, ch->pending[ii].key);
+
+		flow_add(&an->flows, ch->pending[ii].pair, (in) ? in->site : 0,
+			1, ch->pending[ii].bytes);
+	}
+
+	/* new counters are computed from incoming counters first, as realloc
+	 * may have moved counter to address that is updated by this chunk too
+	 */
+	sums = xrealloc(NULL, ch->table.size * sizeof(*sums));
+	for(ii = 0; ii < ch->table.size; ii++)
+	{
+		const struct entry_s *ent = &ch->table.entries[ii];
+		const struct entry_s *in;
+
+		if(!(ent->flags & ENTRY_USED))
+			continue;
+
+		sums[ii] = ent->sum;
+		if((ent->flags & ENTRY_SRC) && (in = entry_find(&an->table, ent->src)) != NULL)
+			sums[ii] += in->sum;
+	}
+
+	for(ii = 0; ii < ch->table.size; ii++)
+	{
+		const struct entry_s *ent = &ch->table.entries[ii];
+		struct entry_s *out;
+
+		if(!(ent->flags & ENTRY_USED))
+			continue;
+
+		out = entry_get(&an->table, ent->key);
+		out->sum = sums[ii];
+		if(ent->site)
+			out->site = site_map[ent->site - 1];
+
+		if((ent->flags & ENTRY_RECORD) && !(out->flags & ENTRY_RECORD))
+		{
+			out->flags   |= ENTRY_RECORD | (ent->flags & ENTRY_STACK);
+			out->line     = an->lines + ent->line;
+			out->change   = ent->change;
+			out->bt       = ent->bt;
+			out->func     = ent->func;
+			out->func_len = ent->func_len;
+		}
+	}
+
+	if(ch->out_len)
+		fwrite(ch->out, 1, ch->out_len, stdout);
+
+	an->lines += ch->lines;
+	free(sums);
+	free(site_map);
+}
+
+/* parse trace in rounds of jobs chunks (bounds memory used by chunk states) */
+static void analyze(struct analyze_s *an)
+{
+	int ii, nchunks;
+	const char *p = an->data;
+	const char *end = an->data + an->size;
+	struct chunk_s *chunks;
+	pthread_t *threads;
+
+	chunks  = xrealloc(NULL, an->jobs * sizeof(*chunks));
+	threads = xrealloc(NULL, an->jobs * sizeof(*threads));
+	memset(chunks, 0, an->jobs * sizeof(*chunks));
+
+	while(p < end)
+	{
+		for(nchunks = 0; nchunks < an->jobs && p < end; nchunks++)
+		{
+			chunk_reset(&chunks[nchunks], an, p);
+			p = chunks[nchunks].end;
+		}
+
+		/* first chunk is parsed by main thread */
+		for(ii = 1; ii < nchunks; ii++)
+			if(pthread_create(&threads[ii], NULL, parse_chunk, &chunks[ii]) != 0)
+			{
+				/* parsed later */
+				threads[ii] = pthread_self();
+			}
+		parse_chunk(&chunks[0]);
+
+		for(ii = 0; ii < nchunks; ii++)
+		{
+			if(ii > 0)
+			{
+				if(pthread_equal(threads[ii], pthread_self()))
+					parse_chunk(&chunks[ii]);
+				else
+					pthread_join(threads[ii], NULL);
+			}
+			merge_chunk(an, &chunks[ii]);
+		}
+	}
+
+	for(ii = 0; ii < an->jobs; ii++)
+	{
+		free(chunks[ii].table.entries);
+		free(chunks[ii].sites.sites);
+		free(chunks[ii].stacks.offsets);
+		free(chunks[ii].flows.flows);
+		free(chunks[ii].pending);
+		free(chunks[ii].out);
+	}
+	free(chunks);
+	free(threads);
+	return;
+}
+
+/*
+ *  OUTPUT
+ */
+static const char *bt_payload(const struct analyze_s *an, uint64_t bt, bool stack)
+{
+	if(!stack)
+		return an->data + bt;
+	if(bt < an->stacks.size && an->stacks.offsets[bt])
+		return an->data + an->stacks.offsets[bt] - 1;
+	return NULL;
+}
+
+/* print backtrace lines, returns their count */
+static int print_backtrace(const struct analyze_s *an, const char *p)
+{
+	int n = 0;
+	const char *end = an->data + an->size;
+
+	while(p && p < end)
+	{
+		const char *next = line_next(p, end);
+		const size_t len = line_len(p, next);
+
+		if(line_is_stop(p, len))
+			break;
+
+		fputc('\t', stdout);
+		fwrite(p, 1, len, stdout);
+		fputc('\n', stdout);
+		p = next;
+		n++;
+	}
+	return n;
+}
+
+static int leak_cmp(const void *a, const void *b)
+{
+	const struct entry_s *ea = *(const struct entry_s **)a;
+	const struct entry_s *eb = *(const struct entry_s **)b;
+
+	return (ea->line > eb->line) - (ea->line < eb->line);
+}
+
+static void print_leaks(const struct analyze_s *an)
+{
+	size_t ii, nleaks = 0;
+	struct entry_s **leaks;
+	const char *c_bold = "\033[1m", *c_rst = "\033[0m";
+
+	if(!isatty(STDOUT_FILENO))
+		c_bold = c_rst = "";
+
+	leaks = xrealloc(NULL, (an->table.used + 1) * sizeof(*leaks));
+	for(ii = 0; ii < an->table.size; ii++)
+	{
+		const struct entry_s *ent = &an->table.entries[ii];
+
+		if((ent->flags & ENTRY_RECORD) && ent->sum != 0)
+			leaks[nleaks++] = &an->table.entries[ii];
+	}
+	qsort(leaks, nleaks, sizeof(*leaks), leak_cmp);
+
+	if(nleaks)
+		printf("%sSUSPECTED %zu LEAKS:%s\n", c_bold, nleaks, c_rst);
+	else
+		printf("NO LEAKS FOUND (HURRAY!)\n");
+
+	for(ii = 0; ii < nleaks; ii++)
+	{
+		char addr[24];
+		const struct entry_s *ent = leaks[ii];
+
+		if(ent->key == KEY_NIL)
+			strcpy(addr, "(nil)");
+		else
+			snprintf(addr, sizeof(addr), "0x%" PRIx64, ent->key);
+
+		printf(" %s%-10s leaked %" PRId64 " bytes (%0.2f KiB) allocated by %.*s (line: %" PRIu64 ")%s\n",
+			c_bold, addr, ent->change, ent->change / 1024.0,
+			(int)ent->func_len, an->data + ent->func,
+			ent->line, c_rst);
+		print_backtrace(an, bt_payload(an, ent->bt, ent->flags & ENTRY_STACK));
+	}
+	free(leaks);
+	return;
+}
+
+/* by bytes, ties by calls and first occurrence (so order does not depend on table layout) */
+static int site_cmp(const void *a, const void *b)
+{
+	const struct site_s *sa = *(const struct site_s **)a;
+	const struct site_s *sb = *(const struct site_s **)b;
+
+	if(sa->bytes != sb->bytes)
+		return (sa->bytes < sb->bytes) - (sa->bytes > sb->bytes);
+	if(sa->calls != sb->calls)
+		return (sa->calls < sb->calls) - (sa->calls > sb->calls);
+	if(sa->bt != sb->bt)
+		return (sa->bt > sb->bt) - (sa->bt < sb->bt);
+	return (sa->hash > sb->hash) - (sa->hash < sb->hash);
+}
+
+static void print_top(const struct analyze_s *an)
+{
+	size_t ii, nsites = 0;
+	struct site_s **sites;
+
+	/* still allocated memory by site of last allocation */
+	for(ii = 0; ii < an->table.size; ii++)
+	{
+		const struct entry_s *ent = &an->table.entries[ii];
+
+		if(ent->site && ent->sum > 0)
+		{
+			an->sites.sites[ent->site - 1].live_blocks++;
+			an->sites.sites[ent->site - 1].live_bytes += ent->sum;
+		}
+	}
+
+	sites = xrealloc(NULL, (an->sites.used + 1) * sizeof(*sites));
+	for(ii = 0; ii < an->sites.size; ii++)
+		if(an->sites.sites[ii].hash)
+			sites[nsites++] = &an->sites.sites[ii];
+	qsort(sites, nsites, sizeof(*sites), site_cmp);
+
+	printf("TOP %zu ALLOCATION SITES (of %zu):\n",
+		(nsites < (size_t)an->top) ? nsites : (size_t)an->top, nsites);
+	for(ii = 0; ii < nsites && ii < (size_t)an->top; ii++)
+	{
+		const struct site_s *site = sites[ii];
+
+		printf(" %" PRIu64 " bytes (%0.2f KiB) in %" PRIu64 " calls, %" PRId64
+			" bytes in %" PRIu64 " blocks still allocated\n",
+			site->bytes, site->bytes / 1024.0, site->calls,
+			site->live_bytes, site->live_blocks);
+		if(print_backtrace(an, bt_payload(an, site->bt, site->stack)) == 0)
+			printf("\t(no backtrace)\n");
+	}
+	free(sites);
+	return;
+}
+
+/* by pair, then by bytes (same ties as sites) */
+static int flow_cmp(const void *a, const void *b)
+{
+	const struct flow_s *fa = *(const struct flow_s **)a;
+	const struct flow_s *fb = *(const struct flow_s **)b;
+
+	if(fa->pair != fb->pair)
+		return (fa->pair > fb->pair) - (fa->pair < fb->pair);
+	if(fa->bytes != fb->bytes)
+		return (fa->bytes < fb->bytes) - (fa->bytes > fb->bytes);
+	if(fa->frees != fb->frees)
+		return (fa->frees < fb->frees) - (fa->frees > fb->frees);
+	return (fa->site > fb->site) - (fa->site < fb->site);
+}
+
+static int tid_cmp(const void *a, const void *b)
+{
+	const uint32_t ta = *(const uint32_t *)a;
+	const uint32_t tb = *(const uint32_t *)b;
+
+	return (ta > tb) - (ta < tb);
+}
+
+/* thread pair totals (flows of pair are adjacent after sort) */
+struct pair_s {
+	uint64_t pair;
+	uint64_t frees;
+	uint64_t bytes;
+	size_t first;		/* first flow of pair */
+	size_t count;
+};
+
+static int pair_cmp(const void *a, const void *b)
+{
+	const struct pair_s *pa = a;
+	const struct pair_s *pb = b;
+
+	if(pa->bytes != pb->bytes)
+		return (pa->bytes < pb->bytes) - (pa->bytes > pb->bytes);
+	return (pa->pair > pb->pair) - (pa->pair < pb->pair);
+}
+
+static void print_threads(const struct analyze_s *an)
+{
+	size_t ii, jj, nflows = 0, npairs = 0, ntids = 0;
+	struct flow_s **flows;
+	struct pair_s *pairs;
+	uint32_t *tids;
+	uint64_t frees = 0, bytes = 0, xfrees = 0, xbytes = 0;
+	const size_t nsites = (an->top) ? (size_t)an->top : FLOW_SITES;
+
+	flows = xrealloc(NULL, (an->flows.used + 1) * sizeof(*flows));
+	for(ii = 0; ii < an->flows.size; ii++)
+		if(an->flows.flows[ii].pair)
+			flows[nflows++] = &an->flows.flows[ii];
+	qsort(flows, nflows, sizeof(*flows), flow_cmp);
+
+	pairs = xrealloc(NULL, (nflows + 1) * sizeof(*pairs));
+	tids = xrealloc(NULL, (nflows * 2 + 1) * sizeof(*tids));
+	for(ii = 0; ii < nflows; ii++)
+	{
+		const struct flow_s *f = flows[ii];
+
+		if(npairs == 0 || pairs[npairs - 1].pair != f->pair)
+		{
+			memset(&pairs[npairs], 0, sizeof(pairs[npairs]));
+			pairs[npairs].pair  = f->pair;
+			pairs[npairs].first = ii;
+			tids[ntids++] = f->pair >> 32;
+			tids[ntids++] = f->pair & 0xffffffff;
+			npairs++;
+		}
+
+		pairs[npairs - 1].frees += f->frees;
+		pairs[npairs - 1].bytes += f->bytes;
+		pairs[npairs - 1].count++;
+
+		frees += f->frees;
+		bytes += f->bytes;
+		if((f->pair >> 32) != (f->pair & 0xffffffff))
+		{
+			xfrees += f->frees;
+			xbytes += f->bytes;
+		}
+	}
+
+	/* unique thread ids */
+	qsort(tids, ntids, sizeof(*tids), tid_cmp);
+	for(ii = jj = 0; ii < ntids; ii++)
+		if(jj == 0 || tids[jj - 1] != tids[ii])
+			tids[jj++] = tids[ii];
+	ntids = jj;
+
+	printf("CROSS-THREAD FREES: %" PRIu64 " of %" PRIu64 " (%" PRIu64 " of %" PRIu64 " bytes), %zu threads\n",
+		xfrees, frees, xbytes, bytes, ntids);
+	if(frees == 0)
+		printf("\t(no thread ids in trace, trace with LOG_MALLOC_TID=1)\n");
+
+	/* matrix, pairs are sorted by allocating, then freeing thread */
+	if(ntids && ntids <= FLOW_MATRIX_MAX)
+	{
+		size_t kk = 0;
+
+		printf("THREAD FLOW MATRIX (freed bytes/frees, rows allocating, columns freeing thread):\n");
+		printf(" %10s", "");
+		for(jj = 0; jj < ntids; jj++)
+			printf(" %20" PRIu32, tids[jj]);
+		printf("\n");
+
+		for(ii = 0; ii < ntids; ii++)
+		{
+			printf(" %10" PRIu32, tids[ii]);
+			for(jj = 0; jj < ntids; jj++)
+			{
+				const uint64_t pair = ((uint64_t)tids[ii] << 32) | tids[jj];
+				char cell[48];
+
+				if(kk < npairs && pairs[kk].pair == pair)
+				{
+					snprintf(cell, sizeof(cell), "%" PRIu64 "/%" PRIu64,
+						pairs[kk].bytes, pairs[kk].frees);
+					kk++;
+				}
+				else
+					strcpy(cell, "-");
+				printf(" %20s", cell);
+			}
+			printf("\n");
+		}
+	}
+
+	/* cross-thread pairs by bytes, with top allocation sites */
+	qsort(pairs, npairs, sizeof(*pairs), pair_cmp);
+	for(ii = 0; ii < npairs; ii++)
+	{
+		const struct pair_s *pr = &pairs[ii];
+
+		if((pr->pair >> 32) == (pr->pair & 0xffffffff))
+			continue;
+
+		printf(" %" PRIu64 " -> %" PRIu64 ": %" PRIu64 " bytes (%0.2f KiB) in %" PRIu64 " frees\n",
+			pr->pair >> 32, pr->pair & 0xffffffff,
+			pr->bytes, pr->bytes / 1024.0, pr->frees);
+
+		for(jj = 0; jj < pr->count && jj < nsites; jj++)
+		{
+			const struct flow_s *f = flows[pr->first + jj];
+			const struct site_s *site = (f->site) ? &an->sites.sites[f->site - 1] : NULL;
+
+			printf("  %" PRIu64 " bytes in %" PRIu64 " frees allocated at:\n",
+				f->bytes, f->frees);
+			if(site == NULL || print_backtrace(an, bt_payload(an, site->bt, site->stack)) == 0)
+				printf("\t(no backtrace)\n");
+		}
+	}
+
+	free(tids);
+	free(pairs);
+	free(flows);
+	return;
+}
+
+static void usage(const char *prog, int ret)
+{
+	fprintf((ret) ? stderr : stdout,
+		"Usage: %s [ OPTIONS ] TRACE-FILE\n"
+		"\n"
+		"  -l, --leaks          print suspected leaks (default, as log-malloc-findleak --no-translate)\n"
+		"  -u, --usage          print memory usage over time (as log-malloc-trackusage)\n"
+		"      --usable-size    print really allocated memory usage (with --usage)\n"
+		"  -t, --top N          print top N allocation call sites\n"
+		"  -T, --threads        print memory flow between allocating and freeing threads\n"
+		"                       (trace with LOG_MALLOC_TID=1, top N sites per thread pair)\n"
+		"  -j, --jobs N         parse trace in N threads (default number of cpus)\n"
+		"      --chunk-size N   parse trace in chunks of N bytes (default trace size / jobs)\n"
+		"  -h, --help           print help\n",
+		prog);
+	exit(ret);
+}
+
+int main(int argc, char *argv[])
+{
+	int fd, opt;
+	struct stat st;
+	struct analyze_s an;
+	static char outbuf[1 << 16];
+	static const struct option opts[] = {
+		{ "leaks",	no_argument,		NULL, 'l' },
+		{ "usage",	no_argument,		NULL, 'u' },
+		{ "usable-size",no_argument,		NULL, 'U' },
+		{ "top",	required_argument,	NULL, 't' },
+		{ "threads",	no_argument,		NULL, 'T' },
+		{ "jobs",	required_argument,	NULL, 'j' },
+		{ "chunk-size",	required_argument,	NULL, 'C' },
+		{ "help",	no_argument,		NULL, 'h' },
+		{ NULL,		0,			NULL, 0 },
+	};
+
+	memset(&an, 0, sizeof(an));
+	an.jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	while((opt = getopt_long(argc, argv, "lut:Tj:h", opts, NULL)) != -1)
+	{
+		switch(opt)
+		{
+			case 'l':
+				an.leaks = true;
+				break;
+
+			case 'u':
+				an.usage = true;
+				break;
+
+			case 'U':
+				an.usable_size = true;
+				break;
+
+			case 't':
+				an.top = atoi(optarg);
+				if(an.top <= 0)
+					usage(argv[0], EXIT_FAILURE);
+				break;
+
+			case 'T':
+				an.threads = true;
+				break;
+
+			case 'j':
+				an.jobs = atoi(optarg);
+				if(an.jobs <= 0)
+					usage(argv[0], EXIT_FAILURE);
+				break;
+
+			case 'C':
+				an.chunk_size = strtoull(optarg, NULL, 10);
+				if(an.chunk_size == 0)
+					usage(argv[0], EXIT_FAILURE);
+				break;
+
+			case 'h':
+				usage(argv[0], EXIT_SUCCESS);
+				break;
+
+			default:
+				usage(argv[0], EXIT_FAILURE);
+		}
+	}
+
+	if(optind + 1 != argc)
+		usage(argv[0], EXIT_FAILURE);
+	if(!an.usage && !an.top && !an.threads)
+		an.leaks = true;
+	if(an.jobs <= 0)
+		an.jobs = 1;
+
+	if((fd = open(argv[optind], O_RDONLY)) == -1 || fstat(fd, &st) == -1)
+	{
+		fprintf(stderr, "%s: failed to open file '%s' - %m\n", argv[0], argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	an.size = st.st_size;
+	if(an.size)
+	{
+		an.data = mmap(NULL, an.size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(an.data == MAP_FAILED)
+		{
+			fprintf(stderr, "%s: failed to map file '%s' - %m\n", argv[0], argv[optind]);
+			return EXIT_FAILURE;
+		}
+		madvise((void *)an.data, an.size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	if(an.size >= 4 && memcmp(an.data, "LM2B", 4) == 0)
+	{
+		fprintf(stderr, "%s: binary trace, convert it with log-malloc-decode first\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if(an.chunk_size == 0)
+	{
+		an.chunk_size = an.size / an.jobs + 1;
+		if(an.chunk_size < CHUNK_MIN)
+			an.chunk_size = CHUNK_MIN;
+		else if(an.chunk_size > CHUNK_MAX)
+			an.chunk_size = CHUNK_MAX;
+	}
+
+	setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+	entries_reset(&an.table, ENTRIES_INIT);
+	if(an.usage)
+		an.usage_from = usage_start(an.data, an.size);
+
+	analyze(&an);
+
+	if(an.leaks)
+		print_leaks(&an);
+	if(an.top)
+		print_top(&an);
+	if(an.threads)
+		print_threads(&an);
+
+	fflush(stdout);
+	return EXIT_SUCCESS;
+}
+
+/* EOF */
@@ -47,6 +47,9 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <execinfo.h>
@@ -55,8 +58,10 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <errno.h>
+#include <limits.h>
 #include <malloc.h>
 #include <time.h>
+#include <sys/uio.h>
 
 #ifdef HAVE_UNWIND
 /* speedup unwinding */
@@ -70,17 +75,21 @@
 #include "log-malloc2.h"
 #include "log-malloc2_internal.h"
 
-/* config */
+/* config (record buffers are sized by runtime backtrace depth) */
 #ifdef HAVE_UNWIND
 #ifdef HAVE_UNWIND_DETAIL
-#define LOG_BUFSIZE	(128 + (256 * LOG_MALLOC_BACKTRACE_COUNT))
+#define LOG_BUFSIZE(depth)	(128 + (256 * (depth)))
 #else
-#define LOG_BUFSIZE	(128 + (32 * LOG_MALLOC_BACKTRACE_COUNT))
+#define LOG_BUFSIZE(depth)	(128 + (32 * (depth)))
 #endif
 #else
-#define LOG_BUFSIZE	128
+#define LOG_BUFSIZE(depth)	(128 + (32 * (depth)))
 #endif
 
+/* binary record: header + frames + statm */
+#define LOG_BINBUFSIZE(depth)	(sizeof(struct log_malloc_brec_s) \
+				+ (8 * (depth)) + 128)
+
 /**
   size       total program size (same as VmSize in /proc/[pid]/status)
   resident   resident set size (same as VmRSS in /proc/[pid]/status)
@@ -101,30 +110,157 @@ static void *(*real_calloc)(size_t nmemb, size_t size)	= NULL;
 static void *(*real_memalign)(size_t boundary, size_t size)	= NULL;
 static int   (*real_posix_memalign)(void **memptr, size_t alignment, size_t size)	= NULL;
 static void *(*real_valloc)(size_t size)	= NULL;
+static void *(*real_aligned_alloc)(size_t alignment, size_t size)	= NULL;
+static void *(*real_pvalloc)(size_t size)	= NULL;
+#ifdef HAVE_MALLOC_USABLE_SIZE
+static size_t (*real_malloc_usable_size)(void *ptr)	= NULL;
+#endif
 
-/* memtracking struct */
+/* memtracking struct
+ *	cb is last word before user memory, where foreign block has its glibc
+ *	chunk size, so header of foreign block is never read
+ */
 struct log_malloc_s {
 	size_t size;		/* allocation size */
-	size_t cb;		/* size check bits */
 #ifdef HAVE_MALLOC_USABLE_SIZE
 	size_t rsize;		/* really allocated size */
 #endif
+	uint32_t flags;		/* LOG_MALLOC_MEM_* */
+	uint32_t tid;		/* allocating thread (fits header padding) */
+#ifdef ENABLE_HISTOGRAM
+	uint64_t timestamp;	/* allocation time (lifetime histogram) */
+#endif
+#if defined(HAVE_MALLOC_USABLE_SIZE) == defined(ENABLE_HISTOGRAM)
+	size_t reserved;	/* keeps cb right before user memory */
+#endif
+	size_t cb;		/* size check bits */
 	char   ptr[0] __attribute__((__aligned__));	/* user memory begin */
 };
 #define MEM_OFF       (sizeof(struct log_malloc_s))
 
+/* compile time check of cb position */
+typedef char log_malloc_cb_check[(offsetof(struct log_malloc_s, cb) + sizeof(size_t) == MEM_OFF) ? 1 : -1];
+
+/* memtracking flags */
+#define LOG_MALLOC_MEM_SAMPLED	0x01	/* allocation traced, trace free too */
+#define LOG_MALLOC_MEM_ARENA	0x02	/* library internal memory (private arena) */
+
 #define MEM_PTR(mem)  (mem != NULL ? ((void *)(((void *)(mem)) + MEM_OFF)) : NULL)
 #define MEM_HEAD(ptr) ((struct log_malloc_s *)(((void *)(ptr)) - MEM_OFF))
 
+/* block allocated by us (glibc chunk size never has top bit set, ~size has) */
+#define MEM_OWNED(ptr)	\
+	((ssize_t)((const size_t *)(ptr))[-1] < 0 && MEM_HEAD(ptr)->size == ~MEM_HEAD(ptr)->cb)
+
+/* memory for block, header or side table entry (LOG_MALLOC_HEADERLESS)
+ *	zero sized block without header would be released by realloc
+ */
+#define MEM_SIZE(size, table)	((table) ? (size) + ((size) == 0) : (size) + MEM_OFF)
+
+/* header keeps user memory aligned to boundary */
+#define MEM_ALIGNED(boundary)	((MEM_OFF & ((boundary) - 1)) == 0)
+
+/* histograms update */
+#ifdef ENABLE_HISTOGRAM
+#define HISTOGRAM_ALLOC(mem, size)	\
+	((mem)->timestamp = (g_ctx.histogram) ? log_malloc_histogram_alloc(size) : 0)
+#define HISTOGRAM_REALLOC(mem, size)	\
+	do {	\
+		if((mem)->timestamp)	\
+			(void)log_malloc_histogram_alloc(size);	\
+	} while(0)
+#define HISTOGRAM_FREE(mem)	\
+	do {	\
+		if((mem)->timestamp)	\
+			log_malloc_histogram_free((mem)->timestamp);	\
+	} while(0)
+#else
+#define HISTOGRAM_ALLOC(mem, size)	do { } while(0)
+#define HISTOGRAM_REALLOC(mem, size)	do { } while(0)
+#define HISTOGRAM_FREE(mem)		do { } while(0)
+#endif
+
+/* thread id of trace event */
+#define EVENT_TID()	((g_ctx.tid) ? log_malloc_gettid() : 0)
+
 /* DL resolving */
 #define DL_RESOLVE(fn)	\
 	((!real_ ## fn) ? (real_ ## fn = dlsym(RTLD_NEXT, # fn)) : (real_ ## fn = ((void *)0x1)))
 #define DL_RESOLVE_CHECK(fn)	\
 	((!real_ ## fn) ? __init_lib() : ((void *)0x1))
 
+/* pthread_atfork() needs __dso_handle, not available with -nostartfiles */
+extern int __register_atfork(void (*prepare)(void), void (*parent)(void),
+	void (*child)(void), void *dso_handle);
+
 /* data context */
 static log_malloc_ctx_t g_ctx = LOG_MALLOC_CTX_INIT;
 
+/* allocation functions dispatch (pass-through mode) */
+struct log_malloc_dispatch_s {
+	void *(*malloc)(size_t size);
+	void  (*free)(void *ptr);
+	void *(*realloc)(void *ptr, size_t size);
+	void *(*calloc)(size_t nmemb, size_t size);
+	void *(*memalign)(size_t boundary, size_t size);
+	int   (*posix_memalign)(void **memptr, size_t alignment, size_t size);
+	void *(*valloc)(size_t size);
+	void *(*aligned_alloc)(size_t alignment, size_t size);
+	void *(*pvalloc)(size_t size);
+};
+
+static void passthrough_free(void *ptr);
+static void *passthrough_realloc(void *ptr, size_t size);
+
+/* libc functions, filled on init */
+static struct log_malloc_dispatch_s g_passthrough;
+
+/* NULL - calls are traced, or &g_passthrough */
+static const struct log_malloc_dispatch_s *g_dispatch = NULL;
+
+#define DISPATCH()	__atomic_load_n(&g_dispatch, __ATOMIC_ACQUIRE)
+
+/* usage counters update */
+#define USAGE_ADD(field, change)	\
+	usage_add(&g_ctx.field, &log_malloc_counters_local()->field,	\
+		offsetof(log_malloc_counters_t, field), (change))
+
+#define STAT_INC(name)	\
+	do {	\
+		if(g_ctx.call_count)	\
+		{	\
+			log_malloc_counters_t *_c = log_malloc_counters_local();	\
+			(void)__sync_fetch_and_add(&_c->stat.name, 1);	\
+			_c->stat.unrel_sum++;	\
+		}	\
+	} while(0)
+
+/** update usage counter, global one if exact trace is wanted, otherwise thread shard
+ * @return	new total (lazily aggregated for shards), 0 if not tracing
+ */
+static inline int64_t usage_add(int64_t *global, int64_t *local,
+	size_t offset, int64_t change)
+{
+	int64_t val;
+
+	if(g_ctx.counters_exact && !g_ctx.memlog_disabled)
+		val = __sync_add_and_fetch(global, change);
+	else
+	{
+		(void)__sync_add_and_fetch(local, change);
+		if(!g_ctx.shards_used)
+			g_ctx.shards_used = true;
+
+		if(g_ctx.memlog_disabled)
+			return 0;
+		val = *(volatile int64_t *)global;
+	}
+
+	if(g_ctx.shards_used)
+		val += log_malloc_counters_shards(offset);
+	return val;
+}
+
 /*
  *  INTERNAL API FUNCTIONS
  */
@@ -133,11 +269,46 @@ log_malloc_ctx_t *log_malloc_ctx_get(void)
 	return &g_ctx;
 }
 
+/** switch pass-through mode (allocation functions call libc directly)
+ * @return	previous state, -1 if library is not initialized
+ * @note	async-signal-safe
+ */
+int log_malloc_passthrough_set(bool enable)
+{
+	const struct log_malloc_dispatch_s *old;
+
+	if(g_ctx.init_done != LOG_MALLOC_INIT_DONE)
+		return -1;
+
+	old = __atomic_exchange_n(&g_dispatch, (enable) ? &g_passthrough : NULL,
+		__ATOMIC_ACQ_REL);
+
+	if(!g_ctx.memlog_disabled && (old != NULL) != enable)
+	{
+		int w;
+
+		if(enable)
+			w = log_malloc_write_text(&g_ctx, "# PASSTHROUGH 1\n", 16);
+		else
+			w = log_malloc_write_text(&g_ctx, "# PASSTHROUGH 0\n", 16);
+	}
+	return (old != NULL);
+}
+
+static void passthrough_signal(int sig)
+{
+	const int err = errno;
+
+	(void)log_malloc_passthrough_set(DISPATCH() == NULL);
+	errno = err;
+	return;
+}
+
 /*
  *  LIBRARY INIT/FINI FUNCTIONS
  */
 static inline void copyfile(const char *head, size_t head_len,
-	const char *path, int outfd)
+	const char *path)
 {
 	int w;
 	int fd = -1;
@@ -148,17 +319,66 @@ static inline void copyfile(const char *head, size_t head_len,
 	if((fd = open(path, 0)) == -1)
 		return;
 
-	w = write(outfd, head, head_len);
+	w = log_malloc_write_text(&g_ctx, head, head_len);
 	// ignoring EINTR here, use SA_RESTART to fix if problem
 	while((len = read(fd, buf, sizeof(buf))) > 0)
-		w = write(outfd, buf, len);
+		w = log_malloc_write_text(&g_ctx, buf, len);
 
 	close(fd);
 	return;
 }
  
+/* apply runtime options (no allocation, called from first malloc) */
+static void log_malloc_config(void)
+{
+	const char *val;
+
+	g_ctx.memlog_fd = log_malloc_options_int("LOG_MALLOC_FD",
+		LOG_MALLOC_TRACE_FD, 0, INT_MAX);
+	g_ctx.depth = log_malloc_options_int("LOG_MALLOC_DEPTH",
+		LOG_MALLOC_BACKTRACE_COUNT, 1, LOG_MALLOC_BACKTRACE_MAX);
+	g_ctx.statm_every = log_malloc_options_int("LOG_MALLOC_STATM", 1, 0, INT_MAX);
+	g_ctx.call_count = log_malloc_options_int("LOG_MALLOC_CALL_COUNT", 1, 0, 1);
+	g_ctx.tid = log_malloc_options_int("LOG_MALLOC_TID", 0, 0, 1);
+	g_ctx.headerless = log_malloc_options_int("LOG_MALLOC_HEADERLESS", 0, 0, 1);
+	g_ctx.bufsize = LOG_BUFSIZE(g_ctx.depth);
+
+	if((val = log_malloc_options_get("LOG_MALLOC_STATM_PATH")) != NULL)
+		g_statm_path = val;
+	if((val = log_malloc_options_get("LOG_MALLOC_MAPS_PATH")) != NULL)
+		g_maps_path = val;
+
+	/* statm disabled */
+	if(g_ctx.statm_every == 0)
+		g_statm_path = "";
+	else
+		log_malloc_statm_init(log_malloc_options_int("LOG_MALLOC_STATM_CACHE", 0, 0, INT_MAX));
+
+	log_malloc_thread_init(log_malloc_options_get("LOG_MALLOC_THREAD_QUOTA"));
+
+	val = log_malloc_options_get("LOG_MALLOC_FREE_STACK");
+	if(val == NULL || val[0] == '\0' || strcmp(val, "foreign") == 0)
+		g_ctx.free_stack = LOG_MALLOC_FREE_STACK_FOREIGN;
+	else if(strcmp(val, "none") == 0 || strcmp(val, "0") == 0)
+		g_ctx.free_stack = LOG_MALLOC_FREE_STACK_NONE;
+	else if(strcmp(val, "all") == 0 || strcmp(val, "1") == 0)
+		g_ctx.free_stack = LOG_MALLOC_FREE_STACK_ALL;
+	else
+		fprintf(stderr, "\n*** log-malloc: unknown free stack mode '%s'\n\n", val);
+	return;
+}
+
+/* release memory of batched free (log-malloc2_tomb.c) */
+static void tomb_release(void *ptr)
+{
+	real_free((MEM_OWNED(ptr)) ? MEM_HEAD(ptr) : ptr);
+	return;
+}
+
 static void *__init_lib(void)
 {
+	const char *sig;
+
 	/* check already initialized */
 	if(!__sync_bool_compare_and_swap(&g_ctx.init_done,
 		LOG_MALLOC_INIT_NULL, LOG_MALLOC_INIT_DONE))
@@ -166,6 +386,10 @@ static void *__init_lib(void)
 
 	LOCK_INIT();
 
+	/* runtime options (LOG_MALLOC_OPTIONS, or LOG_MALLOC_<KEY> variables) */
+	log_malloc_options_init(getenv("LOG_MALLOC_OPTIONS"));
+	log_malloc_config();
+
 	/* open statm */
 	if(g_statm_path[0] != '\0' && (g_ctx.statm_fd = open(g_statm_path, 0)) == -1)
 		fprintf(stderr, "\n*** log-malloc: could not open %s\n\n", g_statm_path);
@@ -178,6 +402,48 @@ static void *__init_lib(void)
 	DL_RESOLVE(memalign);
 	DL_RESOLVE(posix_memalign);
 	DL_RESOLVE(valloc);
+	DL_RESOLVE(aligned_alloc);
+	DL_RESOLVE(pvalloc);
+#ifdef HAVE_MALLOC_USABLE_SIZE
+	DL_RESOLVE(malloc_usable_size);
+#endif
+
+	/* pass-through mode table (libc functions, blocks allocated while tracing
+	 * must still be released by us)
+	 */
+	g_passthrough.malloc		= real_malloc;
+	g_passthrough.free		= passthrough_free;
+	g_passthrough.realloc		= passthrough_realloc;
+	g_passthrough.calloc		= real_calloc;
+	g_passthrough.memalign		= real_memalign;
+	g_passthrough.posix_memalign	= real_posix_memalign;
+	g_passthrough.valloc		= real_valloc;
+	g_passthrough.aligned_alloc	= real_aligned_alloc;
+	g_passthrough.pvalloc		= real_pvalloc;
+
+	/* trace format (writes binary stream header) */
+	if(!g_ctx.memlog_disabled)
+		log_malloc_format_init(log_malloc_options_get("LOG_MALLOC_FORMAT"));
+
+	/* trace buffering (drain thread is started by constructor) */
+	log_malloc_buffer_init(log_malloc_options_get("LOG_MALLOC_BUFFER"),
+		log_malloc_options_get("LOG_MALLOC_BUFFER_OVERFLOW"));
+
+	/* stack interning */
+	log_malloc_stack_init(log_malloc_options_get("LOG_MALLOC_STACK_INTERN"));
+
+	/* backtrace unwinding engine */
+	log_malloc_unwind_init(log_malloc_options_get("LOG_MALLOC_UNWIND"));
+
+	/* allocation sampling */
+	log_malloc_sample_init(log_malloc_options_get("LOG_MALLOC_SAMPLE"));
+
+	/* usage counters mode */
+	log_malloc_counters_init(log_malloc_options_get("LOG_MALLOC_COUNTERS"));
+
+	/* batched frees */
+	log_malloc_tomb_init(log_malloc_options_int("LOG_MALLOC_FREE_BATCH",
+		0, 0, LOG_MALLOC_FREE_BATCH_MAX), tomb_release);
 
 	/* clock */
 	g_ctx.clock_start = clock();
@@ -186,21 +452,22 @@ static void *__init_lib(void)
 	if(!g_ctx.memlog_disabled)
 	{
 		int s, w;
+		log_malloc_counters_t sum;
 		char path[256];
-		char buf[LOG_BUFSIZE + sizeof(path)];
+		char buf[LOG_BUFSIZE(LOG_MALLOC_BACKTRACE_COUNT) + sizeof(path)];
 
 		s = snprintf(buf, sizeof(buf), "# CLOCK-START %lu\n", g_ctx.clock_start);
-		w = write(g_ctx.memlog_fd, buf, s);
+		w = log_malloc_write_text(&g_ctx, buf, s);
 
 		s = snprintf(buf, sizeof(buf), "# PID %u\n", getpid());
-		w = write(g_ctx.memlog_fd, buf, s);
+		w = log_malloc_write_text(&g_ctx, buf, s);
 
 		s = readlink("/proc/self/exe", path, sizeof(path));
 		if(s > 1)
 		{
 			path[s] = '\0';
 			s = snprintf(buf, sizeof(buf), "# EXE %s\n", path);
-			w = write(g_ctx.memlog_fd, buf, s);
+			w = log_malloc_write_text(&g_ctx, buf, s);
 		}
 
 		s = readlink("/proc/self/cwd", path, sizeof(path));
@@ -208,16 +475,24 @@ static void *__init_lib(void)
 		{
 			path[s] = '\0';
 			s = snprintf(buf, sizeof(buf), "# CWD %s\n", path);
-			w = write(g_ctx.memlog_fd, buf, s);
+			w = log_malloc_write_text(&g_ctx, buf, s);
+		}
+
+		if(g_ctx.sample_interval)
+		{
+			s = snprintf(buf, sizeof(buf), "# SAMPLE %zu\n", g_ctx.sample_interval);
+			w = log_malloc_write_text(&g_ctx, buf, s);
 		}
 
-		s = snprintf(buf, sizeof(buf), "+ INIT [%u:%u] malloc=%u calloc=%u realloc=%u memalign=%u/%u valloc=%u free=%u\n",
-				g_ctx.mem_used, g_ctx.mem_rused,
-				g_ctx.stat.malloc, g_ctx.stat.calloc, g_ctx.stat.realloc,
-				g_ctx.stat.memalign, g_ctx.stat.posix_memalign,
-				g_ctx.stat.valloc,
-				g_ctx.stat.free);
-		w = write(g_ctx.memlog_fd, buf, s);
+		log_malloc_counters_sum(&sum);
+		s = snprintf(buf, sizeof(buf), "+ INIT [%" PRId64 ":%" PRId64 "] malloc=%" PRIu64 " calloc=%" PRIu64 " realloc=%" PRIu64
+				" memalign=%" PRIu64 "/%" PRIu64 " valloc=%" PRIu64 " free=%" PRIu64 "\n",
+				sum.mem_used, sum.mem_rused,
+				sum.stat.malloc, sum.stat.calloc, sum.stat.realloc,
+				sum.stat.memalign, sum.stat.posix_memalign,
+				sum.stat.valloc,
+				sum.stat.free);
+		w = log_malloc_write_text(&g_ctx, buf, s);
 
 
 		/* auto-disable trace if file is not open  */
@@ -228,12 +503,65 @@ static void *__init_lib(void)
 			g_ctx.memlog_fd);
 	}
 
+	/* live allocations table (snapshot goes to stderr without trace) */
+	log_malloc_live_init(log_malloc_options_get("LOG_MALLOC_LIVE"),
+		log_malloc_options_get("LOG_MALLOC_LIVE_SIGNAL"));
+
+	/* size class and lifetime histograms */
+	log_malloc_histogram_init(log_malloc_options_get("LOG_MALLOC_HISTOGRAM"),
+		log_malloc_options_get("LOG_MALLOC_HISTOGRAM_SIGNAL"));
+
+	/* aggregate only mode (disables event trace, thread is started by constructor) */
+	log_malloc_series_init(log_malloc_options_get("LOG_MALLOC_SERIES"));
+
+	/* live query socket (thread is started by constructor) */
+	log_malloc_query_init(log_malloc_options_get("LOG_MALLOC_QUERY"));
+
+	/* pass-through mode */
+	if((sig = log_malloc_options_get("LOG_MALLOC_PASSTHROUGH_SIGNAL")) != NULL && sig[0] != '\0')
+	{
+		struct sigaction sa;
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = passthrough_signal;
+		sa.sa_flags = SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+
+		if(sigaction(atoi(sig), &sa, NULL) != 0)
+			fprintf(stderr, "\n*** log-malloc: could not install pass-through signal %s\n\n",
+				sig);
+	}
+
+	if(log_malloc_options_int("LOG_MALLOC_PASSTHROUGH", 0, 0, 1))
+		(void)log_malloc_passthrough_set(true);
+
 	return (void *)0x01;
 }
 
+static void log_malloc2_atfork_child(void)
+{
+	/* new pid, new tid */
+	log_malloc_tid = 0;
+	log_malloc_buffer_atfork_child();
+	log_malloc_live_atfork_child();
+	log_malloc_series_atfork_child();
+	log_malloc_statm_atfork_child();
+	log_malloc_tomb_atfork_child();
+	log_malloc_table_atfork_child();
+	log_malloc_query_atfork_child();
+	return;
+}
+
 static void __attribute__ ((constructor))log_malloc2_init(void)
 {
 	__init_lib();
+
+	(void)__register_atfork(NULL, NULL, log_malloc2_atfork_child, NULL);
+
+	/* threads can not be safely started from first malloc call */
+	log_malloc_buffer_start();
+	log_malloc_series_start();
+	log_malloc_query_start();
   	return;
 }
 
@@ -246,28 +574,51 @@ static void __fini_lib(void)
 		LOG_MALLOC_INIT_DONE, LOG_MALLOC_FINI_DONE))
 		return;
 
+	/* no queries of process being finalized */
+	log_malloc_query_fini();
+
+	/* pending batched frees */
+	log_malloc_tomb_fini();
+
+	/* flush buffered records before summary */
+	log_malloc_buffer_fini();
+
+	/* last usage sample */
+	log_malloc_series_fini();
+
+	/* outstanding allocations */
+	if(g_ctx.live_table)
+		log_malloc_live_snapshot(-1, false, 0);
+
+	/* allocation histograms */
+	if(g_ctx.histogram)
+		log_malloc_histogram_write(-1);
+
 	if(!g_ctx.memlog_disabled)
 	{
 		int s, w;
-		char buf[LOG_BUFSIZE];
+		log_malloc_counters_t sum;
+		char buf[LOG_BUFSIZE(LOG_MALLOC_BACKTRACE_COUNT)];
 		const char maps_head[] = "# FILE /proc/self/maps\n";
 
-		s = snprintf(buf, sizeof(buf), "+ FINI [%u:%u] malloc=%u calloc=%u realloc=%u memalign=%u/%u valloc=%u free=%u\n",
-				g_ctx.mem_used, g_ctx.mem_rused,
-				g_ctx.stat.malloc, g_ctx.stat.calloc, g_ctx.stat.realloc,
-				g_ctx.stat.memalign, g_ctx.stat.posix_memalign,
-				g_ctx.stat.valloc,
-				g_ctx.stat.free);
-		w = write(g_ctx.memlog_fd, buf, s);
+		log_malloc_counters_sum(&sum);
+		s = snprintf(buf, sizeof(buf), "+ FINI [%" PRId64 ":%" PRId64 "] malloc=%" PRIu64 " calloc=%" PRIu64 " realloc=%" PRIu64
+				" memalign=%" PRIu64 "/%" PRIu64 " valloc=%" PRIu64 " free=%" PRIu64 "\n",
+				sum.mem_used, sum.mem_rused,
+				sum.stat.malloc, sum.stat.calloc, sum.stat.realloc,
+				sum.stat.memalign, sum.stat.posix_memalign,
+				sum.stat.valloc,
+				sum.stat.free);
+		w = log_malloc_write_text(&g_ctx, buf, s);
 
 		/* maps out here, because dynamic libs could by mapped during run */
-		copyfile(maps_head, sizeof(maps_head) - 1, g_maps_path, g_ctx.memlog_fd);
+		copyfile(maps_head, sizeof(maps_head) - 1, g_maps_path);
 
 		s = snprintf(buf, sizeof(buf), "# CLOCK-END %lu\n", clck);
-		w = write(g_ctx.memlog_fd, buf, s);
+		w = log_malloc_write_text(&g_ctx, buf, s);
 
 		s = snprintf(buf, sizeof(buf), "# CLOCK-DIFF %lu\n", clck - g_ctx.clock_start);
-		w = write(g_ctx.memlog_fd, buf, s);
+		w = log_malloc_write_text(&g_ctx, buf, s);
 	}
 
 	if(g_ctx.statm_fd != -1)
@@ -289,44 +640,209 @@ static void __attribute__ ((destructor))log_malloc2_fini(void)
  */
 static inline size_t int2hex(unsigned long int num, char *str, size_t max_size)
 {
-	size_t len = 0;
-	const static char hex[] = { '0', '1', '2', '3', '4', '5', '6', '7',
-	                        '8', '9' ,'a', 'b', 'c', 'd', 'e', 'f' };
+	const size_t len = log_malloc_fmt_hex(str, num);
+
+	str[len] = '\0';
+	return len;
+}
+
+
+/* NOTE: tracing functions are always inlined, to keep stack frames
+ *	(skipped by backtrace) stable
+ */
 
-	do
+/* tracing in progress, allocations made by backtrace (libgcc_s loading,
+ * backtrace_symbols...) are library internals served from private arena
+ */
+static __thread int in_trace = 0;
+
+/* records left till next statm read (LOG_MALLOC_STATM=N) */
+static __thread unsigned int statm_left = 0;
+
+/* check if record should contain statm */
+static inline bool log_statm_due(void)
+{
+	if(g_ctx.statm_fd == -1)
+		return false;
+	if(g_ctx.statm_every > 1)
 	{
-		str[len++] = hex[ num & 0xf ];
-		num >>= 4;
- 	} while(num!=0);
- 
- 	unsigned int ii = 0;
-	for(ii = 0; ii < (len / 2); ii++)
+		if(statm_left > 1)
+		{
+			statm_left--;
+			return false;
+		}
+		statm_left = g_ctx.statm_every;
+	}
+	return true;
+}
+
+/* append statm to event line */
+static inline size_t log_statm(char *str, size_t len, size_t max_size)
+{
+	if((max_size - len) > 2 && log_statm_due())
 	{
-		const unsigned int pos = len - ii - 1;
-		const char w = str[ii];
+		ssize_t n;
 
-		str[ii] = str[pos];
-		str[pos] = w;
+		str[len - 1] = ' '; /* remove NL char */
+		str[len]     = '#';
+		n = log_malloc_statm_read(&g_ctx, str + len + 1, max_size - len - 1);
+		len += (n > 0) ? n : 0;
+		str[len++] = '\n';   /* add NL back */
 	}
-	str[len] = '\0';
+	return len;
+}
+
+/* append raw backtrace addresses */
+static inline size_t log_frames(char *str, size_t len, size_t max_size, const uint64_t *frames, int nframes)
+{
+	int ii;
 
+	for(ii = 0; ii < nframes && max_size - len > (16 + 5); ii++)
+	{
+		str[len++] = '[';
+		str[len++] = '0';
+		str[len++] = 'x';
+		len += int2hex(frames[ii], &str[len], max_size - len - 1);
+		str[len++] = ']';
+		str[len++] = '\n';
+	}
 	return len;
 }
 
+/* intern backtrace taken for trace record, so live allocations table
+ * does not unwind the same call again (stack is NULL if not needed)
+ */
+static inline void log_stack_keep(uint32_t *stack, const uint64_t *frames, int nframes)
+{
+	if(stack && *stack == 0)
+		*stack = log_malloc_stack_intern(frames, nframes, NULL);
+	return;
+}
+
+/* capture raw backtrace addresses (without current frame) */
+static inline __attribute__((always_inline)) int log_backtrace(uint64_t *frames, int max)
+{
+	if(g_ctx.unwind == LOG_MALLOC_UNWIND_NONE)
+		return 0;
+
+	/* frame pointers walk (no allocation, no recursion) */
+	if(g_ctx.unwind == LOG_MALLOC_UNWIND_FP)
+		return log_malloc_unwind_fp(__builtin_frame_address(0), frames, max);
+
+#ifdef HAVE_UNWIND
+	if(g_ctx.unwind == LOG_MALLOC_UNWIND_LIBUNWIND)
+		return log_malloc_unwind_cached(frames, max, 1);
+#endif
+
+#ifdef HAVE_BACKTRACE
+	{
+		int ii;
+		int nptrs;
+		void *buffer[LOG_MALLOC_BACKTRACE_MAX + 1];
+
+		nptrs = backtrace(buffer, max + 1) - 1;
+		for(ii = 0; ii < nptrs; ii++)
+			frames[ii] = (uintptr_t)buffer[ii + 1];
+		return (nptrs > 0) ? nptrs : 0;
+	}
+#endif
+	return 0;
+}
+
+#if defined(HAVE_BACKTRACE) && defined(RTLD_DL_LINKMAP)
+#define LOG_IOV(base, len)	\
+	do {	\
+		iov[niov].iov_base = (void *)(base);	\
+		iov[niov++].iov_len = (len);	\
+	} while(0)
+
+/* write record with symbolized backtrace, lines formatted as by
+ * backtrace_symbols_fd(), but without allocation and in single writev()
+ */
+static inline ssize_t log_symbols(const char *str, size_t len, void *const *frames, int nframes)
+{
+	int ii, niov = 0;
+	char hex[LOG_MALLOC_BACKTRACE_MAX][2][24];
+	struct iovec iov[1 + 6 * LOG_MALLOC_BACKTRACE_MAX];
+
+	LOG_IOV(str, len);
+	for(ii = 0; ii < nframes && ii < LOG_MALLOC_BACKTRACE_MAX; ii++)
+	{
+		size_t hlen;
+		Dl_info info;
+		struct link_map *map = NULL;
+		const uintptr_t addr = (uintptr_t)frames[ii];
+
+		if(dladdr1(frames[ii], &info, (void **)&map, RTLD_DL_LINKMAP)
+			&& info.dli_fname != NULL && info.dli_fname[0] != '\0')
+		{
+			LOG_IOV(info.dli_fname, strlen(info.dli_fname));
+
+			if(info.dli_sname != NULL || (map && map->l_addr != 0))
+			{
+				uintptr_t base;
+
+				LOG_IOV("(", 1);
+				if(info.dli_sname != NULL)
+				{
+					LOG_IOV(info.dli_sname, strlen(info.dli_sname));
+					base = (uintptr_t)info.dli_saddr;
+				}
+				else
+					base = map->l_addr;
+
+				hex[ii][0][0] = (addr >= base) ? '+' : '-';
+				hex[ii][0][1] = '0';
+				hex[ii][0][2] = 'x';
+				hlen = 3 + int2hex((addr >= base) ? addr - base : base - addr,
+					&hex[ii][0][3], sizeof(hex[ii][0]) - 3);
+				hex[ii][0][hlen++] = ')';
+				LOG_IOV(hex[ii][0], hlen);
+			}
+		}
+
+		hex[ii][1][0] = '[';
+		hex[ii][1][1] = '0';
+		hex[ii][1][2] = 'x';
+		hlen = 3 + int2hex(addr, &hex[ii][1][3], sizeof(hex[ii][1]) - 3);
+		hex[ii][1][hlen++] = ']';
+		hex[ii][1][hlen++] = '\n';
+		LOG_IOV(hex[ii][1], hlen);
+	}
+	return writev(g_ctx.memlog_fd, iov, niov);
+}
+#endif
 
-static inline void log_trace(char *str, size_t len, size_t max_size, int print_stack)
+static inline __attribute__((always_inline)) void log_trace(char *str, size_t len, size_t max_size,
+	int print_stack, uint32_t *stack)
 {
 	int w;
-	static __thread int in_trace = 0;
 
-	/* prevent deadlock, because inital backtrace call might involve some allocs */
-	if(!in_trace)
+	/* non-default unwinding engine, raw addresses only */
+	if(print_stack && g_ctx.unwind != LOG_MALLOC_UNWIND_DEFAULT)
+	{
+		int nframes;
+		uint64_t frames[LOG_MALLOC_BACKTRACE_MAX];
+
+		in_trace = 1;	/* backtrace may allocate memory !*/
+		nframes = log_backtrace(frames, g_ctx.depth);
+		in_trace = 0;
+
+		log_stack_keep(stack, frames, nframes);
+		len = log_statm(str, len, max_size);
+		len = log_frames(str, len, max_size, frames, nframes);
+		w = log_malloc_write(&g_ctx, str, len);
+		return;
+	}
+
+	in_trace = 1;	/* backtrace may allocate memory !*/
 	{
 #ifdef HAVE_UNWIND
 		int unwind = 0;
 		unw_context_t uc;
 		unw_cursor_t cursor; 
 		int unwind_count = 0;
+		uint64_t frames[LOG_MALLOC_BACKTRACE_MAX];
 
 		if(print_stack)
 		{
@@ -337,25 +853,27 @@ static inline void log_trace(char *str, size_t len, size_t max_size, int print_s
 #else
 #ifdef HAVE_BACKTRACE
 		int nptrs = 0;
-		void *buffer[LOG_MALLOC_BACKTRACE_COUNT + 1];
-
-		in_trace = 1;	/* backtrace may allocate memory !*/
+		void *buffer[LOG_MALLOC_BACKTRACE_MAX + 1];
 
 		if(print_stack)
-			nptrs = backtrace(buffer, LOG_MALLOC_BACKTRACE_COUNT);
-#endif
-#endif
+			nptrs = backtrace(buffer, g_ctx.depth);
 
-		if(g_ctx.statm_fd != -1 && (max_size - len) > 2)
+		if(stack && nptrs > 1)
 		{
-			str[len - 1] = ' '; /* remove NL char */
-			str[len]     = '#';
-			len += pread(g_ctx.statm_fd, str + len + 1, max_size - len - 1, 0);
-			str[len++] = '\n';   /* add NL back */
+			int ii;
+			uint64_t frames[LOG_MALLOC_BACKTRACE_MAX];
+
+			for(ii = 1; ii < nptrs; ii++)
+				frames[ii - 1] = (uintptr_t)buffer[ii];
+			log_stack_keep(stack, frames, nptrs - 1);
 		}
+#endif
+#endif
+
+		len = log_statm(str, len, max_size);
 
 #ifdef HAVE_UNWIND
-		while(print_stack && unwind && unwind_count < LOG_MALLOC_BACKTRACE_COUNT
+		while(print_stack && unwind && unwind_count < g_ctx.depth
 			&& unw_step(&cursor) > 0
 			&& max_size - len > (16 + 5))
 		{
@@ -364,6 +882,7 @@ static inline void log_trace(char *str, size_t len, size_t max_size, int print_s
 			size_t len_start = len;
 
 			unw_get_reg(&cursor, UNW_REG_IP, &ip);
+			frames[unwind_count] = ip;
 
 #ifdef HAVE_UNWIND_DETAIL
 			/* this harms performance */
@@ -388,356 +907,1034 @@ static inline void log_trace(char *str, size_t len, size_t max_size, int print_s
 			
 			unwind_count++;
 		}
+		if(unwind_count)
+			log_stack_keep(stack, frames, unwind_count);
 #else
-#if defined(HAVE_BACKTRACE) && defined(HAVE_BACKTRACE_SYMBOLS_FD)
-		/* try synced write */
-		if(nptrs && print_stack && LOCK(g_ctx.loglock))
+#ifdef HAVE_BACKTRACE
+		/* buffered trace, records must be complete (raw addresses only) */
+		if(nptrs && print_stack && g_ctx.buffer_active)
+		{
+			int ii;
+
+			for(ii = 1; ii < nptrs && max_size - len > (16 + 5); ii++)
+			{
+				str[len++] = '[';
+				str[len++] = '0';
+				str[len++] = 'x';
+				len += int2hex((unsigned long int)buffer[ii], &str[len], max_size - len - 1);
+				str[len++] = ']';
+				str[len++] = '\n';
+			}
+		}
+#ifdef RTLD_DL_LINKMAP
+		/* symbolized record goes out in single write (no lock needed) */
+		else if(nptrs && print_stack)
+		{
+			buffer[nptrs] = NULL;	/* end marker, as before */
+			w = log_symbols(str, len, &buffer[1], nptrs);
+			in_trace = 0;
+			return;
+		}
+#elif defined(HAVE_BACKTRACE_SYMBOLS_FD)
+		/* no dladdr1(), records of concurrent threads might interleave */
+		else if(nptrs && print_stack)
 		{
 			w = write(g_ctx.memlog_fd, str, len);
 			backtrace_symbols_fd(&buffer[1], nptrs, g_ctx.memlog_fd);
-			in_trace = UNLOCK(g_ctx.loglock); /* failed unlock will not re-enable synced tracing */
+			in_trace = 0;
+			return;
 		}
-		else
 #endif
 #endif
+#endif
+		w = log_malloc_write(&g_ctx, str, len);
+	}
+	in_trace = 0;
+	return;
+}
+
+
+/* text trace with interned backtrace, stack is written once
+ * as '# STACK <id>' and events refer to it by ' @<id>'
+ */
+static inline __attribute__((always_inline)) void log_trace_interned(char *str, size_t len, size_t max_size,
+	uint32_t *stack)
+{
+	int w;
+	int nframes;
+	uint32_t id;
+	bool added = false;
+	size_t olen = 0;
+	uint64_t frames[LOG_MALLOC_BACKTRACE_MAX];
+	char out[g_ctx.bufsize * 2];
+
+	in_trace = 1;	/* backtrace may allocate memory !*/
+	nframes = log_backtrace(frames, g_ctx.depth);
+	in_trace = 0;
+
+	id = log_malloc_stack_intern(frames, nframes, &added);
+	if(stack)
+		*stack = id;
+
+	/* stack definition goes before first reference */
+	if(added)
+	{
+		memcpy(out, "# STACK ", 8);
+		olen = 8 + log_malloc_fmt_udec(out + 8, id);
+		out[olen++] = '\n';
+		olen = log_frames(out, olen, sizeof(out) - max_size, frames, nframes);
+	}
+
+	/* ' @ID' goes before NL */
+	if(id && max_size - len > 16)
+	{
+		str[len - 1] = ' ';
+		str[len++]   = '@';
+		len += log_malloc_fmt_udec(str + len, id);
+		str[len++]   = '\n';
+	}
+
+	len = log_statm(str, len, max_size);
+	memcpy(out + olen, str, len);
+	olen += len;
+
+	/* not interned, inline stack */
+	if(!id)
+		olen = log_frames(out, olen, sizeof(out), frames, nframes);
+
+	w = log_malloc_write(&g_ctx, out, olen);
+	return;
+}
+
+static inline __attribute__((always_inline)) void log_trace_binary(const log_malloc_event_t *ev, int print_stack,
+	uint32_t *stack)
+{
+	int w;
+	size_t len = 0;
+	int nframes = 0;
+	uint32_t id = 0;
+	bool added = false;
+	uint64_t frames[LOG_MALLOC_BACKTRACE_MAX];
+	char buf[LOG_BINBUFSIZE(g_ctx.depth) + sizeof(struct log_malloc_brec_s)] __attribute__((__aligned__(8)));
+	struct log_malloc_brec_s *rec;
+
+	if(print_stack)
+	{
+		in_trace = 1;	/* backtrace may allocate memory !*/
+		nframes = log_backtrace(frames, g_ctx.depth);
+		in_trace = 0;
+
+		if(g_ctx.stack_intern)
 		{
-			w = write(g_ctx.memlog_fd, str, len);
-			in_trace = 0;
+			id = log_malloc_stack_intern(frames, nframes, &added);
+			if(stack)
+				*stack = id;
 		}
+		else
+			log_stack_keep(stack, frames, nframes);
+	}
+
+	/* stack definition record goes before first reference */
+	if(added)
+	{
+		const log_malloc_event_t sev = { LOG_MALLOC_EV_STACK };
+
+		rec = (struct log_malloc_brec_s *)buf;
+		len = log_malloc_format_binary(&sev, buf, sizeof(buf));
+		rec->stack = id;
+		rec->nframes = nframes;
+		memcpy(buf + len, frames, nframes * sizeof(frames[0]));
+		len += nframes * sizeof(frames[0]);
 	}
+
+	rec = (struct log_malloc_brec_s *)(buf + len);
+	len += log_malloc_format_binary(ev, buf + len, sizeof(buf) - len);
+
+	if(id)
+		rec->stack = id;
+	else if(nframes)
+	{
+		rec->nframes = nframes;
+		memcpy(buf + len, frames, nframes * sizeof(frames[0]));
+		len += nframes * sizeof(frames[0]);
+	}
+
+	if(log_statm_due())
+	{
+		ssize_t n = log_malloc_statm_read(&g_ctx, buf + len, sizeof(buf) - len - 8);
+
+		if(n > 0)
+		{
+			rec->statm_len = n;
+			len += n;
+
+			while(len != LOG_MALLOC_BINARY_ALIGN(len))
+				buf[len++] = '\0';
+		}
+	}
+
+	w = log_malloc_write(&g_ctx, buf, len);
+	return;
+}
+
+/** log event in configured trace format
+ * @param	stack	set to interned id of logged backtrace (NULL - not needed)
+ */
+static inline __attribute__((always_inline)) void log_event(const log_malloc_event_t *ev, int print_stack,
+	uint32_t *stack)
+{
+	if(g_ctx.unwind == LOG_MALLOC_UNWIND_NONE)
+		print_stack = 0;
+
+	if(g_ctx.format == LOG_MALLOC_FORMAT_BINARY)
+		log_trace_binary(ev, print_stack, stack);
 	else
 	{
-		str[len - 1]	= '!';
-		str[len++]	= '\n';	/* there is alway one char left, with '\0' from sprintf */
+		size_t s;
+		char buf[g_ctx.bufsize];
 
-		w = write(g_ctx.memlog_fd, str, len);
+		s = log_malloc_format_text(ev, buf, sizeof(buf));
+		if(print_stack && g_ctx.stack_intern)
+			log_trace_interned(buf, s, sizeof(buf), stack);
+		else
+			log_trace(buf, s, sizeof(buf), print_stack, stack);
 	}
 	return;
 }
 
 
-/*
- *  LIBRARY FUNCTIONS
+/* interned backtrace of current call (live allocations table),
+ * stack already taken by trace record is reused
  */
-void *malloc(size_t size)
+static inline __attribute__((always_inline)) uint32_t log_stack_id(uint32_t stack)
 {
-	struct log_malloc_s *mem;
-	sig_atomic_t memuse;
-	sig_atomic_t memruse = 0;
+	int nframes;
+	uint64_t frames[LOG_MALLOC_BACKTRACE_MAX];
 
-	if(!DL_RESOLVE_CHECK(malloc))
+	if(stack || in_trace)
+		return stack;
+
+	in_trace = 1;	/* backtrace may allocate memory !*/
+	nframes = log_backtrace(frames, g_ctx.depth);
+	in_trace = 0;
+
+	return log_malloc_stack_intern(frames, nframes, NULL);
+}
+
+
+/* allocation of library internals while tracing (private arena, not traced) */
+static inline void *arena_alloc(size_t size, bool zero)
+{
+	struct log_malloc_s *mem = log_malloc_arena_alloc(size + MEM_OFF);
+
+	if(mem == NULL)
+		return NULL;
+
+	if(zero)
+		memset(mem->ptr, 0, size);
+	mem->size = size;
+	mem->cb = ~mem->size;
+	mem->flags = LOG_MALLOC_MEM_ARENA;
+	mem->tid = 0;
+#ifdef HAVE_MALLOC_USABLE_SIZE
+	mem->rsize = size;
+#endif
+	return MEM_PTR(mem);
+}
+
+static inline void *arena_realloc(void *ptr, size_t size)
+{
+	void *nptr = arena_alloc(size, false);
+	const size_t old_size = MEM_HEAD(ptr)->size;
+
+	if(nptr == NULL)
+		return NULL;
+
+	memcpy(nptr, ptr, (old_size < size) ? old_size : size);
+	log_malloc_arena_free(MEM_HEAD(ptr));
+	return nptr;
+}
+
+
+/* store header of block without header to side table */
+static inline bool mem_table_add(const void *ptr, const struct log_malloc_s *mem)
+{
+	const log_malloc_meta_t meta = { (uintptr_t)ptr, mem->size,
+#ifdef ENABLE_HISTOGRAM
+		mem->timestamp,
+#else
+		0,
+#endif
+		mem->flags, mem->tid };
+
+	return log_malloc_table_add(&meta);
+}
+
+/** get header of owned block
+ * @param	head	filled for block from side table (block is removed from table)
+ * @return	header, NULL if block is foreign
+ */
+static inline struct log_malloc_s *mem_take(void *ptr, struct log_malloc_s *head)
+{
+	log_malloc_meta_t meta;
+
+	if(MEM_OWNED(ptr))
+		return MEM_HEAD(ptr);
+	if(!g_ctx.side_table || !log_malloc_table_del(ptr, &meta))
+		return NULL;
+
+	head->size = meta.size;
+	head->cb = ~head->size;
+	head->flags = meta.flags;
+	head->tid = meta.tid;
+#ifdef ENABLE_HISTOGRAM
+	head->timestamp = meta.timestamp;
+#endif
+#ifdef HAVE_MALLOC_USABLE_SIZE
+	head->rsize = real_malloc_usable_size(ptr);
+#endif
+	return head;
+}
+
+/* block allocated by us (with header, or in side table) */
+static inline bool mem_owned(const void *ptr)
+{
+	return MEM_OWNED(ptr) || (g_ctx.side_table && log_malloc_table_has(ptr));
+}
+
+/** account new block, header goes in front of user memory, or to side table
+ * @param	block	allocated memory (MEM_SIZE(size, table) bytes)
+ * @return	user memory, NULL if block is NULL or side table can not grow
+ */
+static inline void *mem_new(void *block, bool table, size_t size, bool sampled,
+	int64_t *memuse, int64_t *memruse)
+{
+	struct log_malloc_s head;
+	struct log_malloc_s *mem = (table) ? &head : block;
+
+	if(block == NULL)
 		return NULL;
 
-	if((mem = real_malloc(size + MEM_OFF)) != NULL)
+	mem->size = size;
+	mem->cb = ~mem->size;
+	mem->flags = (sampled) ? LOG_MALLOC_MEM_SAMPLED : 0;
+	mem->tid = log_malloc_gettid();
+	HISTOGRAM_ALLOC(mem, size);
+
+	if(table && !mem_table_add(block, mem))
 	{
-		mem->size = size;
-		mem->cb = ~mem->size;
-		memuse = __sync_add_and_fetch(&g_ctx.mem_used, mem->size);
+		HISTOGRAM_FREE(mem);
+		real_free(block);
+		return NULL;
+	}
 
+	*memuse = USAGE_ADD(mem_used, mem->size);
+	log_malloc_thread_add(mem->size);
 #ifdef HAVE_MALLOC_USABLE_SIZE
-		mem->rsize = malloc_usable_size(mem);
-		memruse = __sync_add_and_fetch(&g_ctx.mem_rused, mem->rsize);
+	mem->rsize = real_malloc_usable_size(block);
+	*memruse = USAGE_ADD(mem_rused, mem->rsize);
 #endif
+	return (table) ? block : MEM_PTR(block);
+}
+
+
+/* C++ operator new variant */
+#define OP_ALIGNED	0x01	/* (size, std::align_val_t) */
+#define OP_NOTHROW	0x02	/* (size, [align,] const std::nothrow_t &) */
+
+struct log_malloc_op_s {
+	const char *name;	/* mangled name */
+	const char *nothrow;	/* mangled name of nothrow variant */
+	int variant;		/* OP_* */
+};
+
+/* retry of failed C++ allocation in progress, allocations made by real
+ * operator are not logged (blocks are unsampled), failure is logged once
+ */
+static __thread int in_new_retry = 0;
+
+/* call real operator of given variant */
+static void *op_call(void *fn, int variant, size_t size, size_t align)
+{
+	static const char nothrow = 0;	/* std::nothrow_t is empty */
+
+	switch(variant)
+	{
+		case OP_ALIGNED:
+			return ((void *(*)(size_t, size_t))fn)(size, align);
+		case OP_NOTHROW:
+			return ((void *(*)(size_t, const void *))fn)(size, &nothrow);
+		case OP_ALIGNED | OP_NOTHROW:
+			return ((void *(*)(size_t, size_t, const void *))fn)(size, align, &nothrow);
+		default:
+			return ((void *(*)(size_t))fn)(size);
+	}
+}
+
+/* C++ allocation failed (and is logged), real nothrow operator calls new
+ * handler and allocates again, throwing operator throws std::bad_alloc if
+ * that fails too
+ */
+static void *op_new_failed(const struct log_malloc_op_s *op, size_t size, size_t align)
+{
+	void *fn;
+	void *ptr;
+
+	/* throwing operator called by real nothrow one, exception is caught there */
+	if(in_new_retry)
+	{
+		if((fn = dlsym(RTLD_NEXT, op->name)) == NULL)
+			return NULL;
+		return op_call(fn, op->variant, size, align);
 	}
+
+	if((fn = dlsym(RTLD_NEXT, op->nothrow)) == NULL)
+		return NULL;
+
+	in_new_retry = 1;
+	ptr = op_call(fn, op->variant | OP_NOTHROW, size, align);
+	in_new_retry = 0;
+
+	if(ptr || (op->variant & OP_NOTHROW))
+		return ptr;
+
+	/* std::__throw_bad_alloc() */
+	if((fn = dlsym(RTLD_NEXT, "_ZSt17__throw_bad_allocv")) != NULL)
+		((void (*)(void))fn)();
+	return NULL;
+}
+
+
+/*
+ *  TRACED FUNCTIONS
+ *	type is event type of called API, op is C++ operator new (NULL for C API)
+ */
+static __attribute__((noinline)) void *malloc_traced(size_t size, int type,
+	const struct log_malloc_op_s *op)
+{
+	void *ptr;
+	bool sampled;
+	uint32_t stack = 0;
+	const bool table = g_ctx.headerless;
+	int64_t memuse = 0;
+	int64_t memruse = 0;
+
+	if(!DL_RESOLVE_CHECK(malloc))
+		return NULL;
+
+	if(in_trace)
+		return arena_alloc(size, false);
+
+	sampled = !in_new_retry && log_malloc_sample(&g_ctx, size);
+	ptr = mem_new(real_malloc(MEM_SIZE(size, table)), table, size, sampled,
+		&memuse, &memruse);
 #ifndef DISABLE_CALL_COUNTS
-	(void)__sync_fetch_and_add(&g_ctx.stat.malloc, 1);
-	g_ctx.stat.unrel_sum++;
+	STAT_INC(malloc);
 #endif
 
-	if(!g_ctx.memlog_disabled)
+	if(!g_ctx.memlog_disabled && sampled)
 	{
-		int s;
-		char buf[LOG_BUFSIZE];
+		const log_malloc_event_t ev = { type, 0, false,
+			size, ptr, NULL, 0, 0,
+			memuse, memruse, EVENT_TID() };
 
-		s = snprintf(buf, sizeof(buf), "+ malloc %zu %p [%u:%u]\n",
-			size, MEM_PTR(mem),
-			memuse, memruse);
-
-		log_trace(buf, s, sizeof(buf), 1);
+		log_event(&ev, 1, (g_ctx.live_table) ? &stack : NULL);
 	}
-	return MEM_PTR(mem);
+
+	if(g_ctx.live_table && sampled && ptr)
+		log_malloc_live_add(ptr, size, log_stack_id(stack));
+	return (ptr || op == NULL) ? ptr : op_new_failed(op, size, 0);
 }
 
-void *calloc(size_t nmemb, size_t size)
+static __attribute__((noinline)) void *calloc_traced(size_t nmemb, size_t size)
 {
-	struct log_malloc_s *mem;
-	sig_atomic_t memuse;
-	sig_atomic_t memruse = 0;
+	void *ptr;
+	bool sampled;
+	uint32_t stack = 0;
+	const bool table = g_ctx.headerless;
+	int64_t memuse = 0;
+	int64_t memruse = 0;
 	size_t calloc_size = 0;
 
 	if(!DL_RESOLVE_CHECK(calloc))
 		return NULL;
 
-	calloc_size = (nmemb * size);	//FIXME: what about check for overflow here ?
-	if((mem = real_calloc(1, calloc_size + MEM_OFF)) != NULL)
+	/* as glibc, header would wrap size over PTRDIFF_MAX */
+	if(__builtin_mul_overflow(nmemb, size, &calloc_size) || calloc_size > PTRDIFF_MAX)
 	{
-		mem->size = calloc_size;
-		mem->cb = ~mem->size;
-		memuse = __sync_add_and_fetch(&g_ctx.mem_used, mem->size);
-
-#ifdef HAVE_MALLOC_USABLE_SIZE
-		mem->rsize = malloc_usable_size(mem);
-		memruse = __sync_add_and_fetch(&g_ctx.mem_rused, mem->rsize);
-#endif
+		errno = ENOMEM;
+		return NULL;
 	}
+
+	if(in_trace)
+		return arena_alloc(calloc_size, true);
+
+	sampled = log_malloc_sample(&g_ctx, calloc_size);
+	ptr = mem_new(real_calloc(1, MEM_SIZE(calloc_size, table)), table, calloc_size, sampled,
+		&memuse, &memruse);
 #ifndef DISABLE_CALL_COUNTS
-	(void)__sync_fetch_and_add(&g_ctx.stat.calloc, 1);
-	g_ctx.stat.unrel_sum++;
+	STAT_INC(calloc);
 #endif
 
-	if(!g_ctx.memlog_disabled)
+	if(!g_ctx.memlog_disabled && sampled)
 	{
-		int s;
-		char buf[LOG_BUFSIZE];
-
-		//getrusage(RUSAGE_SELF, &ruse);
-		s = snprintf(buf, sizeof(buf), "+ calloc %zu %p [%u:%u] (%zu %zu)\n",
-			nmemb * size, MEM_PTR(mem),
-			memuse, memruse,
-			nmemb, size);
+		const log_malloc_event_t ev = { LOG_MALLOC_EV_CALLOC, 0, false,
+			calloc_size, ptr, NULL, nmemb, size,
+			memuse, memruse, EVENT_TID() };
 
-		log_trace(buf, s, sizeof(buf), 1);
+		log_event(&ev, 1, (g_ctx.live_table) ? &stack : NULL);
 	}
-	return MEM_PTR(mem);
+
+	if(g_ctx.live_table && sampled && ptr)
+		log_malloc_live_add(ptr, calloc_size, log_stack_id(stack));
+	return ptr;
 }
 
-void *realloc(void *ptr, size_t size)
+static __attribute__((noinline)) void *realloc_traced(void *ptr, size_t size, int type)
 {
-	struct log_malloc_s *mem;
-	sig_atomic_t memuse = 0;
-	sig_atomic_t memruse = 0;
-	sig_atomic_t memchange = 0;
+	struct log_malloc_s head;
+	struct log_malloc_s *mem = NULL;
+	void *block;
+	void *nptr;
+	bool table;
+	bool sampled;
+	uint32_t stack = 0;
+	size_t old_size = 0;
+	int64_t memuse = 0;
+	int64_t memruse = 0;
+	int64_t memchange = 0;
 #ifdef HAVE_MALLOC_USABLE_SIZE
 	size_t       rsize = 0;
-	sig_atomic_t memrchange = 0;
+	int64_t memrchange = 0;
 #endif
 
 	if(!DL_RESOLVE_CHECK(realloc))
 		return NULL;
 
-	mem = (ptr != NULL) ? MEM_HEAD(ptr) : NULL;
+	/* foreign memory (allocated before init or in pass-through mode) stays foreign */
+	if(ptr && (mem = mem_take(ptr, &head)) == NULL)
+		return real_realloc(ptr, size);
 
-	//FIXME: not handling foreign memory here (seems not needed)
-	if(mem && (mem->size != ~mem->cb))
-	{
-		assert(mem->size != ~mem->cb);
-		return NULL;
-	}
+	/* library internals stay in private arena */
+	if(mem && (mem->flags & LOG_MALLOC_MEM_ARENA))
+		return arena_realloc(ptr, size);
+	if(in_trace && mem == NULL)
+		return arena_alloc(size, false);
+
+	/* block keeps its header placement */
+	table = (mem) ? (mem == &head) : g_ctx.headerless;
+	old_size = (mem) ? mem->size : 0;
+
+	/* realloc keeps sampling decision of original block */
+	sampled = (mem) ? (mem->flags & LOG_MALLOC_MEM_SAMPLED) : log_malloc_sample(&g_ctx, size);
 
-	if((mem = real_realloc(mem, size + MEM_OFF)) != NULL)
+	/* before realloc, address might be reused by other thread right after */
+	if(g_ctx.live_table && sampled && ptr)
+		log_malloc_live_del(ptr);
+
+	if((block = real_realloc((mem && !table) ? (void *)mem : ptr, MEM_SIZE(size, table))) != NULL)
 	{
-		memchange = (ptr) ? size - mem->size : size;
-		memuse = __sync_add_and_fetch(&g_ctx.mem_used, memchange);
+		/* header was moved with block, side table one is still in head */
+		if(!table)
+			mem = block;
+
+		memchange = (ptr) ? (int64_t)size - (int64_t)old_size : (int64_t)size;
+		memuse = USAGE_ADD(mem_used, memchange);
+		log_malloc_thread_add(memchange);
 
 #ifdef HAVE_MALLOC_USABLE_SIZE
-		rsize = malloc_usable_size(mem);
+		rsize = real_malloc_usable_size(block);
 
-		memrchange = (ptr) ? rsize - mem->rsize : rsize;
-		memruse = __sync_add_and_fetch(&g_ctx.mem_rused, memrchange);
+		memrchange = (ptr) ? (int64_t)rsize - (int64_t)mem->rsize : (int64_t)rsize;
+		memruse = USAGE_ADD(mem_rused, memrchange);
 #endif
 	}
+	/* original block stays valid */
+	else if(table && mem)
+		(void)mem_table_add(ptr, mem);
 #ifndef DISABLE_CALL_COUNTS
-	(void)__sync_fetch_and_add(&g_ctx.stat.realloc, 1);
-	g_ctx.stat.unrel_sum++;
+	STAT_INC(realloc);
 #endif
 
-	if(!g_ctx.memlog_disabled)
+	nptr = (block && !table) ? MEM_PTR(block) : block;
+	if(!g_ctx.memlog_disabled && sampled && !in_trace)
 	{
-		int s;
-		char buf[LOG_BUFSIZE];
-
-		s = snprintf(buf, sizeof(buf), "+ realloc %d %p %p (%zu %zu) [%u:%u]\n",
-			memchange, ptr,
-			MEM_PTR(mem), (mem ? mem->size : 0), size,
-			memuse, memruse);
+		const log_malloc_event_t ev = { type, 0, false,
+			memchange, nptr, ptr, (nptr && ptr) ? old_size : 0, size,
+			memuse, memruse, EVENT_TID() };
 
-		log_trace(buf, s, sizeof(buf), 1);
+		log_event(&ev, 1, (g_ctx.live_table) ? &stack : NULL);
 	}
 
+	if(g_ctx.live_table && sampled && (nptr || ptr))
+		log_malloc_live_add((nptr) ? nptr : ptr,
+			(nptr) ? size : old_size, log_stack_id(stack));
+
 	/* now we can update */
-	if(mem != NULL)
+	if(nptr != NULL)
 	{
+		if(table)
+			mem = &head;
 		mem->size = size;
 		mem->cb = ~mem->size;
+		mem->flags = (sampled) ? LOG_MALLOC_MEM_SAMPLED : 0;
+		mem->tid = log_malloc_gettid();
+		/* resized block keeps its allocation time */
+		if(ptr)
+			HISTOGRAM_REALLOC(mem, size);
+		else
+			HISTOGRAM_ALLOC(mem, size);
 #ifdef HAVE_MALLOC_USABLE_SIZE
 		mem->rsize = rsize;
 #endif
+		/* side table can not grow, block stays foreign */
+		if(table)
+			(void)mem_table_add(nptr, mem);
 	}
-	return MEM_PTR(mem);
+	return nptr;
 }
 
-void *memalign(size_t boundary, size_t size)
+static __attribute__((noinline)) void *memalign_traced(size_t boundary, size_t size, int type,
+	const struct log_malloc_op_s *op)
 {
-	struct log_malloc_s *mem;
-	sig_atomic_t memuse;
-	sig_atomic_t memruse = 0;
+	void *ptr;
+	bool sampled;
+	uint32_t stack = 0;
+	const bool table = g_ctx.headerless || !MEM_ALIGNED(boundary);
+	int64_t memuse = 0;
+	int64_t memruse = 0;
 
 	if(!DL_RESOLVE_CHECK(memalign))
 		return NULL;
 
-	if(boundary > MEM_OFF)
-		return NULL;
-
-	if((mem = real_memalign(boundary, size + MEM_OFF)) != NULL)
-	{
-		mem->size = size;
-		mem->cb = ~mem->size;
-		memuse = __sync_add_and_fetch(&g_ctx.mem_used, mem->size);
-#ifdef HAVE_MALLOC_USABLE_SIZE
-		mem->rsize = malloc_usable_size(mem);
-		memruse = __sync_add_and_fetch(&g_ctx.mem_rused, mem->rsize);
-#endif
-	}
+	sampled = !in_new_retry && log_malloc_sample(&g_ctx, size);
+	ptr = mem_new(((type == LOG_MALLOC_EV_ALIGNED_ALLOC) ? real_aligned_alloc : real_memalign)
+		(boundary, MEM_SIZE(size, table)), table, size, sampled, &memuse, &memruse);
 #ifndef DISABLE_CALL_COUNTS
-	(void)__sync_fetch_and_add(&g_ctx.stat.memalign, 1);
-	g_ctx.stat.unrel_sum++;
+	STAT_INC(memalign);
 #endif
 
-	if(!g_ctx.memlog_disabled)
+	if(!g_ctx.memlog_disabled && sampled && !in_trace)
 	{
-		int s;
-		char buf[LOG_BUFSIZE];
+		const log_malloc_event_t ev = { type, 0, false,
+			size, ptr, NULL, boundary, 0,
+			memuse, memruse, EVENT_TID() };
 
-		s = snprintf(buf, sizeof(buf), "+ memalign %zu %p (%zu) [%u:%u]\n",
-			size, MEM_PTR(mem),
-			boundary, 
-			memuse, memruse);
-
-		log_trace(buf, s, sizeof(buf), 1);
+		log_event(&ev, 1, (g_ctx.live_table) ? &stack : NULL);
 	}
-	return MEM_PTR(mem);
+
+	if(g_ctx.live_table && sampled && ptr)
+		log_malloc_live_add(ptr, size, log_stack_id(stack));
+	return (ptr || op == NULL) ? ptr : op_new_failed(op, size, boundary);
 }
 
-int posix_memalign(void **memptr, size_t alignment, size_t size)
+static __attribute__((noinline)) int posix_memalign_traced(void **memptr, size_t alignment, size_t size)
 {
 	int ret = 0;
-	struct log_malloc_s *mem = NULL;
-	sig_atomic_t memuse;
-	sig_atomic_t memruse = 0;
+	void *ptr = NULL;
+	void *block = NULL;
+	bool sampled;
+	uint32_t stack = 0;
+	const bool table = g_ctx.headerless || !MEM_ALIGNED(alignment);
+	int64_t memuse = 0;
+	int64_t memruse = 0;
 
 	if(!DL_RESOLVE_CHECK(posix_memalign))
 		return ENOMEM;
 
-	if(alignment > MEM_OFF)
-		return ENOMEM;
-
-	if((ret = real_posix_memalign((void **)&mem, alignment, size + MEM_OFF)) == 0)
+	sampled = !in_new_retry && log_malloc_sample(&g_ctx, size);
+	if((ret = real_posix_memalign(&block, alignment, MEM_SIZE(size, table))) == 0)
 	{
-		mem->size = size;
-		mem->cb = ~mem->size;
-		memuse = __sync_add_and_fetch(&g_ctx.mem_used, mem->size);
-#ifdef HAVE_MALLOC_USABLE_SIZE
-		mem->rsize = malloc_usable_size(mem);
-		memruse = __sync_add_and_fetch(&g_ctx.mem_rused, mem->rsize);
-#endif
+		if((ptr = mem_new(block, table, size, sampled, &memuse, &memruse)) != NULL)
+			*memptr = ptr;
+		else
+			ret = ENOMEM;
 	}
 #ifndef DISABLE_CALL_COUNTS
-	(void)__sync_fetch_and_add(&g_ctx.stat.posix_memalign, 1);
-	g_ctx.stat.unrel_sum++;
+	STAT_INC(posix_memalign);
 #endif
 
-	if(!g_ctx.memlog_disabled)
+	if(!g_ctx.memlog_disabled && sampled && !in_trace)
 	{
-		int s;
-		char buf[LOG_BUFSIZE];
-
-		s = snprintf(buf, sizeof(buf), "+ posix_memalign %zu %p (%zu %zu : %d) [%u:%u]\n",
-			size, MEM_PTR(mem),
-			alignment, size, ret,
-			memuse, memruse);
+		const log_malloc_event_t ev = { LOG_MALLOC_EV_POSIX_MEMALIGN, ret, false,
+			size, ptr, NULL, alignment, size,
+			memuse, memruse, EVENT_TID() };
 
-		log_trace(buf, s, sizeof(buf), 1);
+		log_event(&ev, 1, (g_ctx.live_table) ? &stack : NULL);
 	}
+
+	if(g_ctx.live_table && sampled && ret == 0)
+		log_malloc_live_add(ptr, size, log_stack_id(stack));
 	return ret;
 }
 
-void *valloc(size_t size)
+static __attribute__((noinline)) void *valloc_traced(size_t size, int type)
 {
-	struct log_malloc_s *mem;
-	sig_atomic_t memuse;
-	sig_atomic_t memruse = 0;
+	void *ptr;
+	bool sampled;
+	uint32_t stack = 0;
+	int64_t memuse = 0;
+	int64_t memruse = 0;
 
 	if(!DL_RESOLVE_CHECK(valloc))
 		return NULL;
 
-	if((mem = real_valloc(size + MEM_OFF)) != NULL)
-	{
-		mem->size = size;
-		mem->cb = ~mem->size;
-		memuse = __sync_add_and_fetch(&g_ctx.mem_used, mem->size);
-#ifdef HAVE_MALLOC_USABLE_SIZE
-		mem->rsize = malloc_usable_size(mem);
-		memruse = __sync_add_and_fetch(&g_ctx.mem_rused, mem->rsize);
-#endif
-	}
+	/* page alignment can not be kept with header */
+	sampled = log_malloc_sample(&g_ctx, size);
+	ptr = mem_new(((type == LOG_MALLOC_EV_PVALLOC) ? real_pvalloc : real_valloc)
+		(MEM_SIZE(size, true)), true, size, sampled, &memuse, &memruse);
 #ifndef DISABLE_CALL_COUNTS
-	(void)__sync_fetch_and_add(&g_ctx.stat.valloc, 1);
-	g_ctx.stat.unrel_sum++;
+	STAT_INC(valloc);
 #endif
 
-	if(!g_ctx.memlog_disabled)
+	if(!g_ctx.memlog_disabled && sampled && !in_trace)
 	{
-		int s;
-		char buf[LOG_BUFSIZE];
+		const log_malloc_event_t ev = { type, 0, false,
+			size, ptr, NULL, 0, 0,
+			memuse, memruse, EVENT_TID() };
 
-		s = snprintf(buf, sizeof(buf), "+ valloc %zu %p [%u:%u]\n",
-			size, MEM_PTR(mem),
-			memuse, memruse);
-
-		log_trace(buf, s, sizeof(buf), 1);
+		log_event(&ev, 1, (g_ctx.live_table) ? &stack : NULL);
 	}
-	return MEM_PTR(mem);
+
+	if(g_ctx.live_table && sampled && ptr)
+		log_malloc_live_add(ptr, size, log_stack_id(stack));
+	return ptr;
 }
 
-void free(void *ptr)
+static __attribute__((noinline)) void free_traced(void *ptr, int type)
 {
 	int foreign;
-	sig_atomic_t memuse;
-	sig_atomic_t memruse = 0;
+	bool sampled;
+	bool batched;
+	int64_t memuse = 0;
+	int64_t memruse = 0;
 	size_t       rsize = 0;
-	struct log_malloc_s *mem = MEM_HEAD(ptr);
+	struct log_malloc_s head;
+	struct log_malloc_s *mem;
 
 	if(!DL_RESOLVE_CHECK(free) || ptr == NULL)
 		return;
 
 	/* check if we allocated it */
-	foreign = (mem->size != ~mem->cb);
-	memuse = __sync_sub_and_fetch(&g_ctx.mem_used, (foreign) ? 0: mem->size);
+	mem = mem_take(ptr, &head);
+	foreign = (mem == NULL);
+
+	/* library internals */
+	if(!foreign && (mem->flags & LOG_MALLOC_MEM_ARENA))
+	{
+		log_malloc_arena_free(mem);
+		return;
+	}
+
+	sampled = (foreign || (mem->flags & LOG_MALLOC_MEM_SAMPLED));
+	if(!foreign)
+		HISTOGRAM_FREE(mem);
+	memuse = USAGE_ADD(mem_used, (foreign) ? 0 : -mem->size);
+	if(!foreign)
+		log_malloc_thread_add(-(int64_t)mem->size);
 #ifdef HAVE_MALLOC_USABLE_SIZE
-	memruse = __sync_sub_and_fetch(&g_ctx.mem_rused, (foreign) ? 0 : mem->rsize);
+	memruse = USAGE_ADD(mem_rused, (foreign) ? 0 : -mem->rsize);
 	if(foreign)
-		rsize = malloc_usable_size(ptr);
+		rsize = real_malloc_usable_size(ptr);
 #endif
 
 #ifndef DISABLE_CALL_COUNTS
-	(void)__sync_fetch_and_add(&g_ctx.stat.free, 1);
-	g_ctx.stat.unrel_sum++;
+	STAT_INC(free);
 #endif
 
-	if(!g_ctx.memlog_disabled)
+	/* free without backtrace goes to batch record (LOG_MALLOC_FREE_BATCH),
+	 * memory is released after record is written
+	 */
+	batched = (g_ctx.free_batch && !foreign && sampled && !in_trace
+		&& !g_ctx.memlog_disabled && g_ctx.free_stack != LOG_MALLOC_FREE_STACK_ALL);
+	if(batched)
 	{
-		int s;
-		char buf[LOG_BUFSIZE];
+		if(g_ctx.live_table)
+			log_malloc_live_del(ptr);
+		if(log_malloc_tomb_add(ptr, mem->size, mem->tid, memuse, memruse))
+			return;
+	}
 
-		//getrusage(RUSAGE_SELF, &ruse);
-		if(!foreign)
-		{
-			s = snprintf(buf, sizeof(buf), "+ free -%zu %p [%u:%u]\n",
-				mem->size, MEM_PTR(mem),
-				memuse, memruse);
-		}
-		else
-		{
-			s = snprintf(buf, sizeof(buf), "+ free -%zu %p [%u:%u] !f\n",
-				rsize, ptr,
-				memuse, memruse);
-		}
+	if(!g_ctx.memlog_disabled && sampled && !in_trace)
+	{
+		const log_malloc_event_t ev = { type, 0, foreign,
+			(foreign) ? rsize : mem->size, ptr, NULL, 0, 0,
+			memuse, memruse, EVENT_TID(), (foreign) ? 0 : mem->tid };
 
-		log_trace(buf, s, sizeof(buf), foreign);
+		log_event(&ev, (g_ctx.free_stack == LOG_MALLOC_FREE_STACK_ALL)
+			|| (foreign && g_ctx.free_stack == LOG_MALLOC_FREE_STACK_FOREIGN), NULL);
 	}
 
-	real_free((foreign) ? ptr : mem);
+	/* before free, address might be reused by other thread right after */
+	if(g_ctx.live_table && sampled && !foreign && !batched)
+		log_malloc_live_del(ptr);
+
+	real_free((foreign || mem == &head) ? ptr : (void *)mem);
+	return;
+}
+
+/* pass-through free, blocks allocated while tracing are still ours */
+static void passthrough_free(void *ptr)
+{
+	if(ptr == NULL || !mem_owned(ptr))
+		real_free(ptr);
+	else
+		free_traced(ptr, LOG_MALLOC_EV_FREE);
 	return;
 }
 
+static void *passthrough_realloc(void *ptr, size_t size)
+{
+	if(ptr == NULL || !mem_owned(ptr))
+		return real_realloc(ptr, size);
+	return realloc_traced(ptr, size, LOG_MALLOC_EV_REALLOC);
+}
+
+/*
+ *  LIBRARY FUNCTIONS
+ *	traced calls are tail calls, so backtrace starts at caller
+ */
+void *malloc(size_t size)
+{
+	const struct log_malloc_dispatch_s *dispatch = DISPATCH();
+
+	if(dispatch)
+		return dispatch->malloc(size);
+	return malloc_traced(size, LOG_MALLOC_EV_MALLOC, NULL);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	const struct log_malloc_dispatch_s *dispatch = DISPATCH();
+
+	if(dispatch)
+		return dispatch->calloc(nmemb, size);
+	return calloc_traced(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	const struct log_malloc_dispatch_s *dispatch = DISPATCH();
+
+	if(dispatch)
+		return dispatch->realloc(ptr, size);
+	return realloc_traced(ptr, size, LOG_MALLOC_EV_REALLOC);
+}
+
+void *reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+	size_t total;
+	const struct log_malloc_dispatch_s *dispatch = DISPATCH();
+
+	if(__builtin_mul_overflow(nmemb, size, &total))
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if(dispatch)
+		return dispatch->realloc(ptr, total);
+	return realloc_traced(ptr, total, LOG_MALLOC_EV_REALLOCARRAY);
+}
+
+void *memalign(size_t boundary, size_t size)
+{
+	const struct log_malloc_dispatch_s *dispatch = DISPATCH();
+
+	if(dispatch)
+		return dispatch->memalign(boundary, size);
+	return memalign_traced(boundary, size, LOG_MALLOC_EV_MEMALIGN, NULL);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	const struct log_malloc_dispatch_s *dispatch = DISPATCH();
+
+	if(dispatch)
+		return dispatch->aligned_alloc(alignment, size);
+	return memalign_traced(alignment, size, LOG_MALLOC_EV_ALIGNED_ALLOC, NULL);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	const struct log_malloc_dispatch_s *dispatch = DISPATCH();
+
+	if(dispatch)
+		return dispatch->posix_memalign(memptr, alignment, size);
+	return posix_memalign_traced(memptr, alignment, size);
+}
+
+void *valloc(size_t size)
+{
+	const struct log_malloc_dispatch_s *dispatch = DISPATCH();
+
+	if(dispatch)
+		return dispatch->valloc(size);
+	return valloc_traced(size, LOG_MALLOC_EV_VALLOC);
+}
+
+void *pvalloc(size_t size)
+{
+	const struct log_malloc_dispatch_s *dispatch = DISPATCH();
+
+	if(dispatch)
+		return dispatch->pvalloc(size);
+	return valloc_traced(size, LOG_MALLOC_EV_PVALLOC);
+}
+
+void free(void *ptr)
+{
+	const struct log_malloc_dispatch_s *dispatch = DISPATCH();
+
+	if(dispatch)
+		dispatch->free(ptr);
+	else
+		free_traced(ptr, LOG_MALLOC_EV_FREE);
+	return;
+}
+
+#ifdef HAVE_MALLOC_USABLE_SIZE
+/* usable size of user memory (header is not usable) */
+size_t malloc_usable_size(void *ptr)
+{
+	if(ptr == NULL || !DL_RESOLVE_CHECK(malloc_usable_size))
+		return 0;
+
+	if(MEM_OWNED(ptr))
+	{
+		if(MEM_HEAD(ptr)->flags & LOG_MALLOC_MEM_ARENA)
+			return log_malloc_arena_size(MEM_HEAD(ptr)) - MEM_OFF;
+		return real_malloc_usable_size(MEM_HEAD(ptr)) - MEM_OFF;
+	}
+
+	/* block in side table, or foreign */
+	return real_malloc_usable_size(ptr);
+}
+#endif
+
+
+/*
+ *  C++ OPERATORS
+ *	distinct events (new, new[], delete, delete[]), aligned new is logged
+ *	with alignment, sized delete takes size from header as free does
+ */
+#if SIZE_MAX == UINT_MAX
+#define CXX_SIZE_T	"j"
+#else
+#define CXX_SIZE_T	"m"
+#endif
+#define CXX_ALIGN_T	"St11align_val_t"
+#define CXX_NOTHROW_T	"RKSt9nothrow_t"
+
+/* operator new, or new[] */
+#define CXX_NEW(fn, mangled, type, variant)	\
+	void *fn(size_t size) __asm__(mangled);	\
+	void *fn(size_t size)	\
+	{	\
+		static const struct log_malloc_op_s op = { mangled, mangled CXX_NOTHROW_T, variant };	\
+		\
+		return op_new(size, 0, type, &op);	\
+	}
+
+#define CXX_NEW_NOTHROW(fn, mangled, type, variant)	\
+	void *fn(size_t size, const void *nothrow) __asm__(mangled);	\
+	void *fn(size_t size, const void *nothrow)	\
+	{	\
+		static const struct log_malloc_op_s op = { mangled, mangled, variant };	\
+		\
+		return op_new(size, 0, type, &op);	\
+	}
+
+#define CXX_NEW_ALIGNED(fn, mangled, type, variant)	\
+	void *fn(size_t size, size_t align) __asm__(mangled);	\
+	void *fn(size_t size, size_t align)	\
+	{	\
+		static const struct log_malloc_op_s op = { mangled, mangled CXX_NOTHROW_T, variant };	\
+		\
+		return op_new(size, align, type, &op);	\
+	}
+
+#define CXX_NEW_ALIGNED_NOTHROW(fn, mangled, type, variant)	\
+	void *fn(size_t size, size_t align, const void *nothrow) __asm__(mangled);	\
+	void *fn(size_t size, size_t align, const void *nothrow)	\
+	{	\
+		static const struct log_malloc_op_s op = { mangled, mangled, variant };	\
+		\
+		return op_new(size, align, type, &op);	\
+	}
+
+/* operator delete, or delete[] (extra arguments are ignored) */
+#define CXX_DELETE(fn, mangled, type, ...)	\
+	void fn(void *ptr, ## __VA_ARGS__) __asm__(mangled);	\
+	void fn(void *ptr, ## __VA_ARGS__)	\
+	{	\
+		op_delete(ptr, type);	\
+	}
+
+static inline __attribute__((always_inline)) void *op_new(size_t size, size_t align, int type,
+	const struct log_malloc_op_s *op)
+{
+	void *ptr;
+	const struct log_malloc_dispatch_s *dispatch = DISPATCH();
+
+	if(dispatch == NULL)
+	{
+		if(align)
+			return memalign_traced(align, size, type, op);
+		return malloc_traced(size, type, op);
+	}
+
+	ptr = (align) ? dispatch->memalign(align, size) : dispatch->malloc(size);
+	return (ptr) ? ptr : op_new_failed(op, size, align);
+}
+
+static inline __attribute__((always_inline)) void op_delete(void *ptr, int type)
+{
+	const struct log_malloc_dispatch_s *dispatch = DISPATCH();
+
+	if(dispatch)
+		dispatch->free(ptr);
+	else
+		free_traced(ptr, type);
+	return;
+}
+
+CXX_NEW(cxx_new, "_Znw" CXX_SIZE_T, LOG_MALLOC_EV_NEW, 0)
+CXX_NEW(cxx_new_array, "_Zna" CXX_SIZE_T, LOG_MALLOC_EV_NEW_ARRAY, 0)
+CXX_NEW_NOTHROW(cxx_new_nothrow, "_Znw" CXX_SIZE_T CXX_NOTHROW_T,
+	LOG_MALLOC_EV_NEW, OP_NOTHROW)
+CXX_NEW_NOTHROW(cxx_new_array_nothrow, "_Zna" CXX_SIZE_T CXX_NOTHROW_T,
+	LOG_MALLOC_EV_NEW_ARRAY, OP_NOTHROW)
+CXX_NEW_ALIGNED(cxx_new_aligned, "_Znw" CXX_SIZE_T CXX_ALIGN_T,
+	LOG_MALLOC_EV_NEW, OP_ALIGNED)
+CXX_NEW_ALIGNED(cxx_new_array_aligned, "_Zna" CXX_SIZE_T CXX_ALIGN_T,
+	LOG_MALLOC_EV_NEW_ARRAY, OP_ALIGNED)
+CXX_NEW_ALIGNED_NOTHROW(cxx_new_aligned_nothrow, "_Znw" CXX_SIZE_T CXX_ALIGN_T CXX_NOTHROW_T,
+	LOG_MALLOC_EV_NEW, OP_ALIGNED | OP_NOTHROW)
+CXX_NEW_ALIGNED_NOTHROW(cxx_new_array_aligned_nothrow, "_Zna" CXX_SIZE_T CXX_ALIGN_T CXX_NOTHROW_T,
+	LOG_MALLOC_EV_NEW_ARRAY, OP_ALIGNED | OP_NOTHROW)
+
+CXX_DELETE(cxx_delete, "_ZdlPv", LOG_MALLOC_EV_DELETE)
+CXX_DELETE(cxx_delete_array, "_ZdaPv", LOG_MALLOC_EV_DELETE_ARRAY)
+CXX_DELETE(cxx_delete_sized, "_ZdlPv" CXX_SIZE_T,
+	LOG_MALLOC_EV_DELETE, size_t size)
+CXX_DELETE(cxx_delete_array_sized, "_ZdaPv" CXX_SIZE_T,
+	LOG_MALLOC_EV_DELETE_ARRAY, size_t size)
+CXX_DELETE(cxx_delete_nothrow, "_ZdlPv" CXX_NOTHROW_T,
+	LOG_MALLOC_EV_DELETE, const void *nothrow)
+CXX_DELETE(cxx_delete_array_nothrow, "_ZdaPv" CXX_NOTHROW_T,
+	LOG_MALLOC_EV_DELETE_ARRAY, const void *nothrow)
+CXX_DELETE(cxx_delete_aligned, "_ZdlPv" CXX_ALIGN_T,
+	LOG_MALLOC_EV_DELETE, size_t align)
+CXX_DELETE(cxx_delete_array_aligned, "_ZdaPv" CXX_ALIGN_T,
+	LOG_MALLOC_EV_DELETE_ARRAY, size_t align)
+CXX_DELETE(cxx_delete_sized_aligned, "_ZdlPv" CXX_SIZE_T CXX_ALIGN_T,
+	LOG_MALLOC_EV_DELETE, size_t size, size_t align)
+CXX_DELETE(cxx_delete_array_sized_aligned, "_ZdaPv" CXX_SIZE_T CXX_ALIGN_T,
+	LOG_MALLOC_EV_DELETE_ARRAY, size_t size, size_t align)
+CXX_DELETE(cxx_delete_aligned_nothrow, "_ZdlPv" CXX_ALIGN_T CXX_NOTHROW_T,
+	LOG_MALLOC_EV_DELETE, size_t align, const void *nothrow)
+CXX_DELETE(cxx_delete_array_aligned_nothrow, "_ZdaPv" CXX_ALIGN_T CXX_NOTHROW_T,
+	LOG_MALLOC_EV_DELETE_ARRAY, size_t align, const void *nothrow)
+
 /* EOF */
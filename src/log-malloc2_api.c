@@ -30,11 +30,14 @@
 /*
  *  API FUNCTIONS
  */
-size_t log_malloc_get_usage(void)
+uint64_t log_malloc_get_usage(void)
 {
-	const log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+	log_malloc_counters_t sum;
 
-	return ctx->mem_used;
+	log_malloc_counters_sum(&sum);
+
+	/* shards might be transiently negative under concurrent frees */
+	return (sum.mem_used > 0) ? sum.mem_used : 0;
 }
 
 /* enable trace to LOG_MALLOC_TRACE_FD */
@@ -55,6 +58,43 @@ void log_malloc_trace_disable(void)
 	return;
 }
 
+/* switch pass-through mode */
+int log_malloc_passthrough(int enable)
+{
+	return log_malloc_passthrough_set(enable != 0);
+}
+
+/* dump heap snapshot */
+int log_malloc_heap_snapshot(int fd)
+{
+	return log_malloc_live_snapshot(fd, false, 0);
+}
+
+/* get histograms */
+int log_malloc_histogram_get(log_malloc_histogram_t *hist)
+{
+	return log_malloc_histogram_sum(hist);
+}
+
+/* dump histograms */
+int log_malloc_histogram_dump(int fd)
+{
+	return log_malloc_histogram_write(fd);
+}
+
+/* calling thread memory usage */
+int64_t log_malloc_thread_get_usage(void)
+{
+	return log_malloc_thread.used;
+}
+
+/* calling thread quota */
+void log_malloc_thread_set_quota(uint64_t quota, log_malloc_quota_cb_t cb)
+{
+	log_malloc_thread_quota((quota > INT64_MAX) ? INT64_MAX : (int64_t)quota, cb);
+	return;
+}
+
 /* sprintf trace */
 int log_malloc_trace_printf(const char *fmt, ...)
 {
@@ -73,7 +113,7 @@ int log_malloc_trace_printf(const char *fmt, ...)
 		const int max = ((s > (sizeof(buf) - 1)) ? (sizeof(buf) - 1) : s);
 
 		buf[max - 1] = '\n';
-		ww = write(ctx->memlog_fd, buf, max);
+		ww = log_malloc_write_text(ctx, buf, max);
 	}
 	return w;
 }
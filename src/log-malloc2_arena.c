@@ -0,0 +1,190 @@
+/*
+ * log-malloc2 private arena
+ *	Memory for allocations made by library internals while tracing
+ *		(backtrace(), libgcc_s loading, unwinders).
+ *	Served from per-thread mmap-ed chunks, never from real allocator, so
+ *	they can not recurse into tracing.
+ *
+ * Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+ *
+ * License: GNU LGPLv3 (http://www.gnu.org/licenses/lgpl.html)
+ *
+ * Web:
+ *	http://devel.dob.sk/log-malloc2
+ *	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+ *	https://github.com/samsk/log-malloc2 (git repo)
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	1
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "log-malloc2.h"
+#include "log-malloc2_internal.h"
+
+/* block alignment */
+#define ARENA_ALIGN		16
+#define ARENA_ROUND(size)	(((size) + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1))
+
+/* chunk (bump allocated, unmapped when its last block is released)
+ * @note	refs counts live blocks, plus one for owner thread
+ */
+struct arena_chunk_s {
+	size_t size;		/* mapped size */
+	size_t used;		/* bump offset */
+	long refs;
+} __attribute__((__aligned__(ARENA_ALIGN)));
+
+/* block header */
+struct arena_block_s {
+	struct arena_chunk_s *chunk;	/* NULL - dedicated mapping */
+	size_t size;			/* usable size */
+};
+
+/* thread chunk */
+static __thread struct arena_chunk_s *t_chunk = NULL;
+/* alloc in progress (signal handler allocating while interrupted alloc) */
+static __thread int t_busy = 0;
+
+#ifdef HAVE_LIBPTHREAD
+/* releases chunk of exited thread */
+static pthread_key_t g_key;
+static pthread_once_t g_key_once = PTHREAD_ONCE_INIT;
+#endif
+
+static inline void chunk_unref(struct arena_chunk_s *chunk)
+{
+	if(__sync_sub_and_fetch(&chunk->refs, 1) == 0)
+		munmap(chunk, chunk->size);
+	return;
+}
+
+#ifdef HAVE_LIBPTHREAD
+static void arena_thread_exit(void *chunk)
+{
+	/* later allocations (other destructors) get new chunk */
+	t_chunk = NULL;
+	if(chunk)
+		chunk_unref(chunk);
+	return;
+}
+
+static void arena_key_init(void)
+{
+	/* first keys are static, no allocation */
+	(void)pthread_key_create(&g_key, arena_thread_exit);
+	return;
+}
+#endif
+
+/* dedicated mapping for big blocks */
+static void *arena_map(size_t size)
+{
+	struct arena_block_s *block;
+	const size_t map_size = ARENA_ROUND(size + sizeof(*block));
+
+	block = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(block == MAP_FAILED)
+		return NULL;
+
+	block->chunk = NULL;
+	block->size = map_size - sizeof(*block);
+	return block + 1;
+}
+
+static struct arena_chunk_s *arena_chunk_new(void)
+{
+	struct arena_chunk_s *chunk;
+
+	chunk = mmap(NULL, LOG_MALLOC_ARENA_CHUNK, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(chunk == MAP_FAILED)
+		return NULL;
+
+	chunk->size = LOG_MALLOC_ARENA_CHUNK;
+	chunk->used = sizeof(*chunk);
+	chunk->refs = 1;
+
+#ifdef HAVE_LIBPTHREAD
+	pthread_once(&g_key_once, arena_key_init);
+	pthread_setspecific(g_key, chunk);
+#endif
+	return chunk;
+}
+
+/*
+ *  INTERNAL API FUNCTIONS
+ */
+
+/** allocate memory from private arena (16 bytes aligned)
+ * @note	no locks, blocks can be released by any thread
+ */
+void *log_malloc_arena_alloc(size_t size)
+{
+	struct arena_block_s *block;
+	struct arena_chunk_s *chunk = t_chunk;
+	const size_t need = ARENA_ROUND(size) + sizeof(*block);
+
+	if(need > LOG_MALLOC_ARENA_CHUNK / 4 || t_busy)
+		return arena_map(size);
+
+	t_busy = 1;
+
+	/* all blocks released, rewind */
+	if(chunk && *(volatile long *)&chunk->refs == 1)
+		chunk->used = sizeof(*chunk);
+
+	if(chunk == NULL || chunk->used + need > chunk->size)
+	{
+		struct arena_chunk_s *old = chunk;
+
+		if((chunk = arena_chunk_new()) == NULL)
+		{
+			t_busy = 0;
+			return NULL;
+		}
+
+		t_chunk = chunk;
+		if(old)
+			chunk_unref(old);
+	}
+
+	block = (struct arena_block_s *)((char *)chunk + chunk->used);
+	block->chunk = chunk;
+	block->size = need - sizeof(*block);
+	chunk->used += need;
+	(void)__sync_add_and_fetch(&chunk->refs, 1);
+
+	t_busy = 0;
+	return block + 1;
+}
+
+/** release arena memory */
+void log_malloc_arena_free(void *ptr)
+{
+	struct arena_block_s *block = (struct arena_block_s *)ptr - 1;
+
+	if(block->chunk)
+		chunk_unref(block->chunk);
+	else
+		munmap(block, block->size + sizeof(*block));
+	return;
+}
+
+/** usable size of arena block */
+size_t log_malloc_arena_size(const void *ptr)
+{
+	return ((const struct arena_block_s *)ptr - 1)->size;
+}
+
+/* EOF */
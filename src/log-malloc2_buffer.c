@@ -0,0 +1,557 @@
+/*
+ * log-malloc2 trace buffering
+ *	Per-thread lock-free trace ring buffers with a background drain thread.
+ *
+ * Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+ *
+ * License: GNU LGPLv3 (http://www.gnu.org/licenses/lgpl.html)
+ *
+ * Web:
+ *	http://devel.dob.sk/log-malloc2
+ *	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+ *	https://github.com/samsk/log-malloc2 (git repo)
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <signal.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+
+#include "log-malloc2.h"
+#include "log-malloc2_internal.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX		1024
+#endif
+
+/* ring states */
+#define RING_FREE	0
+#define RING_OWNED	1
+#define RING_ORPHAN	2
+
+/* thread ring marker after thread exit (write directly) */
+#define RING_NONE	((struct log_malloc_ring_s *)0x1)
+
+/* ring entry header, record data follows (entry is padded to header size,
+ * so header never wraps around ring end)
+ */
+struct log_malloc_entry_s {
+	uint64_t seq;			/* global record order */
+	uint64_t len;			/* record length */
+};
+
+#define ENTRY_SIZE(len)		(sizeof(struct log_malloc_entry_s) \
+				+ (((len) + sizeof(struct log_malloc_entry_s) - 1) \
+				& ~(sizeof(struct log_malloc_entry_s) - 1)))
+
+/* single producer (owner thread), single consumer (drain lock holder) ring */
+struct log_malloc_ring_s {
+	/* producer side */
+	volatile size_t head __attribute__((__aligned__(LOG_MALLOC_CACHELINE)));
+	volatile uint64_t pending;	/* lower bound of seq being queued (0 - none) */
+	/* consumer side */
+	volatile size_t tail __attribute__((__aligned__(LOG_MALLOC_CACHELINE)));
+	size_t pos;			/* drained up to (before tail is moved) */
+	size_t limit;			/* head at drain start */
+	volatile sig_atomic_t state;
+	size_t size;			/* power of 2 */
+	struct log_malloc_ring_s *next;
+	char data[0] __attribute__((__aligned__(LOG_MALLOC_CACHELINE)));
+};
+
+/* buffering state */
+static struct {
+	volatile uint64_t seq __attribute__((__aligned__(LOG_MALLOC_CACHELINE)));
+	volatile sig_atomic_t lock __attribute__((__aligned__(LOG_MALLOC_CACHELINE)));
+	size_t size;
+	int overflow;
+	volatile sig_atomic_t stop;
+	volatile size_t dropped;
+	struct log_malloc_ring_s *volatile rings;
+#ifdef HAVE_LIBPTHREAD
+	pthread_t thread;
+	pthread_key_t key;
+#endif
+} g_buf = { 1, 0, 0, LOG_MALLOC_OVERFLOW_BLOCK, 0, 0, NULL };
+
+static __thread struct log_malloc_ring_s *t_ring = NULL;
+static __thread int t_in_write = 0;
+
+/*
+ *  RING FUNCTIONS
+ */
+
+/* drain lock, rings have single consumer (drain thread, or spilling producer) */
+static inline void buffer_lock(void)
+{
+	while(!__sync_bool_compare_and_swap(&g_buf.lock, 0, 1))
+		sched_yield();
+}
+
+static inline void buffer_unlock(void)
+{
+	__atomic_store_n(&g_buf.lock, 0, __ATOMIC_RELEASE);
+}
+
+/* fill iovec with ring content between tail and head (max 2 chunks) */
+static inline int ring_iov(struct log_malloc_ring_s *ring, size_t tail, size_t head,
+	struct iovec *iov)
+{
+	const size_t mask = ring->size - 1;
+	const size_t off = tail & mask;
+	const size_t len = head - tail;
+	int cnt = 0;
+
+	if(len == 0)
+		return 0;
+
+	iov[cnt].iov_base = &ring->data[off];
+	iov[cnt].iov_len  = (off + len > ring->size) ? ring->size - off : len;
+	cnt++;
+
+	if(iov[0].iov_len < len)
+	{
+		iov[cnt].iov_base = &ring->data[0];
+		iov[cnt].iov_len  = len - iov[0].iov_len;
+		cnt++;
+	}
+	return cnt;
+}
+
+static inline const struct log_malloc_entry_s *ring_entry(const struct log_malloc_ring_s *ring,
+	size_t pos)
+{
+	return (const struct log_malloc_entry_s *)&ring->data[pos & (ring->size - 1)];
+}
+
+/* write all iovecs, handling partial writes */
+static ssize_t writev_all(int fd, struct iovec *iov, int cnt)
+{
+	ssize_t w;
+	ssize_t total = 0;
+
+	while(cnt > 0)
+	{
+		if((w = writev(fd, iov, (cnt > IOV_MAX) ? IOV_MAX : cnt)) == -1)
+		{
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		total += w;
+
+		while(cnt > 0 && (size_t)w >= iov->iov_len)
+		{
+			w -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+
+		if(cnt > 0)
+		{
+			iov->iov_base = (char *)iov->iov_base + w;
+			iov->iov_len -= w;
+		}
+	}
+	return total;
+}
+
+static void ring_release(void *arg)
+{
+	struct log_malloc_ring_s *ring = arg;
+
+	/* keep ring linked, drain thread will flush it, new thread might reuse it */
+	t_ring = RING_NONE;
+	__atomic_store_n(&ring->state, RING_ORPHAN, __ATOMIC_RELEASE);
+	return;
+}
+
+static struct log_malloc_ring_s *ring_get(void)
+{
+	struct log_malloc_ring_s *ring;
+
+	/* reuse ring of finished thread */
+	for(ring = g_buf.rings; ring != NULL; ring = ring->next)
+	{
+		if(ring->state == RING_ORPHAN
+			&& __sync_bool_compare_and_swap(&ring->state, RING_ORPHAN, RING_OWNED))
+			goto done;
+	}
+
+	/* mmap, to not recurse into malloc */
+	ring = mmap(NULL, sizeof(*ring) + g_buf.size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(ring == MAP_FAILED)
+		return NULL;
+
+	ring->head    = 0;
+	ring->pending = 0;
+	ring->tail    = 0;
+	ring->pos     = 0;
+	ring->limit   = 0;
+	ring->state   = RING_OWNED;
+	ring->size    = g_buf.size;
+
+	do
+	{
+		ring->next = g_buf.rings;
+	} while(!__sync_bool_compare_and_swap(&g_buf.rings, ring->next, ring));
+
+done:
+#ifdef HAVE_LIBPTHREAD
+	(void)pthread_setspecific(g_buf.key, ring);
+#endif
+	t_ring = ring;
+	return ring;
+}
+
+/* release drained entries to producers */
+static void buffer_commit(struct log_malloc_ring_s *first)
+{
+	struct log_malloc_ring_s *ring;
+
+	for(ring = first; ring != NULL; ring = ring->next)
+	{
+		if(ring->pos != ring->tail)
+			__atomic_store_n(&ring->tail, ring->pos, __ATOMIC_RELEASE);
+	}
+	return;
+}
+
+/** drain all rings in global record order (merge by entry seq)
+ * @param	done	all records with lower seq are written (can be NULL)
+ * @return	number of bytes written
+ * @note	drain lock must be held
+ */
+static ssize_t buffer_drain(uint64_t *done)
+{
+	int cnt = 0;
+	ssize_t w;
+	ssize_t total = 0;
+	uint64_t cutoff;
+	struct iovec iov[IOV_MAX];
+	struct log_malloc_ring_s *first;
+	struct log_malloc_ring_s *ring;
+	const int fd = log_malloc_ctx_get()->memlog_fd;
+
+	/* records with seq below cutoff are all published (rings created later
+	 * only hold newer records)
+	 */
+	cutoff = __atomic_load_n(&g_buf.seq, __ATOMIC_SEQ_CST);
+	first = __atomic_load_n(&g_buf.rings, __ATOMIC_SEQ_CST);
+	for(ring = first; ring != NULL; ring = ring->next)
+	{
+		const uint64_t pending = __atomic_load_n(&ring->pending, __ATOMIC_SEQ_CST);
+
+		if(pending && pending < cutoff)
+			cutoff = pending;
+
+		ring->pos   = ring->tail;
+		ring->limit = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	}
+
+	for(;;)
+	{
+		uint64_t seq = cutoff;
+		struct log_malloc_ring_s *next = NULL;
+		const struct log_malloc_entry_s *entry;
+
+		/* oldest record of all rings */
+		for(ring = first; ring != NULL; ring = ring->next)
+		{
+			if(ring->pos == ring->limit)
+				continue;
+
+			entry = ring_entry(ring, ring->pos);
+			if(entry->seq < seq)
+			{
+				seq = entry->seq;
+				next = ring;
+			}
+		}
+
+		if(next == NULL)
+			break;
+
+		entry = ring_entry(next, next->pos);
+		cnt += ring_iov(next, next->pos + sizeof(*entry),
+				next->pos + sizeof(*entry) + entry->len, &iov[cnt]);
+		next->pos += ENTRY_SIZE(entry->len);
+
+		/* iovec full, write and continue */
+		if(cnt > IOV_MAX - 2)
+		{
+			if((w = writev_all(fd, iov, cnt)) > 0)
+				total += w;
+			buffer_commit(first);
+			cnt = 0;
+		}
+	}
+
+	if(cnt && (w = writev_all(fd, iov, cnt)) > 0)
+		total += w;
+	buffer_commit(first);
+
+	if(done)
+		*done = cutoff;
+	return total;
+}
+
+/* drain all records queued before now (waits for records being queued) */
+static void buffer_flush(void)
+{
+	uint64_t done;
+	const uint64_t seq = __atomic_load_n(&g_buf.seq, __ATOMIC_SEQ_CST);
+
+	for(;;)
+	{
+		(void)buffer_drain(&done);
+		if(done >= seq)
+			break;
+		sched_yield();
+	}
+	return;
+}
+
+/* write record directly, records queued before it go first */
+static ssize_t buffer_direct(const char *data, size_t len)
+{
+	ssize_t w;
+
+	t_in_write = 1;
+	buffer_lock();
+
+	buffer_flush();
+	w = write(log_malloc_ctx_get()->memlog_fd, data, len);
+
+	buffer_unlock();
+	t_in_write = 0;
+	return w;
+}
+
+#ifdef HAVE_LIBPTHREAD
+static void *buffer_thread(void *arg)
+{
+	ssize_t w;
+	const struct timespec ts = { 0, LOG_MALLOC_BUFFER_DRAIN_USEC * 1000 };
+
+	/* own allocations are written directly */
+	t_ring = RING_NONE;
+
+	while(!g_buf.stop)
+	{
+		t_in_write = 1;
+		buffer_lock();
+		w = buffer_drain(NULL);
+		buffer_unlock();
+		t_in_write = 0;
+
+		if(w <= 0)
+			nanosleep(&ts, NULL);
+	}
+	return NULL;
+}
+
+#endif
+
+/*
+ *  INTERNAL API FUNCTIONS
+ */
+void log_malloc_buffer_atfork_child(void)
+{
+	struct log_malloc_ring_s *ring;
+	log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	if(!ctx->buffer_active)
+		return;
+
+	/* drain thread is gone, parent flushes its own records */
+	ctx->buffer_active = false;
+	g_buf.lock = 0;
+
+	for(ring = g_buf.rings; ring != NULL; ring = ring->next)
+	{
+		ring->tail = ring->head;
+		ring->pending = 0;
+	}
+	return;
+}
+int log_malloc_buffer_init(const char *size, const char *overflow)
+{
+	char *end = NULL;
+	size_t sz;
+	size_t val;
+
+	if(size == NULL || size[0] == '\0')
+		return 0;
+
+	val = strtoul(size, &end, 10);
+	if(end && (*end == 'k' || *end == 'K'))
+		val <<= 10;
+	else if(end && (*end == 'm' || *end == 'M'))
+		val <<= 20;
+
+	if(val == 0)
+		return 0;
+
+	/* power of 2, at least single page */
+	for(sz = LOG_MALLOC_BUFFER_MIN; sz < val; sz <<= 1);
+	g_buf.size = sz;
+
+	if(overflow == NULL || strcmp(overflow, "block") == 0)
+		g_buf.overflow = LOG_MALLOC_OVERFLOW_BLOCK;
+	else if(strcmp(overflow, "drop") == 0)
+		g_buf.overflow = LOG_MALLOC_OVERFLOW_DROP;
+	else if(strcmp(overflow, "spill") == 0)
+		g_buf.overflow = LOG_MALLOC_OVERFLOW_SPILL;
+	else
+		fprintf(stderr, "\n*** log-malloc: unknown buffer overflow policy '%s'\n\n",
+			overflow);
+
+	return 1;
+}
+
+int log_malloc_buffer_start(void)
+{
+#ifdef HAVE_LIBPTHREAD
+	log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	if(g_buf.size == 0 || ctx->buffer_active || ctx->memlog_disabled)
+		return 0;
+
+	if(pthread_key_create(&g_buf.key, ring_release) != 0)
+		return -1;
+
+	if(pthread_create(&g_buf.thread, NULL, buffer_thread, NULL) != 0)
+	{
+		fprintf(stderr, "\n*** log-malloc: could not start trace buffer thread\n\n");
+		return -1;
+	}
+
+	ctx->buffer_active = true;
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+void log_malloc_buffer_fini(void)
+{
+	log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	if(!ctx->buffer_active)
+		return;
+
+#ifdef HAVE_LIBPTHREAD
+	g_buf.stop = 1;
+	pthread_join(g_buf.thread, NULL);
+#endif
+
+	/* from now on everything goes directly to trace fd */
+	ctx->buffer_active = false;
+
+	/* drain lock might be held by spilling producer */
+	buffer_lock();
+	buffer_flush();
+	buffer_unlock();
+
+	if(g_buf.dropped)
+	{
+		int s;
+		char buf[64];
+
+		s = snprintf(buf, sizeof(buf), "# DROPPED %zu\n", g_buf.dropped);
+		s = write(ctx->memlog_fd, buf, s);
+	}
+	return;
+}
+
+/** trace buffering might drop records (drop overflow policy) */
+bool log_malloc_buffer_lossy(void)
+{
+	return (g_buf.size && g_buf.overflow == LOG_MALLOC_OVERFLOW_DROP);
+}
+
+ssize_t log_malloc_buffer_write(const char *data, size_t len)
+{
+	size_t head;
+	size_t off;
+	const size_t size = ENTRY_SIZE(len);
+	struct log_malloc_entry_s *entry;
+	struct log_malloc_ring_s *ring = t_ring;
+	const log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	/* recursion (signal handler, drain lock holder) writes directly */
+	if(t_in_write)
+		return write(ctx->memlog_fd, data, len);
+
+	/* no ring, write directly after queued records */
+	if(ring == RING_NONE
+		|| (ring == NULL && (ring = ring_get()) == NULL)
+		|| size > ring->size)
+		return buffer_direct(data, len);
+
+	t_in_write = 1;
+	head = ring->head;
+
+	while(ring->size - (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) < size)
+	{
+		if(g_buf.overflow == LOG_MALLOC_OVERFLOW_DROP)
+		{
+			__sync_fetch_and_add(&g_buf.dropped, 1);
+			t_in_write = 0;
+			return 0;
+		}
+		else if(g_buf.overflow == LOG_MALLOC_OVERFLOW_SPILL || !ctx->buffer_active)
+		{
+			/* keep ordering, all queued records are flushed first */
+			t_in_write = 0;
+			return buffer_direct(data, len);
+		}
+
+		/* block, wait for drain thread */
+		sched_yield();
+	}
+
+	/* drain stops before this record until it is published */
+	__atomic_store_n(&ring->pending, __atomic_load_n(&g_buf.seq, __ATOMIC_SEQ_CST),
+		__ATOMIC_SEQ_CST);
+
+	off = head & (ring->size - 1);
+	entry = (struct log_malloc_entry_s *)&ring->data[off];
+	entry->seq = __atomic_fetch_add(&g_buf.seq, 1, __ATOMIC_SEQ_CST);
+	entry->len = len;
+
+	off = (off + sizeof(*entry)) & (ring->size - 1);
+	if(off + len <= ring->size)
+		memcpy(&ring->data[off], data, len);
+	else
+	{
+		memcpy(&ring->data[off], data, ring->size - off);
+		memcpy(&ring->data[0], data + (ring->size - off), len - (ring->size - off));
+	}
+
+	__atomic_store_n(&ring->head, head + size, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->pending, 0, __ATOMIC_SEQ_CST);
+	t_in_write = 0;
+	return len;
+}
+
+/* EOF */
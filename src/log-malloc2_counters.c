@@ -0,0 +1,107 @@
+/*
+ * log-malloc2 usage counters
+ *	Sharded memory usage and call counters, every thread updates its own
+ *	cache line, totals are aggregated lazily.
+ *
+ * Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+ *
+ * License: GNU LGPLv3 (http://www.gnu.org/licenses/lgpl.html)
+ *
+ * Web:
+ *	http://devel.dob.sk/log-malloc2
+ *	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+ *	https://github.com/samsk/log-malloc2 (git repo)
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	1
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "log-malloc2.h"
+#include "log-malloc2_internal.h"
+
+/* one shard per cache line */
+struct log_malloc_shard_s {
+	log_malloc_counters_t c;
+} __attribute__((__aligned__(LOG_MALLOC_CACHELINE)));
+
+static struct log_malloc_shard_s g_shards[LOG_MALLOC_SHARDS];
+
+__thread log_malloc_counters_t *log_malloc_shard = NULL;
+
+/*
+ *  INTERNAL API FUNCTIONS
+ */
+int log_malloc_counters_init(const char *mode)
+{
+	log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	if(mode == NULL || mode[0] == '\0' || strcmp(mode, "exact") == 0)
+		ctx->counters_exact = true;
+	else if(strcmp(mode, "sharded") == 0)
+		ctx->counters_exact = false;
+	else
+	{
+		fprintf(stderr, "\n*** log-malloc: unknown counters mode '%s'\n\n", mode);
+		return -1;
+	}
+	return 0;
+}
+
+/* slow path of log_malloc_counters_local(), assign shard to thread */
+log_malloc_counters_t *log_malloc_counters_shard(void)
+{
+	/* thread ids are mostly sequential, so they spread well */
+	log_malloc_shard = &g_shards[log_malloc_gettid() & (LOG_MALLOC_SHARDS - 1)].c;
+	return log_malloc_shard;
+}
+
+/* sum of all shards of given usage counter (offset in log_malloc_counters_t) */
+int64_t log_malloc_counters_shards(size_t offset)
+{
+	int ii;
+	int64_t sum = 0;
+
+	for(ii = 0; ii < LOG_MALLOC_SHARDS; ii++)
+		sum += *(volatile int64_t *)((char *)&g_shards[ii].c + offset);
+	return sum;
+}
+
+/* aggregate global counters and all shards */
+void log_malloc_counters_sum(log_malloc_counters_t *sum)
+{
+	int ii;
+	const log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	sum->mem_used	= ctx->mem_used;
+	sum->mem_rused	= ctx->mem_rused;
+	sum->stat	= ctx->stat;
+
+	for(ii = 0; ii < LOG_MALLOC_SHARDS; ii++)
+	{
+		const volatile log_malloc_counters_t *c = &g_shards[ii].c;
+
+		sum->mem_used		+= c->mem_used;
+		sum->mem_rused		+= c->mem_rused;
+		sum->stat.malloc	+= c->stat.malloc;
+		sum->stat.calloc	+= c->stat.calloc;
+		sum->stat.realloc	+= c->stat.realloc;
+		sum->stat.memalign	+= c->stat.memalign;
+		sum->stat.posix_memalign += c->stat.posix_memalign;
+		sum->stat.valloc	+= c->stat.valloc;
+		sum->stat.free		+= c->stat.free;
+		sum->stat.unrel_sum	+= c->stat.unrel_sum;
+	}
+	return;
+}
+
+/* EOF */
@@ -0,0 +1,440 @@
+/*
+ * log-malloc2 trace formatting
+ *	Text and binary trace record encoding.
+ *
+ * Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+ *
+ * License: GNU LGPLv3 (http://www.gnu.org/licenses/lgpl.html)
+ *
+ * Web:
+ *	http://devel.dob.sk/log-malloc2
+ *	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+ *	https://github.com/samsk/log-malloc2 (git repo)
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	1
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "log-malloc2.h"
+#include "log-malloc2_internal.h"
+
+/* text record chunk size */
+#define TEXT_CHUNK	4096
+
+/* longest event line (posix_memalign, all numbers of max. width) */
+#define TEXT_LINE_MAX	256
+
+__thread uint32_t log_malloc_tid = 0;
+
+/* decimal and hex digit pairs, "00" .. "99" and "00" .. "ff" */
+const char log_malloc_dec2[200] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+const char log_malloc_hex2[512] =
+	"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+	"202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+	"404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+	"606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+	"808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+	"a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+	"c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+	"e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+const uint64_t log_malloc_pow10[20] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+	10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+	100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+	100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+	100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+/* append string literal (constant length copy) */
+#define FMT_LIT(p, lit)	\
+	do {	\
+		memcpy((p), (lit), sizeof(lit) - 1);	\
+		(p) += sizeof(lit) - 1;	\
+	} while(0)
+
+/* append ' [USED:RUSED]' */
+static inline char *format_usage(char *p, const log_malloc_event_t *ev)
+{
+	FMT_LIT(p, " [");
+	p += log_malloc_fmt_sdec(p, ev->mem_used);
+	*p++ = ':';
+	p += log_malloc_fmt_sdec(p, ev->mem_rused);
+	*p++ = ']';
+	return p;
+}
+
+/* append ' SIZE PTR' */
+static inline char *format_size_ptr(char *p, const log_malloc_event_t *ev)
+{
+	p += log_malloc_fmt_udec(p, (size_t)ev->size);
+	*p++ = ' ';
+	p += log_malloc_fmt_ptr(p, ev->ptr);
+	return p;
+}
+
+/* append ' (ARG1 ARG2' */
+static inline char *format_args(char *p, const log_malloc_event_t *ev)
+{
+	FMT_LIT(p, " (");
+	p += log_malloc_fmt_udec(p, ev->arg1);
+	*p++ = ' ';
+	p += log_malloc_fmt_udec(p, ev->arg2);
+	return p;
+}
+
+/* append ' (ALIGN)' */
+static inline char *format_align(char *p, const log_malloc_event_t *ev)
+{
+	FMT_LIT(p, " (");
+	p += log_malloc_fmt_udec(p, ev->arg1);
+	*p++ = ')';
+	return p;
+}
+
+/** encode event line, str must have TEXT_LINE_MAX chars
+ * @return	line length, 0 for unknown event
+ */
+static inline size_t format_text(const log_malloc_event_t *ev, char *str)
+{
+	char *p = str;
+
+	switch(ev->type)
+	{
+		/* + malloc SIZE PTR [USED:RUSED] */
+		case LOG_MALLOC_EV_MALLOC:
+			FMT_LIT(p, "+ malloc ");
+			p = format_size_ptr(p, ev);
+			p = format_usage(p, ev);
+			break;
+
+		/* + new SIZE PTR [(ALIGN)] [USED:RUSED] */
+		case LOG_MALLOC_EV_NEW:
+			FMT_LIT(p, "+ new ");
+			p = format_size_ptr(p, ev);
+			if(ev->arg1)
+				p = format_align(p, ev);
+			p = format_usage(p, ev);
+			break;
+
+		/* + new[] SIZE PTR [(ALIGN)] [USED:RUSED] */
+		case LOG_MALLOC_EV_NEW_ARRAY:
+			FMT_LIT(p, "+ new[] ");
+			p = format_size_ptr(p, ev);
+			if(ev->arg1)
+				p = format_align(p, ev);
+			p = format_usage(p, ev);
+			break;
+
+		/* + calloc SIZE PTR [USED:RUSED] (NMEMB SIZE) */
+		case LOG_MALLOC_EV_CALLOC:
+			FMT_LIT(p, "+ calloc ");
+			p = format_size_ptr(p, ev);
+			p = format_usage(p, ev);
+			p = format_args(p, ev);
+			*p++ = ')';
+			break;
+
+		/* + realloc CHANGE OPTR PTR (OSIZE SIZE) [USED:RUSED] */
+		case LOG_MALLOC_EV_REALLOC:
+		case LOG_MALLOC_EV_REALLOCARRAY:
+			if(ev->type == LOG_MALLOC_EV_REALLOC)
+				FMT_LIT(p, "+ realloc ");
+			else
+				FMT_LIT(p, "+ reallocarray ");
+			p += log_malloc_fmt_sdec(p, ev->size);
+			*p++ = ' ';
+			p += log_malloc_fmt_ptr(p, ev->optr);
+			*p++ = ' ';
+			p += log_malloc_fmt_ptr(p, ev->ptr);
+			p = format_args(p, ev);
+			*p++ = ')';
+			p = format_usage(p, ev);
+			break;
+
+		/* + memalign SIZE PTR (ALIGN) [USED:RUSED] */
+		case LOG_MALLOC_EV_MEMALIGN:
+			FMT_LIT(p, "+ memalign ");
+			p = format_size_ptr(p, ev);
+			p = format_align(p, ev);
+			p = format_usage(p, ev);
+			break;
+
+		/* + aligned_alloc SIZE PTR (ALIGN) [USED:RUSED] */
+		case LOG_MALLOC_EV_ALIGNED_ALLOC:
+			FMT_LIT(p, "+ aligned_alloc ");
+			p = format_size_ptr(p, ev);
+			p = format_align(p, ev);
+			p = format_usage(p, ev);
+			break;
+
+		/* + posix_memalign SIZE PTR (ALIGN SIZE : RET) [USED:RUSED] */
+		case LOG_MALLOC_EV_POSIX_MEMALIGN:
+			FMT_LIT(p, "+ posix_memalign ");
+			p = format_size_ptr(p, ev);
+			p = format_args(p, ev);
+			FMT_LIT(p, " : ");
+			p += log_malloc_fmt_sdec(p, ev->ret);
+			*p++ = ')';
+			p = format_usage(p, ev);
+			break;
+
+		/* + valloc SIZE PTR [USED:RUSED] */
+		case LOG_MALLOC_EV_VALLOC:
+			FMT_LIT(p, "+ valloc ");
+			p = format_size_ptr(p, ev);
+			p = format_usage(p, ev);
+			break;
+
+		/* + pvalloc SIZE PTR [USED:RUSED] */
+		case LOG_MALLOC_EV_PVALLOC:
+			FMT_LIT(p, "+ pvalloc ");
+			p = format_size_ptr(p, ev);
+			p = format_usage(p, ev);
+			break;
+
+		/* + free -SIZE PTR [USED:RUSED] [!f] */
+		case LOG_MALLOC_EV_FREE:
+			FMT_LIT(p, "+ free -");
+			p = format_size_ptr(p, ev);
+			p = format_usage(p, ev);
+			if(ev->foreign)
+				FMT_LIT(p, " !f");
+			break;
+
+		/* + delete -SIZE PTR [USED:RUSED] [!f] */
+		case LOG_MALLOC_EV_DELETE:
+			FMT_LIT(p, "+ delete -");
+			p = format_size_ptr(p, ev);
+			p = format_usage(p, ev);
+			if(ev->foreign)
+				FMT_LIT(p, " !f");
+			break;
+
+		/* + delete[] -SIZE PTR [USED:RUSED] [!f] */
+		case LOG_MALLOC_EV_DELETE_ARRAY:
+			FMT_LIT(p, "+ delete[] -");
+			p = format_size_ptr(p, ev);
+			p = format_usage(p, ev);
+			if(ev->foreign)
+				FMT_LIT(p, " !f");
+			break;
+
+		default:
+			return 0;
+	}
+
+	/* ' ~TID' (free ' ~TID/ATID') */
+	if(ev->tid)
+	{
+		FMT_LIT(p, " ~");
+		p += log_malloc_fmt_udec(p, ev->tid);
+		if(ev->type == LOG_MALLOC_EV_FREE || ev->type == LOG_MALLOC_EV_DELETE
+			|| ev->type == LOG_MALLOC_EV_DELETE_ARRAY)
+		{
+			*p++ = '/';
+			p += log_malloc_fmt_udec(p, ev->atid);
+		}
+	}
+
+	*p++ = '\n';
+	*p = '\0';
+	return p - str;
+}
+
+/*
+ *  INTERNAL API FUNCTIONS
+ */
+int log_malloc_format_init(const char *format)
+{
+	log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	if(format == NULL || format[0] == '\0' || strcmp(format, "text") == 0)
+		ctx->format = LOG_MALLOC_FORMAT_TEXT;
+	else if(strcmp(format, "binary") == 0)
+		ctx->format = LOG_MALLOC_FORMAT_BINARY;
+	else
+	{
+		fprintf(stderr, "\n*** log-malloc: unknown trace format '%s'\n\n", format);
+		return -1;
+	}
+
+	/* stream header */
+	if(ctx->format == LOG_MALLOC_FORMAT_BINARY && !ctx->memlog_disabled)
+	{
+		const struct log_malloc_bhead_s head = {
+			LOG_MALLOC_BINARY_MAGIC,
+			LOG_MALLOC_BINARY_VERSION,
+			sizeof(struct log_malloc_brec_s),
+			LOG_MALLOC_BINARY_BOM,
+			0 };
+
+		if(write(ctx->memlog_fd, &head, sizeof(head)) != sizeof(head))
+			return -1;
+	}
+	return ctx->format;
+}
+
+/** format event line (without backtrace)
+ * @note	output is same as of former snprintf() formatting (plus thread
+ *		id if enabled), line is truncated to size - 1 chars
+ */
+size_t log_malloc_format_text(const log_malloc_event_t *ev, char *buf, size_t size)
+{
+	size_t s;
+	char tmp[TEXT_LINE_MAX];
+
+	/* encode in place, or via temporary buffer if line might not fit */
+	if(size >= sizeof(tmp))
+		return format_text(ev, buf);
+
+	s = format_text(ev, tmp);
+	if(s >= size)
+		s = size - 1;
+	memcpy(buf, tmp, s);
+	buf[s] = '\0';
+	return s;
+}
+
+/* format binary record header (frames and statm are appended by caller) */
+size_t log_malloc_format_binary(const log_malloc_event_t *ev, char *buf, size_t size)
+{
+	struct log_malloc_brec_s *rec = (struct log_malloc_brec_s *)buf;
+
+	if(size < sizeof(*rec))
+		return 0;
+
+	rec->type	= ev->type;
+	rec->flags	= ((ev->foreign) ? LOG_MALLOC_BF_FOREIGN : 0)
+			| ((ev->tid) ? LOG_MALLOC_BF_TID : 0);
+	rec->nframes	= 0;
+	rec->statm_len	= 0;
+	rec->reserved	= 0;
+	rec->tid	= log_malloc_gettid();
+	rec->ret	= ev->ret;
+	rec->stack	= 0;
+	rec->atid	= ev->atid;
+	rec->timestamp	= log_malloc_timestamp();
+	rec->size	= ev->size;
+	rec->ptr	= (uintptr_t)ev->ptr;
+	rec->optr	= (uintptr_t)ev->optr;
+	rec->arg1	= ev->arg1;
+	rec->arg2	= ev->arg2;
+	rec->mem_used	= ev->mem_used;
+	rec->mem_rused	= ev->mem_rused;
+
+	return sizeof(*rec);
+}
+
+/** format batched frees record in configured trace format
+ * @param	ev	LOG_MALLOC_EV_FREES event, size is number of tombs
+ * @note	buf must have LOG_MALLOC_FREES_BUFSIZE bytes
+ */
+size_t log_malloc_format_frees(const log_malloc_ctx_t *ctx, const log_malloc_event_t *ev,
+		const log_malloc_tomb_t *tombs, char *buf)
+{
+	ssize_t ii;
+	char *p = buf;
+
+	if(ctx->format == LOG_MALLOC_FORMAT_BINARY)
+	{
+		size_t len;
+		uint64_t *words;
+		struct log_malloc_brec_s *rec = (struct log_malloc_brec_s *)buf;
+
+		len = log_malloc_format_binary(ev, buf, LOG_MALLOC_FREES_BUFSIZE);
+		rec->tid = ev->tid;
+		rec->nframes = ev->size * LOG_MALLOC_BINARY_TOMB_WORDS;
+
+		words = (uint64_t *)(buf + len);
+		for(ii = 0; ii < ev->size; ii++)
+		{
+			*words++ = (uintptr_t)tombs[ii].ptr;
+			*words++ = tombs[ii].size;
+			*words++ = tombs[ii].atid;
+		}
+		return (char *)words - buf;
+	}
+
+	/* + frees COUNT [USED:RUSED] -SIZE PTR[/ATID] ... [~TID] */
+	FMT_LIT(p, "+ frees ");
+	p += log_malloc_fmt_udec(p, ev->size);
+	p = format_usage(p, ev);
+
+	for(ii = 0; ii < ev->size; ii++)
+	{
+		FMT_LIT(p, " -");
+		p += log_malloc_fmt_udec(p, tombs[ii].size);
+		*p++ = ' ';
+		p += log_malloc_fmt_ptr(p, tombs[ii].ptr);
+		if(ev->tid)
+		{
+			*p++ = '/';
+			p += log_malloc_fmt_udec(p, tombs[ii].atid);
+		}
+	}
+
+	if(ev->tid)
+	{
+		FMT_LIT(p, " ~");
+		p += log_malloc_fmt_udec(p, ev->tid);
+	}
+
+	*p++ = '\n';
+	return p - buf;
+}
+
+/* write text (comments, INIT/FINI...) in configured trace format */
+ssize_t log_malloc_write_text(const log_malloc_ctx_t *ctx, const char *data, size_t len)
+{
+	ssize_t w = 0;
+
+	if(ctx->format != LOG_MALLOC_FORMAT_BINARY)
+		return log_malloc_write(ctx, data, len);
+
+	while(len > 0)
+	{
+		size_t rlen;
+		char buf[sizeof(struct log_malloc_brec_s) + TEXT_CHUNK];
+		struct log_malloc_brec_s *rec = (struct log_malloc_brec_s *)buf;
+		const log_malloc_event_t ev = { LOG_MALLOC_EV_TEXT };
+		const size_t chunk = (len > TEXT_CHUNK) ? TEXT_CHUNK : len;
+
+		rlen = log_malloc_format_binary(&ev, buf, sizeof(buf));
+		rec->size = chunk;
+
+		memcpy(buf + rlen, data, chunk);
+		rlen += chunk;
+
+		/* padding */
+		while(rlen != LOG_MALLOC_BINARY_ALIGN(rlen))
+			buf[rlen++] = '\0';
+
+		if(log_malloc_write(ctx, buf, rlen) == -1)
+			return -1;
+
+		w    += chunk;
+		data += chunk;
+		len  -= chunk;
+	}
+	return w;
+}
+
+/* EOF */
@@ -0,0 +1,258 @@
+/*
+ * log-malloc2 block hash
+ *	Lock-striped open addressing hash of fixed size block records keyed by
+ *	user pointer (first 64 bits of record), backward shift deletion. Used by
+ *	live allocations table and side table, slots are allocated by mmap.
+ *
+ * Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+ *
+ * License: GNU LGPLv3 (http://www.gnu.org/licenses/lgpl.html)
+ *
+ * Web:
+ *	http://devel.dob.sk/log-malloc2
+ *	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+ *	https://github.com/samsk/log-malloc2 (git repo)
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "log-malloc2.h"
+#include "log-malloc2_internal.h"
+
+/* record in slot idx, its key */
+#define HASH_SLOT(hash, stripe, idx)	((stripe)->slots + (idx) * (hash)->esize)
+#define HASH_KEY(hash, stripe, idx)	(*(uint64_t *)HASH_SLOT(hash, stripe, idx))
+
+static inline uint64_t hash_key(uint64_t ptr)
+{
+	return (ptr >> 4) * 0x9E3779B97F4A7C15ULL;
+}
+
+static inline log_malloc_hstripe_t *hash_stripe(log_malloc_hash_t *hash, uint64_t hkey)
+{
+	return &hash->stripes[hkey >> (64 - LOG_MALLOC_HASH_STRIPES_BITS)];
+}
+
+static inline void stripe_lock(log_malloc_hstripe_t *stripe)
+{
+	while(__sync_lock_test_and_set(&stripe->lock, 1))
+	{
+		while(stripe->lock)
+			sched_yield();
+	}
+	return;
+}
+
+static inline bool stripe_trylock(log_malloc_hstripe_t *stripe, int spins)
+{
+	do
+	{
+		if(!__sync_lock_test_and_set(&stripe->lock, 1))
+			return true;
+	} while(--spins > 0);
+	return false;
+}
+
+static inline void stripe_unlock(log_malloc_hstripe_t *stripe)
+{
+	__sync_lock_release(&stripe->lock);
+	return;
+}
+
+/* slot of key, or empty slot where it belongs */
+static inline size_t stripe_find(const log_malloc_hash_t *hash,
+	const log_malloc_hstripe_t *stripe, uint64_t key)
+{
+	size_t idx = hash_key(key) & stripe->mask;
+
+	while(HASH_KEY(hash, stripe, idx) != 0 && HASH_KEY(hash, stripe, idx) != key)
+		idx = (idx + 1) & stripe->mask;
+	return idx;
+}
+
+/* resize stripe to given slots count, stripe must be locked */
+static bool stripe_resize(const log_malloc_hash_t *hash, log_malloc_hstripe_t *stripe, size_t size)
+{
+	size_t ii;
+	char *slots;
+	char *old = stripe->slots;
+	const size_t old_size = (old) ? stripe->mask + 1 : 0;
+
+	/* mmap, to not recurse into malloc (pages are touched on use) */
+	slots = mmap(NULL, hash->esize * size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(slots == MAP_FAILED)
+		return false;
+
+	stripe->slots = slots;
+	stripe->mask = size - 1;
+	for(ii = 0; ii < old_size; ii++)
+	{
+		const char *rec = old + ii * hash->esize;
+
+		if(*(const uint64_t *)rec != 0)
+			memcpy(HASH_SLOT(hash, stripe, stripe_find(hash, stripe, *(const uint64_t *)rec)),
+				rec, hash->esize);
+	}
+
+	if(old)
+		munmap(old, hash->esize * old_size);
+	return true;
+}
+
+/*
+ *  INTERNAL API FUNCTIONS
+ */
+
+/** setup hash (slots are allocated on first use of every stripe)
+ * @param	esize	record size, record starts with uint64_t key (0 - empty)
+ * @param	slots	initial slots of stripe (power of 2)
+ * @param	grow	stripe doubles at 3/4 load, otherwise records over
+ *			capacity are not added
+ */
+void log_malloc_hash_init(log_malloc_hash_t *hash, size_t esize, size_t slots, bool grow)
+{
+	hash->esize = esize;
+	hash->slots = slots;
+	hash->grow = grow;
+	return;
+}
+
+void log_malloc_hash_atfork_child(log_malloc_hash_t *hash)
+{
+	int ii;
+
+	/* locks might be held by threads not existing in child */
+	for(ii = 0; ii < LOG_MALLOC_HASH_STRIPES; ii++)
+		hash->stripes[ii].lock = 0;
+	return;
+}
+
+/** add record (record with same key is replaced)
+ * @return	false if stripe is full, or can not grow
+ */
+bool log_malloc_hash_add(log_malloc_hash_t *hash, const void *rec)
+{
+	size_t idx;
+	const uint64_t key = *(const uint64_t *)rec;
+	log_malloc_hstripe_t *stripe = hash_stripe(hash, hash_key(key));
+
+	stripe_lock(stripe);
+	if(stripe->slots == NULL
+		|| (hash->grow && stripe->count + 1 > (stripe->mask + 1) / 4 * 3))
+	{
+		if(!stripe_resize(hash, stripe, (stripe->slots) ? (stripe->mask + 1) * 2 : hash->slots))
+		{
+			stripe_unlock(stripe);
+			return false;
+		}
+	}
+	/* one slot stays empty, probing ends */
+	else if(!hash->grow && stripe->count >= stripe->mask)
+	{
+		stripe_unlock(stripe);
+		return false;
+	}
+
+	idx = stripe_find(hash, stripe, key);
+	if(HASH_KEY(hash, stripe, idx) == 0)
+		stripe->count++;
+	memcpy(HASH_SLOT(hash, stripe, idx), rec, hash->esize);
+	stripe_unlock(stripe);
+	return true;
+}
+
+/** remove record (backward shift deletion, no tombstones)
+ * @param	rec	removed record (can be NULL)
+ * @return	false if key is not in hash
+ */
+bool log_malloc_hash_del(log_malloc_hash_t *hash, uint64_t key, void *rec)
+{
+	size_t idx, next;
+	log_malloc_hstripe_t *stripe = hash_stripe(hash, hash_key(key));
+
+	stripe_lock(stripe);
+	if(stripe->slots == NULL || HASH_KEY(hash, stripe, idx = stripe_find(hash, stripe, key)) == 0)
+	{
+		stripe_unlock(stripe);
+		return false;
+	}
+
+	if(rec)
+		memcpy(rec, HASH_SLOT(hash, stripe, idx), hash->esize);
+
+	for(next = (idx + 1) & stripe->mask; HASH_KEY(hash, stripe, next) != 0;
+		next = (next + 1) & stripe->mask)
+	{
+		const size_t home = hash_key(HASH_KEY(hash, stripe, next)) & stripe->mask;
+
+		/* entry can fill the hole only if hole lies between its home and it */
+		if(((next - home) & stripe->mask) >= ((next - idx) & stripe->mask))
+		{
+			memcpy(HASH_SLOT(hash, stripe, idx), HASH_SLOT(hash, stripe, next), hash->esize);
+			idx = next;
+		}
+	}
+	HASH_KEY(hash, stripe, idx) = 0;
+	stripe->count--;
+	stripe_unlock(stripe);
+	return true;
+}
+
+/** check if key is in hash */
+bool log_malloc_hash_has(log_malloc_hash_t *hash, uint64_t key)
+{
+	bool found;
+	log_malloc_hstripe_t *stripe = hash_stripe(hash, hash_key(key));
+
+	stripe_lock(stripe);
+	found = (stripe->slots && HASH_KEY(hash, stripe, stripe_find(hash, stripe, key)) != 0);
+	stripe_unlock(stripe);
+	return found;
+}
+
+/** call cb for every record of given stripe (stripe is locked meanwhile)
+ * @param	spins	lock attempts before stripe is skipped (0 - wait for lock)
+ * @return	number of records, -1 if stripe was busy
+ */
+ssize_t log_malloc_hash_walk(log_malloc_hash_t *hash, int stripe_idx, int spins,
+	void (*cb)(const void *rec, void *arg), void *arg)
+{
+	size_t ii;
+	size_t count = 0;
+	log_malloc_hstripe_t *stripe = &hash->stripes[stripe_idx];
+
+	if(spins == 0)
+		stripe_lock(stripe);
+	else if(!stripe_trylock(stripe, spins))
+		return -1;
+
+	for(ii = 0; stripe->slots && count < stripe->count && ii <= stripe->mask; ii++)
+	{
+		if(HASH_KEY(hash, stripe, ii) == 0)
+			continue;
+
+		cb(HASH_SLOT(hash, stripe, ii), arg);
+		count++;
+	}
+	stripe_unlock(stripe);
+	return count;
+}
+
+/* EOF */
@@ -0,0 +1,302 @@
+/*
+ * log-malloc2 histograms
+ *	Allocation size class and block lifetime histograms (log2 buckets),
+ *	every thread counts into its own slot, totals are aggregated on dump.
+ *
+ * Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+ *
+ * License: GNU LGPLv3 (http://www.gnu.org/licenses/lgpl.html)
+ *
+ * Web:
+ *	http://devel.dob.sk/log-malloc2
+ *	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+ *	https://github.com/samsk/log-malloc2 (git repo)
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <signal.h>
+#include <errno.h>
+
+#include "log-malloc2.h"
+#include "log-malloc2_internal.h"
+
+#ifdef ENABLE_HISTOGRAM
+
+/* thread slot, slot 0 is shared by threads that did not get own one */
+struct log_malloc_hslot_s {
+	volatile int busy;
+	uint64_t allocs[LOG_MALLOC_HISTOGRAM_BUCKETS];
+	uint64_t bytes[LOG_MALLOC_HISTOGRAM_BUCKETS];
+	uint64_t lifetime[LOG_MALLOC_HISTOGRAM_BUCKETS];
+} __attribute__((__aligned__(LOG_MALLOC_CACHELINE)));
+
+static struct log_malloc_hslot_s g_slots[LOG_MALLOC_HISTOGRAM_SLOTS];
+
+static __thread struct log_malloc_hslot_s *t_slot = NULL;
+
+static int g_fd = -1;		/* dump fd (-1 - trace fd) */
+
+#ifdef HAVE_LIBPTHREAD
+/* releases slot of exited thread */
+static pthread_key_t g_key;
+static pthread_once_t g_key_once = PTHREAD_ONCE_INIT;
+
+static void histogram_thread_exit(void *slot)
+{
+	/* later allocations (other destructors) go to shared slot */
+	t_slot = &g_slots[0];
+	if(slot)
+		__sync_lock_release(&((struct log_malloc_hslot_s *)slot)->busy);
+	return;
+}
+
+static void histogram_key_init(void)
+{
+	(void)pthread_key_create(&g_key, histogram_thread_exit);
+	return;
+}
+#endif
+
+/* log2 bucket, bucket k > 0 holds values of [2^(k-1), 2^k) */
+static inline int histogram_bucket(uint64_t val)
+{
+	const int bucket = (val) ? 64 - __builtin_clzll(val) : 0;
+
+	return (bucket < LOG_MALLOC_HISTOGRAM_BUCKETS) ? bucket : LOG_MALLOC_HISTOGRAM_BUCKETS - 1;
+}
+
+/* assign slot to thread (slot counts stay, they are aggregated) */
+static struct log_malloc_hslot_s *histogram_slot(void)
+{
+	int ii;
+
+	/* shared slot until own slot is registered (setspecific may allocate) */
+	t_slot = &g_slots[0];
+
+	for(ii = 1; ii < LOG_MALLOC_HISTOGRAM_SLOTS; ii++)
+	{
+		if(g_slots[ii].busy || !__sync_bool_compare_and_swap(&g_slots[ii].busy, 0, 1))
+			continue;
+
+#ifdef HAVE_LIBPTHREAD
+		pthread_once(&g_key_once, histogram_key_init);
+		pthread_setspecific(g_key, &g_slots[ii]);
+#endif
+		t_slot = &g_slots[ii];
+		break;
+	}
+	return t_slot;
+}
+
+static inline void histogram_inc(struct log_malloc_hslot_s *slot, uint64_t *counter, uint64_t val)
+{
+	if(slot == &g_slots[0])
+		(void)__sync_fetch_and_add(counter, val);
+	else
+		*counter += val;
+	return;
+}
+
+static void histogram_signal(int sig)
+{
+	const int err = errno;
+
+	(void)log_malloc_histogram_write(-1);
+	errno = err;
+	return;
+}
+
+static ssize_t histogram_write(int fd, const char *data, size_t len)
+{
+	log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	if(fd == -1)
+		return log_malloc_write_text(ctx, data, len);
+	return write(fd, data, len);
+}
+
+/* print bucket range */
+static inline int histogram_range(char *buf, size_t size, int bucket)
+{
+	if(bucket == 0)
+		return snprintf(buf, size, "0-0");
+	if(bucket == LOG_MALLOC_HISTOGRAM_BUCKETS - 1)
+		return snprintf(buf, size, "%" PRIu64 "-", (uint64_t)1 << (bucket - 1));
+	return snprintf(buf, size, "%" PRIu64 "-%" PRIu64,
+		(uint64_t)1 << (bucket - 1), ((uint64_t)1 << bucket) - 1);
+}
+
+/*
+ *  INTERNAL API FUNCTIONS
+ */
+int log_malloc_histogram_init(const char *enable, const char *sig)
+{
+	log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	if(enable == NULL || enable[0] == '\0' || strcmp(enable, "0") == 0)
+		return 0;
+
+	/* dump goes to stderr if there is no trace */
+	if(ctx->memlog_disabled)
+		g_fd = STDERR_FILENO;
+
+	if(sig && sig[0] != '\0')
+	{
+		struct sigaction sa;
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = histogram_signal;
+		sa.sa_flags = SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+
+		if(sigaction(atoi(sig), &sa, NULL) != 0)
+			fprintf(stderr, "\n*** log-malloc: could not install histogram signal %s\n\n",
+				sig);
+	}
+
+	ctx->histogram = true;
+	return 1;
+}
+
+/** count allocation of given size
+ * @return	allocation timestamp (for lifetime)
+ */
+uint64_t log_malloc_histogram_alloc(size_t size)
+{
+	struct log_malloc_hslot_s *slot = (t_slot) ? t_slot : histogram_slot();
+	const int bucket = histogram_bucket(size);
+
+	histogram_inc(slot, &slot->allocs[bucket], 1);
+	histogram_inc(slot, &slot->bytes[bucket], size);
+	return log_malloc_timestamp();
+}
+
+/* count release of block allocated at given time */
+void log_malloc_histogram_free(uint64_t timestamp)
+{
+	struct log_malloc_hslot_s *slot = (t_slot) ? t_slot : histogram_slot();
+	const uint64_t now = log_malloc_timestamp();
+
+	histogram_inc(slot, &slot->lifetime[histogram_bucket(now - timestamp)], 1);
+	return;
+}
+
+/* aggregate all thread slots */
+int log_malloc_histogram_sum(log_malloc_histogram_t *sum)
+{
+	int ii, jj;
+	const log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	if(!ctx->histogram)
+		return -1;
+
+	memset(sum, 0, sizeof(*sum));
+	for(ii = 0; ii < LOG_MALLOC_HISTOGRAM_SLOTS; ii++)
+	{
+		const volatile struct log_malloc_hslot_s *slot = &g_slots[ii];
+
+		for(jj = 0; jj < LOG_MALLOC_HISTOGRAM_BUCKETS; jj++)
+		{
+			sum->allocs[jj]		+= slot->allocs[jj];
+			sum->bytes[jj]		+= slot->bytes[jj];
+			sum->lifetime[jj]	+= slot->lifetime[jj];
+		}
+	}
+	return 0;
+}
+
+/** write histograms (non-empty buckets only)
+ * @param	fd	output fd, -1 for trace fd
+ * @return	0, -1 if histograms are disabled
+ * @note	async-signal safe enough (no locks, no allocation)
+ */
+int log_malloc_histogram_write(int fd)
+{
+	int ii;
+	int s, w;
+	char buf[256];
+	uint64_t allocs = 0;
+	uint64_t bytes = 0;
+	uint64_t frees = 0;
+	log_malloc_histogram_t sum;
+
+	if(log_malloc_histogram_sum(&sum) != 0)
+		return -1;
+
+	if(fd == -1)
+		fd = g_fd;
+
+	for(ii = 0; ii < LOG_MALLOC_HISTOGRAM_BUCKETS; ii++)
+	{
+		allocs += sum.allocs[ii];
+		bytes += sum.bytes[ii];
+		frees += sum.lifetime[ii];
+	}
+
+	s = snprintf(buf, sizeof(buf), "# HISTOGRAM allocs=%" PRIu64 " bytes=%" PRIu64
+			" frees=%" PRIu64 "\n", allocs, bytes, frees);
+	w = histogram_write(fd, buf, s);
+
+	for(ii = 0; ii < LOG_MALLOC_HISTOGRAM_BUCKETS; ii++)
+	{
+		if(sum.allocs[ii] == 0)
+			continue;
+
+		s = snprintf(buf, sizeof(buf), "# HISTOGRAM-SIZE ");
+		s += histogram_range(buf + s, sizeof(buf) - s, ii);
+		s += snprintf(buf + s, sizeof(buf) - s, " allocs=%" PRIu64 " bytes=%" PRIu64 "\n",
+			sum.allocs[ii], sum.bytes[ii]);
+		w = histogram_write(fd, buf, s);
+	}
+
+	for(ii = 0; ii < LOG_MALLOC_HISTOGRAM_BUCKETS; ii++)
+	{
+		if(sum.lifetime[ii] == 0)
+			continue;
+
+		s = snprintf(buf, sizeof(buf), "# HISTOGRAM-LIFETIME ");
+		s += histogram_range(buf + s, sizeof(buf) - s, ii);
+		s += snprintf(buf + s, sizeof(buf) - s, "ns frees=%" PRIu64 "\n",
+			sum.lifetime[ii]);
+		w = histogram_write(fd, buf, s);
+	}
+	return 0;
+}
+
+#else
+
+int log_malloc_histogram_init(const char *enable, const char *sig)
+{
+	if(enable == NULL || enable[0] == '\0' || strcmp(enable, "0") == 0)
+		return 0;
+
+	fprintf(stderr, "\n*** log-malloc: histograms not compiled in (--enable-histogram)\n\n");
+	return -1;
+}
+
+int log_malloc_histogram_sum(log_malloc_histogram_t *sum)
+{
+	return -1;
+}
+
+int log_malloc_histogram_write(int fd)
+{
+	return -1;
+}
+
+#endif
+
+/* EOF */
@@ -20,7 +20,13 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/syscall.h>
 
 #ifdef HAVE_STDBOOL_H
 #include <stdbool.h>
@@ -47,33 +53,233 @@
 #endif
 
 
+/* trace buffering config */
+#ifndef LOG_MALLOC_CACHELINE
+#define LOG_MALLOC_CACHELINE		64
+#endif
+
+#ifndef LOG_MALLOC_BUFFER_MIN
+#define LOG_MALLOC_BUFFER_MIN		4096
+#endif
+
+#ifndef LOG_MALLOC_BUFFER_DRAIN_USEC
+#define LOG_MALLOC_BUFFER_DRAIN_USEC	1000
+#endif
+
+/* trace buffer overflow policy */
+#define LOG_MALLOC_OVERFLOW_BLOCK	0	/* wait for drain thread */
+#define LOG_MALLOC_OVERFLOW_DROP	1	/* drop record and count it */
+#define LOG_MALLOC_OVERFLOW_SPILL	2	/* flush ring and write directly */
+
+/* usage counter shards (power of 2) */
+#ifndef LOG_MALLOC_SHARDS
+#define LOG_MALLOC_SHARDS		64
+#endif
+
+/* stack interning table size (power of 2) */
+#ifndef LOG_MALLOC_STACK_TABLE_SIZE
+#define LOG_MALLOC_STACK_TABLE_SIZE	65536
+#endif
+
+/* live allocations table size (blocks, power of 2) */
+#ifndef LOG_MALLOC_LIVE_TABLE_SIZE
+#define LOG_MALLOC_LIVE_TABLE_SIZE	(1 << 20)
+#endif
+
+/* histogram thread slots (threads over limit share one slot) */
+#ifndef LOG_MALLOC_HISTOGRAM_SLOTS
+#define LOG_MALLOC_HISTOGRAM_SLOTS	256
+#endif
+
+/* max. backtrace depth (runtime depth is LOG_MALLOC_BACKTRACE_COUNT by default) */
+#ifndef LOG_MALLOC_BACKTRACE_MAX
+#define LOG_MALLOC_BACKTRACE_MAX	32
+#endif
+
+/* LOG_MALLOC_OPTIONS limits (options count, keys and values size) */
+#ifndef LOG_MALLOC_OPTIONS_MAX
+#define LOG_MALLOC_OPTIONS_MAX		32
+#endif
+
+#ifndef LOG_MALLOC_OPTIONS_SIZE
+#define LOG_MALLOC_OPTIONS_SIZE		1024
+#endif
+
+/* max. frees in one batch record (LOG_MALLOC_FREE_BATCH) */
+#ifndef LOG_MALLOC_FREE_BATCH_MAX
+#define LOG_MALLOC_FREE_BATCH_MAX	64
+#endif
+
+/* query socket client timeout (seconds) and default call sites count */
+#ifndef LOG_MALLOC_QUERY_TIMEOUT
+#define LOG_MALLOC_QUERY_TIMEOUT	10
+#endif
+
+#ifndef LOG_MALLOC_QUERY_TOP
+#define LOG_MALLOC_QUERY_TOP		10
+#endif
+
+/* private arena chunk size (internal allocations while tracing) */
+#ifndef LOG_MALLOC_ARENA_CHUNK
+#define LOG_MALLOC_ARENA_CHUNK		(64 * 1024)
+#endif
+
+/* backtrace unwinding engine */
+#define LOG_MALLOC_UNWIND_GLIBC		0	/* glibc backtrace() */
+#define LOG_MALLOC_UNWIND_LIBUNWIND	1	/* libunwind, cached unwind info */
+#define LOG_MALLOC_UNWIND_FP		2	/* frame pointers walk */
+#define LOG_MALLOC_UNWIND_NONE		3	/* no backtraces */
+
+#ifdef HAVE_UNWIND
+#define LOG_MALLOC_UNWIND_DEFAULT	LOG_MALLOC_UNWIND_LIBUNWIND
+#else
+#define LOG_MALLOC_UNWIND_DEFAULT	LOG_MALLOC_UNWIND_GLIBC
+#endif
+
+/* backtrace of free() calls */
+#define LOG_MALLOC_FREE_STACK_NONE	0
+#define LOG_MALLOC_FREE_STACK_FOREIGN	1	/* only free of foreign memory */
+#define LOG_MALLOC_FREE_STACK_ALL	2
+
+/* trace output format */
+#define LOG_MALLOC_FORMAT_TEXT		0
+#define LOG_MALLOC_FORMAT_BINARY	1
+
+/* trace event types */
+#define LOG_MALLOC_EV_TEXT		0	/* raw text (comments, INIT/FINI...) */
+#define LOG_MALLOC_EV_MALLOC		1
+#define LOG_MALLOC_EV_CALLOC		2
+#define LOG_MALLOC_EV_REALLOC		3
+#define LOG_MALLOC_EV_MEMALIGN		4
+#define LOG_MALLOC_EV_POSIX_MEMALIGN	5
+#define LOG_MALLOC_EV_VALLOC		6
+#define LOG_MALLOC_EV_FREE		7
+#define LOG_MALLOC_EV_STACK		8	/* interned backtrace definition */
+#define LOG_MALLOC_EV_FREES		9	/* batched frees (tombstones) */
+#define LOG_MALLOC_EV_ALIGNED_ALLOC	10
+#define LOG_MALLOC_EV_PVALLOC		11
+#define LOG_MALLOC_EV_REALLOCARRAY	12
+#define LOG_MALLOC_EV_NEW		13	/* C++ operator new (aligned one with alignment) */
+#define LOG_MALLOC_EV_NEW_ARRAY		14
+#define LOG_MALLOC_EV_DELETE		15
+#define LOG_MALLOC_EV_DELETE_ARRAY	16
+
+/* trace event */
+typedef struct log_malloc_event_s {
+	int type;
+	int ret;		/* posix_memalign return value */
+	bool foreign;		/* free of memory not allocated by us */
+	ssize_t size;		/* allocated size, or change for realloc */
+	const void *ptr;	/* (re)allocated/released memory */
+	const void *optr;	/* realloc input memory */
+	size_t arg1;		/* calloc nmemb, alignment (0 - new), realloc old size */
+	size_t arg2;		/* calloc size, posix_memalign size, realloc new size */
+	int64_t mem_used;
+	int64_t mem_rused;
+	uint32_t tid;		/* calling thread (0 - thread tracking disabled) */
+	uint32_t atid;		/* free: thread that allocated memory (0 - unknown) */
+} log_malloc_event_t;
+
+/* binary trace format
+ *	stream header, followed by records (header + frames + statm/text payload),
+ *	all values in host byte order, every record aligned to 8 bytes
+ */
+#define LOG_MALLOC_BINARY_MAGIC		"LM2B"
+#define LOG_MALLOC_BINARY_VERSION	2
+#define LOG_MALLOC_BINARY_BOM		0x01020304
+
+#define LOG_MALLOC_BINARY_ALIGN(len)	(((len) + 7) & ~((size_t)7))
+
+/* batched frees record carries 3 words per free (ptr, size, atid) in place
+ * of frames, so older decoders can skip it
+ */
+#define LOG_MALLOC_BINARY_TOMB_WORDS	3
+
+/* record flags */
+#define LOG_MALLOC_BF_FOREIGN		0x01	/* free of foreign memory (!f) */
+#define LOG_MALLOC_BF_RECURSION		0x02	/* stack unavailable due recursion (!) */
+#define LOG_MALLOC_BF_TID		0x04	/* thread tracking (~TID[/ATID]) */
+
+struct log_malloc_bhead_s {
+	char     magic[4];
+	uint16_t version;
+	uint16_t rec_size;	/* sizeof(struct log_malloc_brec_s) */
+	uint32_t bom;		/* byte order mark */
+	uint32_t reserved;
+};
+
+struct log_malloc_brec_s {
+	uint8_t  type;		/* LOG_MALLOC_EV_* */
+	uint8_t  flags;		/* LOG_MALLOC_BF_* */
+	uint16_t nframes;	/* frame addresses following header */
+	uint16_t statm_len;	/* /proc/self/statm data following frames */
+	uint16_t reserved;
+	uint32_t tid;
+	int32_t  ret;
+	uint32_t stack;		/* interned backtrace id (0 - none) */
+	uint32_t atid;		/* free: allocating thread (0 - unknown) */
+	uint64_t timestamp;	/* CLOCK_MONOTONIC ns */
+	int64_t  size;		/* text length for LOG_MALLOC_EV_TEXT */
+	uint64_t ptr;
+	uint64_t optr;
+	uint64_t arg1;
+	uint64_t arg2;
+	int64_t  mem_used;
+	int64_t  mem_rused;
+};
+
 /* init constants */
 #define LOG_MALLOC_INIT_NULL		0xFAB321
 #define LOG_MALLOC_INIT_DONE		0x123FAB
 #define LOG_MALLOC_FINI_DONE		0xFAFBFC
 
+/* call counters (64-bit, lock-free on 64-bit platforms) */
+struct log_malloc_stat_s {
+	uint64_t malloc;
+	uint64_t calloc;
+	uint64_t realloc;
+	uint64_t memalign;
+	uint64_t posix_memalign;
+	uint64_t valloc;
+	uint64_t free;
+	uint64_t unrel_sum; /* unrealiable call count sum */
+};
+
+/* usage counters (counters shard, or aggregated totals) */
+typedef struct log_malloc_counters_s {
+	int64_t mem_used;
+	int64_t mem_rused;
+	struct log_malloc_stat_s stat;
+} log_malloc_counters_t;
+
 /* global context */
 typedef struct log_malloc_ctx_s {
 	sig_atomic_t init_done;
-        sig_atomic_t mem_used;
-	sig_atomic_t mem_rused;
-	struct {
-		sig_atomic_t malloc;
-		sig_atomic_t calloc;
-		sig_atomic_t realloc;
-		sig_atomic_t memalign;
-		sig_atomic_t posix_memalign;
-		sig_atomic_t valloc;
-		sig_atomic_t free;
-		sig_atomic_t unrel_sum; /* unrealiable call count sum */
-	} stat;
+	int64_t mem_used;
+	int64_t mem_rused;
+	struct log_malloc_stat_s stat;
 	int memlog_fd;
 	int statm_fd;
 	bool memlog_disabled;
+	bool buffer_active;
+	int format;
+	bool stack_intern;
+	size_t sample_interval;	/* 0 - trace every call */
+	bool counters_exact;	/* global usage counters while tracing */
+	volatile bool shards_used;
+	bool live_table;
+	bool histogram;
+	int unwind;		/* LOG_MALLOC_UNWIND_* */
+	int depth;		/* backtrace depth (<= LOG_MALLOC_BACKTRACE_MAX) */
+	unsigned int statm_every; /* statm in every Nth record */
+	int free_stack;		/* LOG_MALLOC_FREE_STACK_* */
+	volatile unsigned int free_batch; /* frees per batch record (0 - off) */
+	bool call_count;
+	bool tid;		/* thread ids in trace records */
+	bool headerless;	/* block metadata in side table, not in header */
+	volatile size_t side_table; /* blocks in side table (0 - no lookups) */
+	size_t bufsize;		/* text record buffer size (depends on depth) */
 	clock_t clock_start;
-#ifdef HAVE_LIBPTHREAD
-	pthread_mutex_t loglock;
-#endif
 } log_malloc_ctx_t;
 
 #define LOG_MALLOC_CTX_INIT_BASE		\
@@ -84,22 +290,336 @@ typedef struct log_malloc_ctx_s {
 		LOG_MALLOC_TRACE_FD,		\
 		-1,				\
 		false,				\
+		false,				\
+		LOG_MALLOC_FORMAT_TEXT,		\
+		false,				\
+		0,				\
+		true,				\
+		false,				\
+		false,				\
+		false,				\
+		LOG_MALLOC_UNWIND_DEFAULT,	\
+		LOG_MALLOC_BACKTRACE_COUNT,	\
+		1,				\
+		LOG_MALLOC_FREE_STACK_FOREIGN,	\
+		0,				\
+		true,				\
+		false,				\
+		false,				\
+		0,				\
+		0,				\
 		0
 
-#ifdef HAVE_LIBPTHREAD
 #define LOG_MALLOC_CTX_INIT			\
 	{					\
 		LOG_MALLOC_CTX_INIT_BASE,	\
-		PTHREAD_MUTEX_INITIALIZER,	\
 	}
-#else
-#define LOG_MALLOC_CTX_INIT			\
-	{					\
-		LOG_MALLOC_CTX_INIT_BASE,	\
-	}
-#endif
 
 /* API function */
 log_malloc_ctx_t *log_malloc_ctx_get(void);
+int log_malloc_passthrough_set(bool enable);
+
+/* runtime options (log-malloc2_options.c) */
+int log_malloc_options_init(const char *options);
+const char *log_malloc_options_get(const char *name);
+long log_malloc_options_int(const char *name, long def, long min, long max);
+
+/* trace buffering (log-malloc2_buffer.c) */
+int log_malloc_buffer_init(const char *size, const char *overflow);
+int log_malloc_buffer_start(void);
+void log_malloc_buffer_atfork_child(void);
+void log_malloc_buffer_fini(void);
+bool log_malloc_buffer_lossy(void);
+ssize_t log_malloc_buffer_write(const char *data, size_t len);
+
+/* metadata of block without header (side table entry) */
+typedef struct log_malloc_meta_s {
+	uint64_t ptr;		/* user memory, 0 - empty slot */
+	uint64_t size;
+	uint64_t timestamp;	/* allocation time (lifetime histogram) */
+	uint32_t flags;
+	uint32_t tid;		/* allocating thread */
+} log_malloc_meta_t;
+
+/* freed block waiting in batch (log-malloc2_tomb.c) */
+typedef struct log_malloc_tomb_s {
+	const void *ptr;
+	size_t size;
+	uint32_t atid;		/* allocating thread */
+} log_malloc_tomb_t;
+
+/* batched frees record buffer (text line, or binary header + tombs) */
+#define LOG_MALLOC_FREES_BUFSIZE	(128 + 64 * LOG_MALLOC_FREE_BATCH_MAX)
+
+/* trace formatting (log-malloc2_format.c) */
+int log_malloc_format_init(const char *format);
+size_t log_malloc_format_text(const log_malloc_event_t *ev, char *buf, size_t size);
+size_t log_malloc_format_binary(const log_malloc_event_t *ev, char *buf, size_t size);
+size_t log_malloc_format_frees(const log_malloc_ctx_t *ctx, const log_malloc_event_t *ev,
+		const struct log_malloc_tomb_s *tombs, char *buf);
+ssize_t log_malloc_write_text(const log_malloc_ctx_t *ctx, const char *data, size_t len);
+
+/* stack interning (log-malloc2_stack.c) */
+int log_malloc_stack_table(void);
+int log_malloc_stack_init(const char *enable);
+uint32_t log_malloc_stack_intern(const uint64_t *frames, int nframes, bool *added);
+int log_malloc_stack_get(uint32_t id, uint64_t *frames, int max);
+
+/* allocation sampling (log-malloc2_sample.c) */
+int log_malloc_sample_init(const char *interval);
+bool log_malloc_sample_hit(size_t size);
+
+extern __thread int64_t log_malloc_sample_left;
+
+/** check if allocation of given size should be traced
+ * @note	unsampled allocation costs single thread-local subtraction
+ */
+static inline bool log_malloc_sample(const log_malloc_ctx_t *ctx, size_t size)
+{
+	if(ctx->sample_interval == 0)
+		return true;
+	if((log_malloc_sample_left -= size) > 0)
+		return false;
+	return log_malloc_sample_hit(size);
+}
+
+/* per-thread accounting (log-malloc2_thread.c) */
+typedef struct log_malloc_thread_s {
+	int64_t used;		/* allocated - released by this thread */
+	int64_t limit;		/* next quota check (0 - not initialized) */
+	int64_t quota;		/* 0 - none */
+	log_malloc_quota_cb_t cb;
+	bool init;
+	bool rearm;		/* quota reported, re-check when usage drops */
+} log_malloc_thread_t;
+
+int log_malloc_thread_init(const char *quota);
+void log_malloc_thread_over(void);
+void log_malloc_thread_quota(int64_t quota, log_malloc_quota_cb_t cb);
+
+extern __thread log_malloc_thread_t log_malloc_thread;
+
+/** account memory change of calling thread
+ * @note	costs thread-local add and compare (quota check)
+ */
+static inline void log_malloc_thread_add(int64_t change)
+{
+	log_malloc_thread_t *t = &log_malloc_thread;
+
+	t->used += change;
+	if(__builtin_expect(t->used > t->limit, 0))
+		log_malloc_thread_over();
+	else if(__builtin_expect(t->rearm, 0) && t->used <= t->quota)
+	{
+		t->limit = t->quota;
+		t->rearm = false;
+	}
+	return;
+}
+
+/* batched frees (log-malloc2_tomb.c) */
+int log_malloc_tomb_init(unsigned int batch, void (*release)(void *ptr));
+bool log_malloc_tomb_add(const void *ptr, size_t size, uint32_t atid,
+		int64_t mem_used, int64_t mem_rused);
+void log_malloc_tomb_atfork_child(void);
+void log_malloc_tomb_fini(void);
+
+/* block hash stripes (power of 2) */
+#define LOG_MALLOC_HASH_STRIPES_BITS	8
+#define LOG_MALLOC_HASH_STRIPES		(1 << LOG_MALLOC_HASH_STRIPES_BITS)
+
+typedef struct log_malloc_hstripe_s {
+	volatile sig_atomic_t lock;
+	size_t mask;		/* slots - 1 */
+	size_t count;
+	char *slots;		/* NULL - not allocated yet */
+} __attribute__((__aligned__(LOG_MALLOC_CACHELINE))) log_malloc_hstripe_t;
+
+/* lock-striped hash of block records, keyed by first uint64_t of record */
+typedef struct log_malloc_hash_s {
+	size_t esize;		/* record size */
+	size_t slots;		/* initial stripe slots (power of 2) */
+	bool grow;		/* stripe doubles at 3/4 load (or record is not added) */
+	log_malloc_hstripe_t stripes[LOG_MALLOC_HASH_STRIPES];
+} log_malloc_hash_t;
+
+/* block hash (log-malloc2_hash.c) */
+void log_malloc_hash_init(log_malloc_hash_t *hash, size_t esize, size_t slots, bool grow);
+void log_malloc_hash_atfork_child(log_malloc_hash_t *hash);
+bool log_malloc_hash_add(log_malloc_hash_t *hash, const void *rec);
+bool log_malloc_hash_del(log_malloc_hash_t *hash, uint64_t key, void *rec);
+bool log_malloc_hash_has(log_malloc_hash_t *hash, uint64_t key);
+ssize_t log_malloc_hash_walk(log_malloc_hash_t *hash, int stripe, int spins,
+		void (*cb)(const void *rec, void *arg), void *arg);
+
+/* side table (log-malloc2_table.c) */
+void log_malloc_table_atfork_child(void);
+bool log_malloc_table_add(const log_malloc_meta_t *meta);
+bool log_malloc_table_del(const void *ptr, log_malloc_meta_t *meta);
+bool log_malloc_table_has(const void *ptr);
+
+/* private arena (log-malloc2_arena.c) */
+void *log_malloc_arena_alloc(size_t size);
+void log_malloc_arena_free(void *ptr);
+size_t log_malloc_arena_size(const void *ptr);
+
+/* unwinding engines (log-malloc2_unwind.c) */
+int log_malloc_unwind_init(const char *engine);
+int log_malloc_unwind_fp(const void *fp, uint64_t *frames, int max);
+#ifdef HAVE_UNWIND
+int log_malloc_unwind_cached(uint64_t *frames, int max, int skip);
+#endif
+
+/* live allocations table (log-malloc2_live.c) */
+int log_malloc_live_init(const char *size, const char *sig);
+void log_malloc_live_atfork_child(void);
+void log_malloc_live_add(const void *ptr, size_t size, uint32_t stack);
+void log_malloc_live_del(const void *ptr);
+int log_malloc_live_snapshot(int fd, bool async, size_t max);
+int64_t log_malloc_live_dump(int fd);
+
+/* size class and lifetime histograms (log-malloc2_histogram.c) */
+int log_malloc_histogram_init(const char *enable, const char *sig);
+int log_malloc_histogram_sum(log_malloc_histogram_t *sum);
+int log_malloc_histogram_write(int fd);
+#ifdef ENABLE_HISTOGRAM
+uint64_t log_malloc_histogram_alloc(size_t size);
+void log_malloc_histogram_free(uint64_t timestamp);
+#endif
+
+/* statm cache (log-malloc2_statm.c) */
+int log_malloc_statm_init(long interval);
+void log_malloc_statm_atfork_child(void);
+ssize_t log_malloc_statm_read(const log_malloc_ctx_t *ctx, char *buf, size_t size);
+
+/* usage time series (log-malloc2_series.c) */
+int log_malloc_series_init(const char *interval);
+int log_malloc_series_start(void);
+void log_malloc_series_atfork_child(void);
+void log_malloc_series_fini(void);
+
+/* live query socket (log-malloc2_query.c) */
+int log_malloc_query_init(const char *path);
+int log_malloc_query_start(void);
+void log_malloc_query_atfork_child(void);
+void log_malloc_query_fini(void);
+
+/* usage counters (log-malloc2_counters.c) */
+int log_malloc_counters_init(const char *mode);
+log_malloc_counters_t *log_malloc_counters_shard(void);
+int64_t log_malloc_counters_shards(size_t offset);
+void log_malloc_counters_sum(log_malloc_counters_t *sum);
+
+extern __thread log_malloc_counters_t *log_malloc_shard;
+
+/** get counters shard of current thread */
+static inline log_malloc_counters_t *log_malloc_counters_local(void)
+{
+	return (log_malloc_shard) ? log_malloc_shard : log_malloc_counters_shard();
+}
+
+/** get (cached) kernel thread id */
+extern __thread uint32_t log_malloc_tid;
+
+static inline uint32_t log_malloc_gettid(void)
+{
+	if(log_malloc_tid == 0)
+		log_malloc_tid = syscall(SYS_gettid);
+	return log_malloc_tid;
+}
+
+/** monotonic timestamp in ns (vdso, no syscall) */
+static inline uint64_t log_malloc_timestamp(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* text encoding tables (log-malloc2_format.c) */
+extern const char log_malloc_dec2[200];
+extern const char log_malloc_hex2[512];
+extern const uint64_t log_malloc_pow10[20];
+
+/** encode unsigned decimal (no terminating NUL)
+ * @return	number of chars written (max. 20)
+ */
+static inline size_t log_malloc_fmt_udec(char *str, uint64_t num)
+{
+	/* digits = floor(log10(num)) + 1, log10 estimated from bit length */
+	const int guess = ((64 - __builtin_clzll(num | 1)) * 1233) >> 12;
+	const size_t len = guess + ((num | 1) >= log_malloc_pow10[guess]);
+	char *p = str + len;
+
+	while(num >= 100)
+	{
+		p -= 2;
+		memcpy(p, &log_malloc_dec2[(num % 100) * 2], 2);
+		num /= 100;
+	}
+
+	if(num >= 10)
+		memcpy(p - 2, &log_malloc_dec2[num * 2], 2);
+	else
+		p[-1] = '0' + num;
+	return len;
+}
+
+/** encode signed decimal (no terminating NUL) */
+static inline size_t log_malloc_fmt_sdec(char *str, int64_t num)
+{
+	if(num >= 0)
+		return log_malloc_fmt_udec(str, num);
+
+	str[0] = '-';
+	return 1 + log_malloc_fmt_udec(str + 1, 0 - (uint64_t)num);
+}
+
+/** encode lowercase hex without 0x prefix (no terminating NUL)
+ * @return	number of chars written (max. 16)
+ */
+static inline size_t log_malloc_fmt_hex(char *str, uint64_t num)
+{
+	const size_t len = (64 - __builtin_clzll(num | 1) + 3) / 4;
+	char *p = str + len;
+
+	while(num >= 0x100)
+	{
+		p -= 2;
+		memcpy(p, &log_malloc_hex2[(num & 0xff) * 2], 2);
+		num >>= 8;
+	}
+
+	if(num >= 0x10)
+		memcpy(p - 2, &log_malloc_hex2[num * 2], 2);
+	else
+		p[-1] = log_malloc_hex2[num * 2 + 1];
+	return len;
+}
+
+/** encode pointer as printf %p (no terminating NUL) */
+static inline size_t log_malloc_fmt_ptr(char *str, const void *ptr)
+{
+	if(ptr == NULL)
+	{
+		memcpy(str, "(nil)", 5);
+		return 5;
+	}
+
+	memcpy(str, "0x", 2);
+	return 2 + log_malloc_fmt_hex(str + 2, (uintptr_t)ptr);
+}
+
+/** write trace record to trace fd (or thread trace buffer)
+ * @note	record must be complete, it is never split between buffers
+ */
+static inline ssize_t log_malloc_write(const log_malloc_ctx_t *ctx,
+	const char *data, size_t len)
+{
+	if(ctx->buffer_active)
+		return log_malloc_buffer_write(data, len);
+	return write(ctx->memlog_fd, data, len);
+}
 
 #endif
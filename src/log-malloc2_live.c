@@ -0,0 +1,362 @@
+/*
+ * log-malloc2 live allocations table
+ *	In-process table of outstanding memory blocks (size, stack id, timestamp),
+ *	heap snapshot groups them by allocation call site.
+ *
+ * Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+ *
+ * License: GNU LGPLv3 (http://www.gnu.org/licenses/lgpl.html)
+ *
+ * Web:
+ *	http://devel.dob.sk/log-malloc2
+ *	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+ *	https://github.com/samsk/log-malloc2 (git repo)
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "log-malloc2.h"
+#include "log-malloc2_internal.h"
+
+/* lock spins in signal handler before stripe is skipped */
+#define LIVE_SIGNAL_SPINS	1000
+
+struct log_malloc_live_s {
+	uint64_t ptr;		/* 0 - empty slot */
+	uint64_t size;
+	uint64_t timestamp;
+	uint32_t stack;
+	uint32_t reserved;
+};
+
+/* snapshot call site */
+struct log_malloc_site_s {
+	uint64_t bytes;
+	uint64_t blocks;
+	uint64_t oldest;
+	uint32_t stack;
+};
+
+/* snapshot walk state */
+struct log_malloc_sites_s {
+	struct log_malloc_site_s *sites;
+	uint64_t blocks;
+	uint64_t bytes;
+};
+
+static struct {
+	log_malloc_hash_t hash;
+	volatile size_t dropped;
+	int fd;			/* snapshot fd (-1 - trace fd) */
+} g_live = { { 0 }, 0, -1 };
+
+static void live_signal(int sig)
+{
+	const int err = errno;
+
+	(void)log_malloc_live_snapshot(-1, true, 0);
+	errno = err;
+	return;
+}
+
+static ssize_t live_write(int fd, const char *data, size_t len)
+{
+	log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	if(fd == -1)
+		return log_malloc_write_text(ctx, data, len);
+	return write(fd, data, len);
+}
+
+/* account block to its call site */
+static void live_site(const void *rec, void *arg)
+{
+	const struct log_malloc_live_s *live = rec;
+	struct log_malloc_sites_s *state = arg;
+	struct log_malloc_site_s *site;
+
+	site = &state->sites[(live->stack <= LOG_MALLOC_STACK_TABLE_SIZE) ? live->stack : 0];
+	if(site->blocks == 0)
+	{
+		site->stack = live->stack;
+		site->oldest = live->timestamp;
+	}
+	else if(live->timestamp < site->oldest)
+		site->oldest = live->timestamp;
+
+	site->bytes += live->size;
+	site->blocks++;
+	state->bytes += live->size;
+	state->blocks++;
+	return;
+}
+
+/* copy block out of stripe */
+static void live_copy(const void *rec, void *arg)
+{
+	struct log_malloc_live_s **copy = arg;
+
+	*(*copy)++ = *(const struct log_malloc_live_s *)rec;
+	return;
+}
+
+/*
+ *  INTERNAL API FUNCTIONS
+ */
+int log_malloc_live_init(const char *size, const char *sig)
+{
+	char *end = NULL;
+	size_t val;
+	size_t sz;
+	log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	if(size == NULL || size[0] == '\0' || strcmp(size, "0") == 0)
+		return 0;
+
+	/* table size in blocks, or default */
+	val = strtoul(size, &end, 10);
+	if(end && (*end == 'k' || *end == 'K'))
+		val <<= 10;
+	else if(end && (*end == 'm' || *end == 'M'))
+		val <<= 20;
+	if(val <= 1)
+		val = LOG_MALLOC_LIVE_TABLE_SIZE;
+
+	if(log_malloc_stack_table() != 0)
+		return -1;
+
+	/* fixed size stripes, blocks over capacity are dropped */
+	for(sz = LOG_MALLOC_HASH_STRIPES; sz < val; sz <<= 1);
+	log_malloc_hash_init(&g_live.hash, sizeof(struct log_malloc_live_s),
+		sz / LOG_MALLOC_HASH_STRIPES, false);
+
+	/* snapshot goes to stderr if there is no trace */
+	if(ctx->memlog_disabled)
+		g_live.fd = STDERR_FILENO;
+
+	if(sig && sig[0] != '\0')
+	{
+		struct sigaction sa;
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = live_signal;
+		sa.sa_flags = SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+
+		if(sigaction(atoi(sig), &sa, NULL) != 0)
+			fprintf(stderr, "\n*** log-malloc: could not install heap snapshot signal %s\n\n",
+				sig);
+	}
+
+	ctx->live_table = true;
+	return 1;
+}
+
+void log_malloc_live_atfork_child(void)
+{
+	log_malloc_hash_atfork_child(&g_live.hash);
+	return;
+}
+
+/* add block to table */
+void log_malloc_live_add(const void *ptr, size_t size, uint32_t stack)
+{
+	struct log_malloc_live_s live;
+
+	live.ptr = (uintptr_t)ptr;
+	live.size = size;
+	live.timestamp = log_malloc_timestamp();
+	live.stack = stack;
+	live.reserved = 0;
+
+	if(!log_malloc_hash_add(&g_live.hash, &live))
+		(void)__sync_fetch_and_add(&g_live.dropped, 1);
+	return;
+}
+
+/* remove block from table (not found if dropped) */
+void log_malloc_live_del(const void *ptr)
+{
+	(void)log_malloc_hash_del(&g_live.hash, (uintptr_t)ptr, NULL);
+	return;
+}
+
+/** write heap snapshot (outstanding blocks grouped by call site)
+ * @param	fd	output fd, -1 for trace fd
+ * @param	async	called from signal handler (busy stripes are skipped)
+ * @param	max	max. call sites written, biggest first (0 - all)
+ * @return	number of call sites, -1 on error
+ */
+int log_malloc_live_snapshot(int fd, bool async, size_t max)
+{
+	int ii;
+	int s, w;
+	size_t jj;
+	size_t nsites = 0;
+	size_t skipped = 0;
+	uint64_t now;
+	char buf[256 + 24 * LOG_MALLOC_BACKTRACE_MAX];
+	size_t map_size;
+	struct log_malloc_site_s *sites;
+	struct log_malloc_sites_s state = { NULL, 0, 0 };
+
+	if(!log_malloc_ctx_get()->live_table)
+		return -1;
+
+	if(fd == -1)
+		fd = g_live.fd;
+
+	/* site per stack id (0 - unknown stack) */
+	map_size = sizeof(*sites) * (LOG_MALLOC_STACK_TABLE_SIZE + 1);
+	sites = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(sites == MAP_FAILED)
+		return -1;
+	state.sites = sites;
+
+	now = log_malloc_timestamp();
+	for(ii = 0; ii < LOG_MALLOC_HASH_STRIPES; ii++)
+	{
+		if(log_malloc_hash_walk(&g_live.hash, ii, (async) ? LIVE_SIGNAL_SPINS : 0,
+				live_site, &state) == -1)
+			skipped++;
+	}
+
+	/* compact sites to array begin */
+	for(nsites = 0, jj = 0; jj <= LOG_MALLOC_STACK_TABLE_SIZE; jj++)
+	{
+		if(sites[jj].blocks == 0)
+			continue;
+		sites[nsites++] = sites[jj];
+	}
+
+	/* shell sort by bytes, biggest first (no qsort, it might allocate) */
+	{
+		size_t gap, kk;
+
+		for(gap = nsites / 2; gap > 0; gap /= 2)
+			for(jj = gap; jj < nsites; jj++)
+			{
+				const struct log_malloc_site_s tmp = sites[jj];
+
+				for(kk = jj; kk >= gap && sites[kk - gap].bytes < tmp.bytes; kk -= gap)
+					sites[kk] = sites[kk - gap];
+				sites[kk] = tmp;
+			}
+	}
+
+	s = snprintf(buf, sizeof(buf), "# HEAP-SNAPSHOT sites=%zu blocks=%" PRIu64 " bytes=%" PRIu64
+			" dropped=%zu skipped=%zu\n",
+			nsites, state.blocks, state.bytes, g_live.dropped, skipped);
+	w = live_write(fd, buf, s);
+
+	if(max && max < nsites)
+		nsites = max;
+
+	for(jj = 0; jj < nsites; jj++)
+	{
+		int nframes;
+		uint64_t frames[LOG_MALLOC_BACKTRACE_MAX];
+
+		s = snprintf(buf, sizeof(buf), "# HEAP-SITE bytes=%" PRIu64 " blocks=%" PRIu64
+				" age=%" PRIu64 ".%03" PRIu64 " @%u\n",
+				sites[jj].bytes, sites[jj].blocks,
+				(now - sites[jj].oldest) / UINT64_C(1000000000),
+				((now - sites[jj].oldest) / UINT64_C(1000000)) % 1000,
+				sites[jj].stack);
+
+		nframes = log_malloc_stack_get(sites[jj].stack, frames, LOG_MALLOC_BACKTRACE_MAX);
+		for(ii = 0; ii < nframes && s < sizeof(buf) - 24; ii++)
+			s += snprintf(buf + s, sizeof(buf) - s, "[0x%" PRIx64 "]\n", frames[ii]);
+		w = live_write(fd, buf, s);
+	}
+
+	munmap(sites, map_size);
+	return nsites;
+}
+
+/** write all outstanding blocks
+ * @param	fd	output fd
+ * @return	number of blocks, -1 on error
+ * @note	stripes are copied out first, slow reader does not block allocations
+ */
+int64_t log_malloc_live_dump(int fd)
+{
+	int ii;
+	int s, w;
+	size_t jj;
+	size_t used = 0;
+	int64_t blocks = 0;
+	uint64_t now;
+	char buf[4096];
+	size_t map_size;
+	struct log_malloc_live_s *copy;
+
+	if(!log_malloc_ctx_get()->live_table)
+		return -1;
+
+	map_size = sizeof(*copy) * g_live.hash.slots;
+	copy = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(copy == MAP_FAILED)
+		return -1;
+
+	s = snprintf(buf, sizeof(buf), "# HEAP-DUMP dropped=%zu\n", g_live.dropped);
+	w = write(fd, buf, s);
+
+	for(ii = 0; ii < LOG_MALLOC_HASH_STRIPES; ii++)
+	{
+		struct log_malloc_live_s *end = copy;
+		size_t count;
+
+		(void)log_malloc_hash_walk(&g_live.hash, ii, 0, live_copy, &end);
+		count = end - copy;
+
+		now = log_malloc_timestamp();
+		for(jj = 0; jj < count; jj++)
+		{
+			/* flush, if next line might not fit */
+			if(used > sizeof(buf) - 128)
+			{
+				if(write(fd, buf, used) != used)
+				{
+					munmap(copy, map_size);
+					return -1;
+				}
+				used = 0;
+			}
+
+			used += snprintf(buf + used, sizeof(buf) - used, "# HEAP-BLOCK 0x%" PRIx64
+				" size=%" PRIu64 " age=%" PRIu64 ".%03" PRIu64 " @%u\n",
+				copy[jj].ptr, copy[jj].size,
+				(now - copy[jj].timestamp) / UINT64_C(1000000000),
+				((now - copy[jj].timestamp) / UINT64_C(1000000)) % 1000,
+				copy[jj].stack);
+		}
+		blocks += count;
+	}
+
+	if(used && write(fd, buf, used) != used)
+		blocks = -1;
+
+	munmap(copy, map_size);
+	return blocks;
+}
+
+/* EOF */
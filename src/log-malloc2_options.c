@@ -0,0 +1,218 @@
+/*
+ * log-malloc2 runtime options
+ *	LOG_MALLOC_OPTIONS="key=value,key=value,..." parser, every key can be
+ *	also given (and overridden) by LOG_MALLOC_<KEY> environment variable.
+ *	Runs from first malloc call, so it never allocates.
+ *
+ * Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+ *
+ * License: GNU LGPLv3 (http://www.gnu.org/licenses/lgpl.html)
+ *
+ * Web:
+ *	http://devel.dob.sk/log-malloc2
+ *	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+ *	https://github.com/samsk/log-malloc2 (git repo)
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "log-malloc2.h"
+#include "log-malloc2_internal.h"
+
+#define ENV_PREFIX		"LOG_MALLOC_"
+
+/* known options (key is env variable name without prefix, lowercase, '-' for '_') */
+static const char *const g_known[] = {
+	"fd", "depth", "unwind", "statm", "statm-cache", "statm-path", "maps-path", "format",
+	"free-stack", "free-batch", "call-count", "tid", "buffer", "buffer-overflow", "stack-intern",
+	"sample", "counters", "live", "live-signal", "histogram",
+	"histogram-signal", "series", "thread-quota", "passthrough", "passthrough-signal",
+	"headerless", "query",
+	NULL
+};
+
+/* parsed options, copied to static pool (environment stays untouched) */
+static struct {
+	int count;
+	size_t used;
+	struct {
+		const char *key;
+		size_t key_len;
+		const char *value;
+	} opts[LOG_MALLOC_OPTIONS_MAX];
+	char pool[LOG_MALLOC_OPTIONS_SIZE];
+} g_opts;
+
+static inline bool option_sep(char c)
+{
+	return (c == ',' || c == ' ' || c == '\t' || c == '\n');
+}
+
+/* compare env variable name suffix with option key (case and '_'/'-' insensitive) */
+static bool option_match(const char *name, const char *key, size_t key_len)
+{
+	size_t ii;
+
+	for(ii = 0; ii < key_len; ii++)
+	{
+		char n = name[ii];
+		char k = key[ii];
+
+		if(n == '\0')
+			return false;
+		if(n == '_')
+			n = '-';
+		if(k == '_')
+			k = '-';
+		if(n >= 'A' && n <= 'Z')
+			n += 'a' - 'A';
+		if(k >= 'A' && k <= 'Z')
+			k += 'a' - 'A';
+		if(n != k)
+			return false;
+	}
+	return (name[key_len] == '\0');
+}
+
+static bool option_known(const char *key, size_t key_len)
+{
+	int ii;
+
+	for(ii = 0; g_known[ii] != NULL; ii++)
+		if(strlen(g_known[ii]) == key_len && option_match(g_known[ii], key, key_len))
+			return true;
+	return false;
+}
+
+/*
+ *  INTERNAL API FUNCTIONS
+ */
+
+/** parse options string (key=value pairs separated by ',' or space)
+ * @note	key without value means 'key=1'
+ * @return	number of options parsed, -1 if some option is invalid
+ */
+int log_malloc_options_init(const char *options)
+{
+	int ret = 0;
+	const char *p = options;
+
+	if(options == NULL)
+		return 0;
+
+	while(*p != '\0')
+	{
+		const char *key, *value;
+		size_t key_len, value_len;
+
+		while(option_sep(*p))
+			p++;
+		if(*p == '\0')
+			break;
+
+		for(key = p; *p != '\0' && *p != '=' && !option_sep(*p); p++);
+		key_len = p - key;
+
+		if(*p == '=')
+		{
+			for(value = ++p; *p != '\0' && !option_sep(*p); p++);
+			value_len = p - value;
+		}
+		else
+		{
+			value = "1";
+			value_len = 1;
+		}
+
+		if(!option_known(key, key_len))
+		{
+			fprintf(stderr, "\n*** log-malloc: unknown option '%.*s'\n\n", (int)key_len, key);
+			ret = -1;
+			continue;
+		}
+
+		if(g_opts.count == LOG_MALLOC_OPTIONS_MAX
+			|| g_opts.used + key_len + value_len + 2 > sizeof(g_opts.pool))
+		{
+			fprintf(stderr, "\n*** log-malloc: too many options\n\n");
+			return -1;
+		}
+
+		/* key\0value\0 */
+		g_opts.opts[g_opts.count].key = g_opts.pool + g_opts.used;
+		g_opts.opts[g_opts.count].key_len = key_len;
+		memcpy(g_opts.pool + g_opts.used, key, key_len);
+		g_opts.used += key_len;
+		g_opts.pool[g_opts.used++] = '\0';
+
+		g_opts.opts[g_opts.count].value = g_opts.pool + g_opts.used;
+		memcpy(g_opts.pool + g_opts.used, value, value_len);
+		g_opts.used += value_len;
+		g_opts.pool[g_opts.used++] = '\0';
+		g_opts.count++;
+	}
+	return (ret == 0) ? g_opts.count : ret;
+}
+
+/** get option value
+ * @param	name	environment variable (LOG_MALLOC_<KEY>), it has precedence
+ * @return	value, NULL if option is not set
+ */
+const char *log_malloc_options_get(const char *name)
+{
+	int ii;
+	const char *val;
+
+	if((val = getenv(name)) != NULL)
+		return val;
+
+	if(strncmp(name, ENV_PREFIX, sizeof(ENV_PREFIX) - 1) != 0)
+		return NULL;
+	name += sizeof(ENV_PREFIX) - 1;
+
+	/* last one wins */
+	for(ii = g_opts.count - 1; ii >= 0; ii--)
+		if(option_match(name, g_opts.opts[ii].key, g_opts.opts[ii].key_len))
+			return g_opts.opts[ii].value;
+	return NULL;
+}
+
+/** get numeric option value
+ * @return	value clamped to given range, or default if option is not set
+ */
+long log_malloc_options_int(const char *name, long def, long min, long max)
+{
+	long val;
+	char *end = NULL;
+	const char *str = log_malloc_options_get(name);
+
+	if(str == NULL || str[0] == '\0')
+		return def;
+
+	val = strtol(str, &end, 10);
+	if(end == str || *end != '\0')
+	{
+		fprintf(stderr, "\n*** log-malloc: invalid value of %s '%s'\n\n", name, str);
+		return def;
+	}
+
+	if(val < min)
+		val = min;
+	else if(val > max)
+		val = max;
+	return val;
+}
+
+/* EOF */
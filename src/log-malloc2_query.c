@@ -0,0 +1,433 @@
+/*
+ * log-malloc2 live query socket
+ *	UNIX domain socket served by background thread, answers queries for
+ *	usage counters, histograms, top call sites and live heap dump of
+ *	running process (line protocol, replies are in trace comment format).
+ *
+ * Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+ *
+ * License: GNU LGPLv3 (http://www.gnu.org/licenses/lgpl.html)
+ *
+ * Web:
+ *	http://devel.dob.sk/log-malloc2
+ *	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+ *	https://github.com/samsk/log-malloc2 (git repo)
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "log-malloc2.h"
+#include "log-malloc2_internal.h"
+
+/* max. query line length */
+#define QUERY_LINE_MAX		256
+
+/* server state */
+static struct {
+	int fd;			/* listening socket, -1 - disabled */
+	volatile int client;	/* connected client, -1 - none */
+	bool running;
+	volatile sig_atomic_t stop;
+	struct sockaddr_un addr;
+	socklen_t addr_len;
+#ifdef HAVE_LIBPTHREAD
+	pthread_t thread;
+#endif
+} g_query = { -1, -1, false, 0 };
+
+static bool query_write(int fd, const char *data, size_t len)
+{
+	while(len > 0)
+	{
+		const ssize_t n = write(fd, data, len);
+
+		if(n < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return false;
+		}
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+/* # COUNTERS [USED:RUSED] malloc=N calloc=N ... free=N */
+static bool query_counters(int fd)
+{
+	int s;
+	char buf[512];
+	log_malloc_counters_t sum;
+
+	log_malloc_counters_sum(&sum);
+	s = snprintf(buf, sizeof(buf), "# COUNTERS [%" PRId64 ":%" PRId64 "] malloc=%" PRIu64
+			" calloc=%" PRIu64 " realloc=%" PRIu64 " memalign=%" PRIu64 "/%" PRIu64
+			" valloc=%" PRIu64 " free=%" PRIu64 "\n",
+			sum.mem_used, sum.mem_rused,
+			sum.stat.malloc, sum.stat.calloc, sum.stat.realloc,
+			sum.stat.memalign, sum.stat.posix_memalign,
+			sum.stat.valloc, sum.stat.free);
+	return query_write(fd, buf, s);
+}
+
+/* # STACK @ID + frames */
+static bool query_stack(int fd, const char *arg)
+{
+	int ii;
+	int s;
+	int nframes;
+	const uint32_t id = strtoul(arg, NULL, 10);
+	uint64_t frames[LOG_MALLOC_BACKTRACE_MAX];
+	char buf[64 + 24 * LOG_MALLOC_BACKTRACE_MAX];
+
+	nframes = log_malloc_stack_get(id, frames, LOG_MALLOC_BACKTRACE_MAX);
+	if(nframes == 0)
+		return false;
+
+	s = snprintf(buf, sizeof(buf), "# STACK @%u\n", id);
+	for(ii = 0; ii < nframes; ii++)
+		s += snprintf(buf + s, sizeof(buf) - s, "[0x%" PRIx64 "]\n", frames[ii]);
+	(void)query_write(fd, buf, s);
+	return true;
+}
+
+/** execute single query, reply is terminated by '# OK' or '# ERROR <reason>' line
+ * @return	false if reply could not be written (client is gone)
+ */
+static bool query_exec(int fd, char *cmd)
+{
+	int s;
+	char *arg;
+	char buf[QUERY_LINE_MAX + 32];
+	const char *err = NULL;
+	const log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	/* split query and argument */
+	for(arg = cmd; *arg != '\0' && *arg != ' ' && *arg != '\t' && *arg != '\r'; arg++);
+	while(*arg == ' ' || *arg == '\t' || *arg == '\r')
+		*arg++ = '\0';
+
+	if(cmd[0] == '\0')
+		return true;
+	else if(strcmp(cmd, "counters") == 0)
+		(void)query_counters(fd);
+	else if(strcmp(cmd, "histogram") == 0)
+	{
+		if(!ctx->histogram)
+			err = "histograms disabled (LOG_MALLOC_HISTOGRAM)";
+		else
+			(void)log_malloc_histogram_write(fd);
+	}
+	else if(strcmp(cmd, "top") == 0)
+	{
+		const long max = (*arg != '\0') ? strtol(arg, NULL, 10) : LOG_MALLOC_QUERY_TOP;
+
+		if(!ctx->live_table)
+			err = "live table disabled (LOG_MALLOC_LIVE)";
+		else if(log_malloc_live_snapshot(fd, false, (max > 0) ? max : 0) < 0)
+			err = "snapshot failed";
+	}
+	else if(strcmp(cmd, "heap") == 0)
+	{
+		if(!ctx->live_table)
+			err = "live table disabled (LOG_MALLOC_LIVE)";
+		else if(log_malloc_live_dump(fd) < 0)
+			err = "dump failed";
+	}
+	else if(strcmp(cmd, "stack") == 0)
+	{
+		if(!query_stack(fd, arg))
+			err = "unknown stack";
+	}
+	else
+		err = "unknown query";
+
+	if(err)
+		s = snprintf(buf, sizeof(buf), "# ERROR %s\n", err);
+	else
+		s = snprintf(buf, sizeof(buf), "# OK\n");
+	return query_write(fd, buf, s);
+}
+
+/* check that client runs as same user (or root), heap dump exposes addresses */
+static bool query_peer_allowed(int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+		return false;
+	return (cred.uid == 0 || cred.uid == geteuid());
+}
+
+/* serve connected client, queries are executed one per line */
+static void query_serve(int fd)
+{
+	int s;
+	size_t len = 0;
+	char line[QUERY_LINE_MAX];
+	const struct timeval tv = { LOG_MALLOC_QUERY_TIMEOUT, 0 };
+
+	/* stalled client does not block other clients forever */
+	(void)setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	(void)setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	if(!query_peer_allowed(fd))
+	{
+		(void)query_write(fd, "# ERROR permission denied\n", 26);
+		return;
+	}
+
+	s = snprintf(line, sizeof(line), "# PID %u\n", getpid());
+	if(!query_write(fd, line, s))
+		return;
+
+	while(!g_query.stop)
+	{
+		char *nl;
+		const ssize_t n = read(fd, line + len, sizeof(line) - 1 - len);
+
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return;
+
+		len += n;
+		line[len] = '\0';
+
+		while((nl = memchr(line, '\n', len)) != NULL)
+		{
+			const size_t used = nl - line + 1;
+
+			*nl = '\0';
+			if(!query_exec(fd, line))
+				return;
+
+			memmove(line, line + used, len - used);
+			len -= used;
+			line[len] = '\0';
+		}
+
+		if(len == sizeof(line) - 1)
+		{
+			(void)query_write(fd, "# ERROR query too long\n", 23);
+			return;
+		}
+	}
+	return;
+}
+
+#ifdef HAVE_LIBPTHREAD
+static void *query_thread(void *arg)
+{
+	sigset_t set;
+
+	/* signals are for application threads (SIGPIPE of gone client too) */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	while(!g_query.stop)
+	{
+		const int fd = accept4(g_query.fd, NULL, NULL, SOCK_CLOEXEC);
+
+		if(fd == -1)
+		{
+			if(errno == EINTR || errno == ECONNABORTED)
+				continue;
+			/* socket shut down by fini */
+			break;
+		}
+
+		g_query.client = fd;
+		if(!g_query.stop)
+			query_serve(fd);
+		g_query.client = -1;
+		close(fd);
+	}
+	return NULL;
+}
+#endif
+
+/* bind socket, stale socket file of dead process is replaced */
+static int query_bind(int fd)
+{
+	int tmp;
+
+	if(bind(fd, (struct sockaddr *)&g_query.addr, g_query.addr_len) == 0)
+		return 0;
+
+	/* abstract socket, or socket in use */
+	if(errno != EADDRINUSE || g_query.addr.sun_path[0] == '\0')
+		return -1;
+
+	tmp = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(tmp == -1)
+		return -1;
+	if(connect(tmp, (struct sockaddr *)&g_query.addr, g_query.addr_len) == 0
+		|| errno != ECONNREFUSED)
+	{
+		close(tmp);
+		errno = EADDRINUSE;
+		return -1;
+	}
+	close(tmp);
+
+	unlink(g_query.addr.sun_path);
+	return bind(fd, (struct sockaddr *)&g_query.addr, g_query.addr_len);
+}
+
+/*
+ *  INTERNAL API FUNCTIONS
+ */
+
+/** create query socket
+ * @param	path	socket path ('%p' is replaced by pid, '@' prefix - abstract socket)
+ * @note	server thread is started by log_malloc_query_start()
+ */
+int log_malloc_query_init(const char *path)
+{
+#ifdef HAVE_LIBPTHREAD
+	int fd;
+	size_t len = 0;
+	const size_t max = sizeof(g_query.addr.sun_path) - 1;
+
+	if(path == NULL || path[0] == '\0')
+		return 0;
+
+	memset(&g_query.addr, 0, sizeof(g_query.addr));
+	g_query.addr.sun_family = AF_UNIX;
+	for(; *path != '\0' && len < max; path++)
+	{
+		if(path[0] == '%' && path[1] == 'p')
+		{
+			len += snprintf(g_query.addr.sun_path + len, max + 1 - len, "%u", getpid());
+			path++;
+		}
+		else
+			g_query.addr.sun_path[len++] = *path;
+	}
+
+	if(*path != '\0' || len > max)
+	{
+		fprintf(stderr, "\n*** log-malloc: query socket path too long\n\n");
+		return -1;
+	}
+
+	/* abstract namespace, name is not NUL terminated */
+	if(g_query.addr.sun_path[0] == '@')
+		g_query.addr.sun_path[0] = '\0';
+	g_query.addr_len = offsetof(struct sockaddr_un, sun_path) + len
+			+ (g_query.addr.sun_path[0] != '\0');
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd == -1 || query_bind(fd) != 0 || listen(fd, 8) != 0)
+	{
+		fprintf(stderr, "\n*** log-malloc: could not create query socket %s%s (%s)\n\n",
+			(g_query.addr.sun_path[0] == '\0') ? "@" : "",
+			g_query.addr.sun_path + (g_query.addr.sun_path[0] == '\0'),
+			strerror(errno));
+		if(fd != -1)
+			close(fd);
+		return -1;
+	}
+
+	/* owner only (peer credentials are checked too) */
+	if(g_query.addr.sun_path[0] != '\0')
+		(void)chmod(g_query.addr.sun_path, S_IRUSR | S_IWUSR);
+
+	g_query.fd = fd;
+	return 1;
+#else
+	if(path == NULL || path[0] == '\0')
+		return 0;
+
+	fprintf(stderr, "\n*** log-malloc: query socket needs pthreads\n\n");
+	return -1;
+#endif
+}
+
+int log_malloc_query_start(void)
+{
+#ifdef HAVE_LIBPTHREAD
+	if(g_query.fd == -1 || g_query.running)
+		return 0;
+
+	if(pthread_create(&g_query.thread, NULL, query_thread, NULL) != 0)
+	{
+		fprintf(stderr, "\n*** log-malloc: could not start query socket thread\n\n");
+		return -1;
+	}
+
+	g_query.running = true;
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+void log_malloc_query_atfork_child(void)
+{
+	/* server thread is gone, socket belongs to parent */
+	if(g_query.client != -1)
+		close(g_query.client);
+	if(g_query.fd != -1)
+		close(g_query.fd);
+
+	g_query.client = -1;
+	g_query.fd = -1;
+	g_query.running = false;
+	return;
+}
+
+/* stop server thread and remove socket */
+void log_malloc_query_fini(void)
+{
+	int client;
+
+	if(g_query.fd == -1)
+		return;
+
+	g_query.stop = 1;
+
+	/* wake up accept() and read() of served client */
+	shutdown(g_query.fd, SHUT_RDWR);
+	if((client = g_query.client) != -1)
+		shutdown(client, SHUT_RDWR);
+
+#ifdef HAVE_LIBPTHREAD
+	if(g_query.running)
+	{
+		pthread_join(g_query.thread, NULL);
+		g_query.running = false;
+	}
+#endif
+
+	close(g_query.fd);
+	if(g_query.addr.sun_path[0] != '\0')
+		unlink(g_query.addr.sun_path);
+	g_query.fd = -1;
+	return;
+}
+
+/* EOF */
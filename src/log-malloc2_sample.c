@@ -0,0 +1,117 @@
+/*
+ * log-malloc2 allocation sampling
+ *	Poisson byte-interval sampling, allocation is traced with probability
+ *	proportional to its size (average one sample per interval bytes).
+ *
+ * Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+ *
+ * License: GNU LGPLv3 (http://www.gnu.org/licenses/lgpl.html)
+ *
+ * Web:
+ *	http://devel.dob.sk/log-malloc2
+ *	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+ *	https://github.com/samsk/log-malloc2 (git repo)
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "log-malloc2.h"
+#include "log-malloc2_internal.h"
+
+__thread int64_t log_malloc_sample_left = 0;
+
+static __thread uint64_t t_rand = 0;
+
+/* xorshift64* */
+static inline uint64_t sample_rand(void)
+{
+	if(t_rand == 0)
+		t_rand = (log_malloc_timestamp() ^ ((uint64_t)log_malloc_gettid() << 32)) | 1;
+
+	t_rand ^= t_rand >> 12;
+	t_rand ^= t_rand << 25;
+	t_rand ^= t_rand >> 27;
+	return t_rand * 0x2545F4914F6CDD1DULL;
+}
+
+/* natural logarithm of x in (0, 1], good enough for sampling
+ *	(no libm, x = m * 2^e, ln(m) via atanh series)
+ */
+static inline double sample_ln(double x)
+{
+	int e = 0;
+	double s, s2;
+
+	while(x < 0.5)
+	{
+		x *= 2.0;
+		e--;
+	}
+
+	s  = (x - 1.0) / (x + 1.0);
+	s2 = s * s;
+	return e * 0.69314718055994531
+		+ 2.0 * s * (1.0 + s2 * (1.0 / 3 + s2 * (1.0 / 5 + s2 * (1.0 / 7 + s2 / 9))));
+}
+
+/* next sampling interval, exponentially distributed with configured mean */
+static inline int64_t sample_next(size_t mean)
+{
+	/* uniform (0, 1] */
+	const double u = ((sample_rand() >> 11) + 1) * (1.0 / 9007199254740992.0);
+	const double next = -sample_ln(u) * mean;
+
+	return (next < 1.0) ? 1 : (int64_t)next;
+}
+
+/*
+ *  INTERNAL API FUNCTIONS
+ */
+int log_malloc_sample_init(const char *interval)
+{
+	char *end = NULL;
+	size_t val;
+	log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	if(interval == NULL || interval[0] == '\0')
+		return 0;
+
+	val = strtoul(interval, &end, 10);
+	if(end && (*end == 'k' || *end == 'K'))
+		val <<= 10;
+	else if(end && (*end == 'm' || *end == 'M'))
+		val <<= 20;
+
+	ctx->sample_interval = val;
+	return (val != 0);
+}
+
+/* slow path of log_malloc_sample(), sampling interval has been crossed */
+bool log_malloc_sample_hit(size_t size)
+{
+	const log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	/* first allocation in thread, pick initial interval */
+	if(t_rand == 0)
+	{
+		log_malloc_sample_left = sample_next(ctx->sample_interval) - size;
+		if(log_malloc_sample_left > 0)
+			return false;
+	}
+
+	log_malloc_sample_left = sample_next(ctx->sample_interval);
+	return true;
+}
+
+/* EOF */
@@ -0,0 +1,230 @@
+/*
+ * log-malloc2 usage time series
+ *	Aggregate only mode, background thread writes memory usage, call count
+ *	deltas and /proc/self/statm at fixed interval, events are not traced.
+ *
+ * Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+ *
+ * License: GNU LGPLv3 (http://www.gnu.org/licenses/lgpl.html)
+ *
+ * Web:
+ *	http://devel.dob.sk/log-malloc2
+ *	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+ *	https://github.com/samsk/log-malloc2 (git repo)
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#include "log-malloc2.h"
+#include "log-malloc2_internal.h"
+
+/* sampler state */
+static struct {
+	uint64_t interval;	/* ns, 0 - disabled */
+	uint64_t start;		/* sample times are relative to it */
+	bool running;
+	volatile sig_atomic_t stop;
+	struct log_malloc_stat_s last;	/* call counts of previous sample */
+#ifdef HAVE_LIBPTHREAD
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+#endif
+} g_series = { 0, 0, false, 0, {0, 0, 0, 0, 0, 0, 0, 0},
+#ifdef HAVE_LIBPTHREAD
+	0, PTHREAD_MUTEX_INITIALIZER,
+#endif
+};
+
+/* write single sample line
+ * # USAGE SEC.MSEC [USED:RUSED] malloc=N calloc=N ... free=N #STATM
+ */
+static void series_sample(void)
+{
+	int s, w;
+	uint64_t now;
+	log_malloc_counters_t sum;
+	char buf[512];
+	const log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	now = log_malloc_timestamp() - g_series.start;
+	log_malloc_counters_sum(&sum);
+
+	s = snprintf(buf, sizeof(buf) - 128, "# USAGE %" PRIu64 ".%03" PRIu64
+			" [%" PRId64 ":%" PRId64 "] malloc=%" PRIu64 " calloc=%" PRIu64 " realloc=%" PRIu64
+			" memalign=%" PRIu64 "/%" PRIu64 " valloc=%" PRIu64 " free=%" PRIu64 "\n",
+			now / UINT64_C(1000000000), (now / UINT64_C(1000000)) % 1000,
+			sum.mem_used, sum.mem_rused,
+			sum.stat.malloc - g_series.last.malloc,
+			sum.stat.calloc - g_series.last.calloc,
+			sum.stat.realloc - g_series.last.realloc,
+			sum.stat.memalign - g_series.last.memalign,
+			sum.stat.posix_memalign - g_series.last.posix_memalign,
+			sum.stat.valloc - g_series.last.valloc,
+			sum.stat.free - g_series.last.free);
+	g_series.last = sum.stat;
+
+	/* statm, as in trace records */
+	if(ctx->statm_fd != -1)
+	{
+		ssize_t n;
+
+		buf[s - 1] = ' ';
+		buf[s++]   = '#';
+		n = pread(ctx->statm_fd, buf + s, sizeof(buf) - s - 1, 0);
+		s += (n > 0) ? n : 0;
+		if(buf[s - 1] != '\n')
+			buf[s++] = '\n';
+	}
+
+	w = log_malloc_write_text(ctx, buf, s);
+	return;
+}
+
+#ifdef HAVE_LIBPTHREAD
+static void *series_thread(void *arg)
+{
+	struct timespec ts;
+
+	/* absolute deadlines, sampling does not drift */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	pthread_mutex_lock(&g_series.lock);
+	while(!g_series.stop)
+	{
+		ts.tv_sec  += g_series.interval / 1000000000ULL;
+		ts.tv_nsec += g_series.interval % 1000000000ULL;
+		if(ts.tv_nsec >= 1000000000L)
+		{
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+
+		while(!g_series.stop
+			&& pthread_cond_timedwait(&g_series.cond, &g_series.lock, &ts) != ETIMEDOUT);
+
+		if(!g_series.stop)
+			series_sample();
+	}
+	pthread_mutex_unlock(&g_series.lock);
+	return NULL;
+}
+#endif
+
+/*
+ *  INTERNAL API FUNCTIONS
+ */
+
+/** enable aggregate only mode
+ * @param	interval	sample interval in ms (or with 's' suffix in seconds)
+ * @note	must be called after trace header is written, disables event trace
+ */
+int log_malloc_series_init(const char *interval)
+{
+	char *end = NULL;
+	uint64_t val;
+	log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	if(interval == NULL || interval[0] == '\0')
+		return 0;
+
+	val = strtoull(interval, &end, 10);
+	if(end && *end == 's')
+		val *= 1000;
+	if(val == 0)
+		return 0;
+
+	if(ctx->memlog_disabled)
+	{
+		fprintf(stderr, "\n*** log-malloc: usage time series needs trace fd\n\n");
+		return -1;
+	}
+
+	g_series.interval = val * 1000000ULL;
+	g_series.start = log_malloc_timestamp();
+
+	/* aggregate only, no per-event trace */
+	ctx->memlog_disabled = true;
+	return 1;
+}
+
+int log_malloc_series_start(void)
+{
+#ifdef HAVE_LIBPTHREAD
+	pthread_condattr_t attr;
+
+	if(g_series.interval == 0 || g_series.running)
+		return 0;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&g_series.cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	if(pthread_create(&g_series.thread, NULL, series_thread, NULL) != 0)
+	{
+		fprintf(stderr, "\n*** log-malloc: could not start usage time series thread\n\n");
+		return -1;
+	}
+
+	g_series.running = true;
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+void log_malloc_series_atfork_child(void)
+{
+#ifdef HAVE_LIBPTHREAD
+	/* sampler thread is gone, child is not sampled */
+	if(g_series.running)
+	{
+		pthread_mutex_init(&g_series.lock, NULL);
+		g_series.running = false;
+	}
+#endif
+	g_series.interval = 0;
+	return;
+}
+
+/* stop sampler, last sample is written at exit */
+void log_malloc_series_fini(void)
+{
+	if(g_series.interval == 0)
+		return;
+
+#ifdef HAVE_LIBPTHREAD
+	if(g_series.running)
+	{
+		pthread_mutex_lock(&g_series.lock);
+		g_series.stop = 1;
+		pthread_cond_signal(&g_series.cond);
+		pthread_mutex_unlock(&g_series.lock);
+
+		pthread_join(g_series.thread, NULL);
+		g_series.running = false;
+	}
+#endif
+
+	series_sample();
+	g_series.interval = 0;
+	return;
+}
+
+/* EOF */
@@ -0,0 +1,191 @@
+/*
+ * log-malloc2 stack interning
+ *	Allocation-free table of unique backtraces, every unique backtrace is
+ *	written once (# STACK <id>) and referenced by its id afterwards.
+ *
+ * Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+ *
+ * License: GNU LGPLv3 (http://www.gnu.org/licenses/lgpl.html)
+ *
+ * Web:
+ *	http://devel.dob.sk/log-malloc2
+ *	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+ *	https://github.com/samsk/log-malloc2 (git repo)
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	1
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "log-malloc2.h"
+#include "log-malloc2_internal.h"
+
+/* max. probes before giving up (table too full) */
+#define STACK_PROBES	32
+
+struct log_malloc_stack_s {
+	volatile uint64_t hash;		/* 0 - empty slot */
+	volatile uint32_t id;		/* 0 - not yet published */
+	volatile uint16_t logged;	/* definition written to trace */
+	uint16_t nframes;
+	uint64_t frames[LOG_MALLOC_BACKTRACE_MAX];
+};
+
+static struct log_malloc_stack_s *g_stacks = NULL;
+static uint32_t *g_stack_index = NULL;		/* id -> slot */
+static volatile uint32_t g_stack_id = 0;
+
+/* FNV-1a over frame addresses */
+static inline uint64_t stack_hash(const uint64_t *frames, int nframes)
+{
+	int ii;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for(ii = 0; ii < nframes; ii++)
+	{
+		hash ^= frames[ii];
+		hash *= 0x100000001b3ULL;
+	}
+	hash ^= nframes;
+
+	/* 0 marks empty slot */
+	return (hash) ? hash : 1;
+}
+
+/*
+ *  INTERNAL API FUNCTIONS
+ */
+int log_malloc_stack_table(void)
+{
+	if(g_stacks != NULL)
+		return 0;
+
+	/* mmap, to not recurse into malloc (pages are touched on use) */
+	g_stacks = mmap(NULL, sizeof(*g_stacks) * LOG_MALLOC_STACK_TABLE_SIZE
+			+ sizeof(*g_stack_index) * (LOG_MALLOC_STACK_TABLE_SIZE + 1),
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+			-1, 0);
+	if(g_stacks == MAP_FAILED)
+	{
+		g_stacks = NULL;
+		fprintf(stderr, "\n*** log-malloc: could not allocate stack table\n\n");
+		return -1;
+	}
+
+	g_stack_index = (uint32_t *)&g_stacks[LOG_MALLOC_STACK_TABLE_SIZE];
+	return 0;
+}
+
+int log_malloc_stack_init(const char *enable)
+{
+	log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	if(enable == NULL || enable[0] == '\0' || enable[0] == '0')
+		return 0;
+
+	if(log_malloc_stack_table() != 0)
+		return -1;
+
+	ctx->stack_intern = true;
+	return 1;
+}
+
+/** intern given backtrace
+ * @param	added	set to true if backtrace definition has to be written
+ *			to trace (first time seen by trace), may be NULL
+ * @return	stack id, or 0 if backtrace could not be interned (write it inline)
+ */
+uint32_t log_malloc_stack_intern(const uint64_t *frames, int nframes, bool *added)
+{
+	int probe;
+	uint64_t hash;
+	size_t idx;
+
+	if(added)
+		*added = false;
+	if(g_stacks == NULL || nframes <= 0 || nframes > LOG_MALLOC_BACKTRACE_MAX)
+		return 0;
+
+	hash = stack_hash(frames, nframes);
+	idx  = hash & (LOG_MALLOC_STACK_TABLE_SIZE - 1);
+
+	for(probe = 0; probe < STACK_PROBES; probe++)
+	{
+		struct log_malloc_stack_s *slot = &g_stacks[idx];
+		uint64_t shash = slot->hash;
+
+		/* claim empty slot */
+		if(shash == 0)
+		{
+			if(__sync_bool_compare_and_swap(&slot->hash, 0, hash))
+			{
+				uint32_t id = __sync_add_and_fetch(&g_stack_id, 1);
+
+				slot->nframes = nframes;
+				slot->logged = (added != NULL);
+				memcpy(slot->frames, frames, nframes * sizeof(frames[0]));
+				g_stack_index[id] = idx;
+				__atomic_store_n(&slot->id, id, __ATOMIC_RELEASE);
+
+				if(added)
+					*added = true;
+				return id;
+			}
+
+			shash = slot->hash;
+		}
+
+		if(shash == hash)
+		{
+			const uint32_t id = __atomic_load_n(&slot->id, __ATOMIC_ACQUIRE);
+
+			/* being inserted by other thread right now */
+			if(id == 0)
+				return 0;
+
+			if(slot->nframes == nframes
+				&& memcmp(slot->frames, frames, nframes * sizeof(frames[0])) == 0)
+			{
+				/* first use by trace */
+				if(added && !slot->logged)
+					*added = __sync_bool_compare_and_swap(&slot->logged, 0, 1);
+				return id;
+			}
+		}
+
+		idx = (idx + 1) & (LOG_MALLOC_STACK_TABLE_SIZE - 1);
+	}
+	return 0;
+}
+
+/** get frames of interned backtrace
+ * @return	number of frames, 0 if id is unknown
+ */
+int log_malloc_stack_get(uint32_t id, uint64_t *frames, int max)
+{
+	const struct log_malloc_stack_s *slot;
+
+	if(g_stacks == NULL || id == 0 || id > LOG_MALLOC_STACK_TABLE_SIZE)
+		return 0;
+
+	slot = &g_stacks[g_stack_index[id]];
+	if(__atomic_load_n(&slot->id, __ATOMIC_ACQUIRE) != id)
+		return 0;
+
+	if(max > slot->nframes)
+		max = slot->nframes;
+	memcpy(frames, slot->frames, max * sizeof(frames[0]));
+	return max;
+}
+
+/* EOF */
@@ -0,0 +1,128 @@
+/*
+ * log-malloc2 statm cache
+ *	/proc/self/statm read at most once per interval, trace records get
+ *	cached copy (rate limited refresh done by thread that finds it stale),
+ *	so traced calls do not pay for extra syscall and kernel mm walk.
+ *
+ * Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+ *
+ * License: GNU LGPLv3 (http://www.gnu.org/licenses/lgpl.html)
+ *
+ * Web:
+ *	http://devel.dob.sk/log-malloc2
+ *	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+ *	https://github.com/samsk/log-malloc2 (git repo)
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "log-malloc2.h"
+#include "log-malloc2_internal.h"
+
+/* statm line is 7 numbers, in pages */
+#define STATM_SIZE	128
+
+/* cache state, data is guarded by sequence counter (odd - update in progress) */
+static struct {
+	uint64_t interval;		/* ns, 0 - disabled */
+	volatile uint64_t next;		/* next refresh time */
+	volatile uint32_t seq;
+	volatile int busy;		/* refresh in progress */
+	volatile size_t len;
+	char data[STATM_SIZE];
+} g_statm __attribute__((__aligned__(LOG_MALLOC_CACHELINE)));
+
+/* re-read statm, only one thread refreshes, others keep using old copy */
+static void statm_refresh(const log_malloc_ctx_t *ctx, uint64_t now)
+{
+	ssize_t n;
+	char data[STATM_SIZE];
+
+	if(g_statm.busy || !__sync_bool_compare_and_swap(&g_statm.busy, 0, 1))
+		return;
+
+	/* read outside of seq section, readers are not blocked by syscall */
+	if((n = pread(ctx->statm_fd, data, sizeof(data), 0)) > 0)
+	{
+		__sync_fetch_and_add(&g_statm.seq, 1);
+		memcpy(g_statm.data, data, n);
+		g_statm.len = n;
+		__sync_fetch_and_add(&g_statm.seq, 1);
+	}
+
+	g_statm.next = now + g_statm.interval;
+	__sync_lock_release(&g_statm.busy);
+	return;
+}
+
+/*
+ *  INTERNAL API FUNCTIONS
+ */
+
+/** enable statm cache
+ * @param	interval	refresh interval in ms (0 - read statm for every record)
+ */
+int log_malloc_statm_init(long interval)
+{
+	if(interval <= 0)
+		return 0;
+
+	g_statm.interval = (uint64_t)interval * 1000000ULL;
+	return 1;
+}
+
+void log_malloc_statm_atfork_child(void)
+{
+	/* thread that was refreshing is gone, child has own statm */
+	g_statm.busy = 0;
+	g_statm.seq = 0;
+	g_statm.len = 0;
+	g_statm.next = 0;
+	return;
+}
+
+/** read statm (cached if enabled)
+ * @return	bytes read, <= 0 on error
+ * @note	falls back to pread if cache is being updated
+ */
+ssize_t log_malloc_statm_read(const log_malloc_ctx_t *ctx, char *buf, size_t size)
+{
+	uint32_t seq;
+	size_t len;
+	uint64_t now;
+
+	if(g_statm.interval == 0)
+		return pread(ctx->statm_fd, buf, size, 0);
+
+	now = log_malloc_timestamp();
+	if(now >= g_statm.next)
+		statm_refresh(ctx, now);
+
+	seq = g_statm.seq;
+	__sync_synchronize();
+
+	len = g_statm.len;
+	if((seq & 1) || len == 0 || len > size)
+		return pread(ctx->statm_fd, buf, size, 0);
+	memcpy(buf, g_statm.data, len);
+
+	__sync_synchronize();
+	if(seq != g_statm.seq)
+		return pread(ctx->statm_fd, buf, size, 0);
+	return len;
+}
+
+/* EOF */
@@ -0,0 +1,84 @@
+/*
+ * log-malloc2 side table
+ *	Metadata of blocks without header (LOG_MALLOC_HEADERLESS, and blocks
+ *	whose alignment header would break) keyed by user pointer. Every stripe
+ *	of block hash grows on its own, so user memory is left untouched and
+ *	footprint under tool stays realistic.
+ *
+ * Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+ *
+ * License: GNU LGPLv3 (http://www.gnu.org/licenses/lgpl.html)
+ *
+ * Web:
+ *	http://devel.dob.sk/log-malloc2
+ *	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+ *	https://github.com/samsk/log-malloc2 (git repo)
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "log-malloc2.h"
+#include "log-malloc2_internal.h"
+
+/* initial stripe size (slots, power of 2), stripe doubles at 3/4 load */
+#define TABLE_STRIPE_MIN	256
+
+static log_malloc_hash_t g_table = { sizeof(log_malloc_meta_t), TABLE_STRIPE_MIN, true };
+
+/*
+ *  INTERNAL API FUNCTIONS
+ */
+void log_malloc_table_atfork_child(void)
+{
+	log_malloc_hash_atfork_child(&g_table);
+	return;
+}
+
+/** add block metadata (meta->ptr is the key)
+ * @return	false if table can not grow (block stays untracked)
+ */
+bool log_malloc_table_add(const log_malloc_meta_t *meta)
+{
+	/* counted before insert, so lookup of block is never skipped */
+	(void)__sync_fetch_and_add(&log_malloc_ctx_get()->side_table, 1);
+	if(!log_malloc_hash_add(&g_table, meta))
+	{
+		(void)__sync_fetch_and_sub(&log_malloc_ctx_get()->side_table, 1);
+		return false;
+	}
+	return true;
+}
+
+/** remove block from table
+ * @param	meta	removed metadata (can be NULL)
+ * @return	false if block is not in table
+ */
+bool log_malloc_table_del(const void *ptr, log_malloc_meta_t *meta)
+{
+	if(!log_malloc_hash_del(&g_table, (uintptr_t)ptr, meta))
+		return false;
+
+	(void)__sync_fetch_and_sub(&log_malloc_ctx_get()->side_table, 1);
+	return true;
+}
+
+/** check if block is in table */
+bool log_malloc_table_has(const void *ptr)
+{
+	return log_malloc_hash_has(&g_table, (uintptr_t)ptr);
+}
+
+/* EOF */
@@ -0,0 +1,133 @@
+/*
+ * log-malloc2 per-thread accounting
+ *	Memory used by calling thread (allocated minus released by it) and
+ *	optional per-thread quota, all kept in thread-local storage. Quota is
+ *	checked by single comparison, crossing it calls user callback or writes
+ *	'# QUOTA' trace marker (reported again after usage drops below quota).
+ *
+ * Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+ *
+ * License: GNU LGPLv3 (http://www.gnu.org/licenses/lgpl.html)
+ *
+ * Web:
+ *	http://devel.dob.sk/log-malloc2
+ *	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+ *	https://github.com/samsk/log-malloc2 (git repo)
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "log-malloc2.h"
+#include "log-malloc2_internal.h"
+
+__thread log_malloc_thread_t log_malloc_thread = { 0, 0, 0, NULL, false, false };
+
+/* quota of threads that did not set own (LOG_MALLOC_THREAD_QUOTA) */
+static int64_t g_quota = 0;
+
+/* write quota marker to trace fd (or stderr, if trace is disabled) */
+static void thread_quota_mark(const log_malloc_thread_t *t)
+{
+	int s, w;
+	char buf[128];
+	const log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	s = snprintf(buf, sizeof(buf), "# QUOTA tid=%" PRIu32 " used=%" PRId64 " quota=%" PRId64 "\n",
+		log_malloc_gettid(), t->used, t->quota);
+
+	if(ctx->memlog_disabled)
+		w = write(STDERR_FILENO, buf, s);
+	else
+		w = log_malloc_write_text(ctx, buf, s);
+	return;
+}
+
+static inline void thread_set_quota(log_malloc_thread_t *t, int64_t quota)
+{
+	t->init  = true;
+	t->rearm = false;
+	t->quota = quota;
+	t->limit = (quota > 0) ? quota : INT64_MAX;
+	return;
+}
+
+/*
+ *  INTERNAL API FUNCTIONS
+ */
+
+/** set default per-thread quota
+ * @param	quota	BYTES[k|m]
+ */
+int log_malloc_thread_init(const char *quota)
+{
+	char *end = NULL;
+	int64_t val;
+
+	if(quota == NULL || quota[0] == '\0')
+		return 0;
+
+	val = strtoll(quota, &end, 10);
+	if(end && (*end == 'k' || *end == 'K'))
+		val <<= 10;
+	else if(end && (*end == 'm' || *end == 'M'))
+		val <<= 20;
+
+	g_quota = (val > 0) ? val : 0;
+	return (g_quota != 0);
+}
+
+/* slow path of log_malloc_thread_add(), usage went over limit */
+void log_malloc_thread_over(void)
+{
+	log_malloc_thread_t *t = &log_malloc_thread;
+
+	/* first allocation in thread, pick default quota */
+	if(!t->init)
+	{
+		thread_set_quota(t, g_quota);
+		if(t->used <= t->limit)
+			return;
+	}
+
+	/* report once, until usage drops below quota (callback may allocate) */
+	t->limit = INT64_MAX;
+	t->rearm = true;
+
+	if(t->cb)
+		t->cb(t->used, t->quota);
+	else
+		thread_quota_mark(t);
+	return;
+}
+
+/** set quota of calling thread
+ * @param	quota	bytes, 0 - no quota
+ * @param	cb	callback, NULL - write trace marker
+ */
+void log_malloc_thread_quota(int64_t quota, log_malloc_quota_cb_t cb)
+{
+	log_malloc_thread_t *t = &log_malloc_thread;
+
+	t->cb = cb;
+	thread_set_quota(t, quota);
+
+	/* already over */
+	if(t->used > t->limit)
+		log_malloc_thread_over();
+	return;
+}
+
+/* EOF */
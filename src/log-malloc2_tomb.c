@@ -0,0 +1,282 @@
+/*
+ * log-malloc2 batched frees
+ *	Frees of blocks allocated by library (without backtrace) are kept as
+ *	tombstones in per-thread batch and written as single record, instead of
+ *	trace record (and statm read and write syscall) for every free. Memory
+ *	is released only after batch record is written (or queued to trace
+ *	buffer, that keeps global record order), so freed address can not be
+ *	reused (and logged by malloc) before its free.
+ *
+ * Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+ *
+ * License: GNU LGPLv3 (http://www.gnu.org/licenses/lgpl.html)
+ *
+ * Web:
+ *	http://devel.dob.sk/log-malloc2
+ *	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+ *	https://github.com/samsk/log-malloc2 (git repo)
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "log-malloc2.h"
+#include "log-malloc2_internal.h"
+
+/* batch states */
+#define BATCH_OWNED	1
+#define BATCH_ORPHAN	2	/* thread finished, batch can be reused */
+
+/* thread batch, linked forever (batches of finished threads are reused) */
+struct log_malloc_batch_s {
+	struct log_malloc_batch_s *next;
+	volatile int lock;	/* owner, or fini flush */
+	volatile int state;
+	uint32_t tid;		/* owner thread (0 - not known yet) */
+	unsigned int count;
+	int64_t mem_used;	/* usage after last free */
+	int64_t mem_rused;
+	log_malloc_tomb_t tombs[LOG_MALLOC_FREE_BATCH_MAX];
+};
+
+/* no batch (thread is finishing), frees are logged directly */
+#define BATCH_NONE	((struct log_malloc_batch_s *)0x01)
+
+static struct {
+	struct log_malloc_batch_s *batches;
+	void (*release)(void *ptr);
+#ifdef HAVE_LIBPTHREAD
+	pthread_key_t key;
+	pthread_once_t key_once;
+#endif
+} g_tomb = {
+	NULL,
+	NULL,
+#ifdef HAVE_LIBPTHREAD
+	0,
+	PTHREAD_ONCE_INIT,
+#endif
+};
+
+static __thread struct log_malloc_batch_s *t_batch = NULL;
+
+static inline void batch_lock(struct log_malloc_batch_s *batch)
+{
+	while(__sync_lock_test_and_set(&batch->lock, 1))
+		while(batch->lock);
+	return;
+}
+
+static inline void batch_unlock(struct log_malloc_batch_s *batch)
+{
+	__sync_lock_release(&batch->lock);
+	return;
+}
+
+/* write batch record and release memory, batch must be locked */
+static void batch_flush(const log_malloc_ctx_t *ctx, struct log_malloc_batch_s *batch)
+{
+	int w;
+	size_t len;
+	unsigned int ii;
+	char buf[LOG_MALLOC_FREES_BUFSIZE] __attribute__((__aligned__(8)));
+	const log_malloc_event_t ev = { LOG_MALLOC_EV_FREES, 0, false,
+		batch->count, NULL, NULL, 0, 0,
+		batch->mem_used, batch->mem_rused,
+		(ctx->tid) ? batch->tid : 0, 0 };
+
+	if(batch->count == 0)
+		return;
+
+	len = log_malloc_format_frees(ctx, &ev, batch->tombs, buf);
+	w = log_malloc_write(ctx, buf, len);
+
+	for(ii = 0; ii < batch->count; ii++)
+		g_tomb.release((void *)batch->tombs[ii].ptr);
+	batch->count = 0;
+	return;
+}
+
+#ifdef HAVE_LIBPTHREAD
+static void batch_release(void *arg)
+{
+	struct log_malloc_batch_s *batch = arg;
+
+	/* frees from later destructors are logged directly */
+	t_batch = BATCH_NONE;
+
+	batch_lock(batch);
+	batch_flush(log_malloc_ctx_get(), batch);
+	batch_unlock(batch);
+
+	__atomic_store_n(&batch->state, BATCH_ORPHAN, __ATOMIC_RELEASE);
+	return;
+}
+
+static void batch_key_init(void)
+{
+	(void)pthread_key_create(&g_tomb.key, batch_release);
+	return;
+}
+#endif
+
+static struct log_malloc_batch_s *batch_get(void)
+{
+	struct log_malloc_batch_s *batch;
+
+	/* no batch while registering (setspecific may allocate) */
+	t_batch = BATCH_NONE;
+
+	/* reuse batch of finished thread */
+	for(batch = g_tomb.batches; batch != NULL; batch = batch->next)
+	{
+		if(batch->state == BATCH_ORPHAN
+			&& __sync_bool_compare_and_swap(&batch->state, BATCH_ORPHAN, BATCH_OWNED))
+			goto done;
+	}
+
+	/* mmap, to not recurse into malloc */
+	batch = mmap(NULL, sizeof(*batch), PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(batch == MAP_FAILED)
+	{
+		t_batch = NULL;
+		return NULL;
+	}
+
+	batch->lock  = 0;
+	batch->state = BATCH_OWNED;
+	batch->count = 0;
+
+	do
+	{
+		batch->next = g_tomb.batches;
+	} while(!__sync_bool_compare_and_swap(&g_tomb.batches, batch->next, batch));
+
+done:
+	batch->tid = 0;
+#ifdef HAVE_LIBPTHREAD
+	pthread_once(&g_tomb.key_once, batch_key_init);
+	(void)pthread_setspecific(g_tomb.key, batch);
+#endif
+	t_batch = batch;
+	return batch;
+}
+
+/*
+ *  INTERNAL API FUNCTIONS
+ */
+
+/** enable batched frees
+ * @param	batch	frees per record (0 - disabled)
+ * @param	release	releases memory of freed block (user pointer)
+ */
+int log_malloc_tomb_init(unsigned int batch, void (*release)(void *ptr))
+{
+	log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	if(batch == 0 || ctx->memlog_disabled)
+		return 0;
+
+	/* dropped batch record would lose frees of already released memory */
+	if(log_malloc_buffer_lossy())
+	{
+		fprintf(stderr, "\n*** log-malloc: batched frees disabled, trace buffer drops records\n\n");
+		return 0;
+	}
+
+	g_tomb.release = release;
+	ctx->free_batch = (batch > LOG_MALLOC_FREE_BATCH_MAX) ? LOG_MALLOC_FREE_BATCH_MAX : batch;
+	return 1;
+}
+
+/** add freed block to batch of calling thread
+ * @return	false if block was not batched (log and release it directly)
+ */
+bool log_malloc_tomb_add(const void *ptr, size_t size, uint32_t atid,
+		int64_t mem_used, int64_t mem_rused)
+{
+	log_malloc_tomb_t *tomb;
+	struct log_malloc_batch_s *batch = t_batch;
+	const log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	if(batch == BATCH_NONE || (batch == NULL && (batch = batch_get()) == NULL))
+		return false;
+
+	batch_lock(batch);
+
+	/* batching stopped by fini */
+	if(ctx->free_batch == 0)
+	{
+		batch_unlock(batch);
+		return false;
+	}
+
+	if(batch->tid == 0)
+		batch->tid = log_malloc_gettid();
+
+	tomb = &batch->tombs[batch->count++];
+	tomb->ptr  = ptr;
+	tomb->size = size;
+	tomb->atid = atid;
+	batch->mem_used  = mem_used;
+	batch->mem_rused = mem_rused;
+
+	if(batch->count >= ctx->free_batch)
+		batch_flush(ctx, batch);
+
+	batch_unlock(batch);
+	return true;
+}
+
+void log_malloc_tomb_atfork_child(void)
+{
+	struct log_malloc_batch_s *batch;
+
+	/* parent writes its frees, child only drops them (memory stays) */
+	for(batch = g_tomb.batches; batch != NULL; batch = batch->next)
+	{
+		batch->lock  = 0;
+		batch->count = 0;
+		batch->tid   = 0;
+		if(batch != t_batch)
+			batch->state = BATCH_ORPHAN;
+	}
+	return;
+}
+
+/* flush batches of all threads and stop batching */
+void log_malloc_tomb_fini(void)
+{
+	struct log_malloc_batch_s *batch;
+	log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	if(ctx->free_batch == 0)
+		return;
+
+	ctx->free_batch = 0;
+	__sync_synchronize();
+
+	for(batch = g_tomb.batches; batch != NULL; batch = batch->next)
+	{
+		batch_lock(batch);
+		batch_flush(ctx, batch);
+		batch_unlock(batch);
+	}
+	return;
+}
+
+/* EOF */
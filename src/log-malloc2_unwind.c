@@ -0,0 +1,151 @@
+/*
+ * log-malloc2 unwinding engines
+ *	Frame pointer walk and cached libunwind backtrace, none of them
+ *	allocates memory (so no recursion into malloc).
+ *
+ * Author: Samuel Behan <_samuel_._behan_(at)_dob_._sk> (C) 2013-2015
+ *
+ * License: GNU LGPLv3 (http://www.gnu.org/licenses/lgpl.html)
+ *
+ * Web:
+ *	http://devel.dob.sk/log-malloc2
+ *	http://blog.dob.sk/category/devel/log-malloc2 (howto, tutorials)
+ *	https://github.com/samsk/log-malloc2 (git repo)
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	1
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef HAVE_UNWIND
+/* speedup unwinding */
+#define UNW_LOCAL_ONLY 1
+
+#include <libunwind.h>
+#endif
+
+#include "log-malloc2.h"
+#include "log-malloc2_internal.h"
+
+/* max. frame size, bigger step means broken frame pointer chain */
+#ifndef LOG_MALLOC_UNWIND_FP_MAX_FRAME
+#define LOG_MALLOC_UNWIND_FP_MAX_FRAME	100000
+#endif
+
+/* main thread stack top (glibc) */
+extern void *__libc_stack_end;
+
+/*
+ *  INTERNAL API FUNCTIONS
+ */
+int log_malloc_unwind_init(const char *engine)
+{
+	log_malloc_ctx_t *ctx = log_malloc_ctx_get();
+
+	if(engine == NULL || engine[0] == '\0')
+		ctx->unwind = LOG_MALLOC_UNWIND_DEFAULT;
+	else if(strcmp(engine, "fp") == 0)
+		ctx->unwind = LOG_MALLOC_UNWIND_FP;
+	else if(strcmp(engine, "none") == 0)
+		ctx->unwind = LOG_MALLOC_UNWIND_NONE;
+#ifdef HAVE_UNWIND
+	else if(strcmp(engine, "libunwind") == 0)
+		ctx->unwind = LOG_MALLOC_UNWIND_LIBUNWIND;
+#endif
+#ifdef HAVE_BACKTRACE
+	else if(strcmp(engine, "glibc") == 0)
+		ctx->unwind = LOG_MALLOC_UNWIND_GLIBC;
+#endif
+	else
+	{
+		fprintf(stderr, "\n*** log-malloc: unknown or unsupported unwind engine '%s'\n\n",
+			engine);
+		return -1;
+	}
+
+#ifdef HAVE_UNWIND
+	/* per-thread cache of unwind info, keyed by IP */
+	if(ctx->unwind == LOG_MALLOC_UNWIND_LIBUNWIND)
+		unw_set_caching_policy(unw_local_addr_space, UNW_CACHE_PER_THREAD);
+#endif
+	return ctx->unwind;
+}
+
+/** walk frame pointers chain
+ * @param	fp	frame address of first frame (its return address is frames[0])
+ * @note	requires code built with -fno-omit-frame-pointer, chain is followed
+ *		only while it looks sane (growing up, small steps, aligned)
+ */
+int log_malloc_unwind_fp(const void *fp, uint64_t *frames, int max)
+{
+	int nframes = 0;
+	const uintptr_t *frame = fp;
+	const uintptr_t stack_end = (uintptr_t)__libc_stack_end;
+
+	while(nframes < max)
+	{
+		const uintptr_t *next;
+
+		if(frame == NULL || ((uintptr_t)frame & (sizeof(*frame) - 1)) != 0)
+			break;
+
+		/* bottom frame */
+		if(frame[1] < 4096)
+			break;
+		frames[nframes++] = frame[1];
+
+		/* stack grows down, so callers frames are above */
+		next = (const uintptr_t *)frame[0];
+		if(next <= frame
+			|| (uintptr_t)next - (uintptr_t)frame > LOG_MALLOC_UNWIND_FP_MAX_FRAME)
+			break;
+
+		/* do not step out of main thread stack */
+		if((uintptr_t)frame < stack_end && (uintptr_t)next + 2 * sizeof(*next) > stack_end)
+			break;
+
+		frame = next;
+	}
+	return nframes;
+}
+
+#ifdef HAVE_UNWIND
+/** libunwind backtrace (with per-IP unwind info cache)
+ * @param	skip	frames to skip above caller of this function
+ */
+int log_malloc_unwind_cached(uint64_t *frames, int max, int skip)
+{
+	int nframes = 0;
+	unw_context_t uc;
+	unw_cursor_t cursor;
+
+	if(unw_getcontext(&uc) != 0 || unw_init_local(&cursor, &uc) != 0)
+		return 0;
+
+	while(nframes < max && unw_step(&cursor) > 0)
+	{
+		unw_word_t ip = 0;
+
+		if(skip > 0)
+		{
+			skip--;
+			continue;
+		}
+
+		unw_get_reg(&cursor, UNW_REG_IP, &ip);
+		frames[nframes++] = ip;
+	}
+	return nframes;
+}
+#endif
+
+/* EOF */